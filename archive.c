@@ -0,0 +1,390 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Output archive (-A): everything the program
+ * prints is kept as an LZ4 frame in the runs
+ * directory (see runs.c), "<id>.lz4", readable
+ * with lz4(1).
+ *
+ * Output is only copied into a queue on the way
+ * through, compression and writing happen on a
+ * thread of its own. Passing output on never
+ * waits for it: if the queue is full, output is
+ * left out of the archive and a marker saying
+ * how much was lost takes its place.
+ *
+ * The compressor sleeps on a futex. It is woken
+ * once a full block is queued, and writes out
+ * whatever is queued after ARCHIVE_FLUSH seconds
+ * without one, so little is lost if we are killed.
+ * What is written out is indexed behind it, on
+ * another thread, see index.c.
+ */
+
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include "archive.h"
+#include "lz4.h"
+#include "runs.h"
+#include "config.h"
+
+#define ARCHIVE_WBUF    (256 * 1024)
+#define ARCHIVE_ALIGN   4096
+
+/* LZ4 frame format */
+#define FRAME_MAGIC     0x184d2204
+#define FRAME_FLG       0x70    /* Version 1, independent blocks, block checksums */
+#define FRAME_BD        0x40    /* 64 KiB blocks */
+#define BLOCK_STORED    0x80000000U
+
+/* Values of `sleeping' */
+#define AWAKE           0
+#define WAIT_BLOCK      1       /* Wake for a full block */
+#define WAIT_ANY        2       /* Nothing pending, wake for anything */
+
+static void
+put_le32(char *p, uint32_t v)
+{
+    p[0] = (char)v;
+    p[1] = (char)(v >> 8);
+    p[2] = (char)(v >> 16);
+    p[3] = (char)(v >> 24);
+}
+
+static void
+futex_wake(_Atomic uint32_t *addr)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+/*
+ * Writes out the write buffer, giving up on
+ * the archive on errors.
+ */
+static void
+wbuf_flush(struct archive *a)
+{
+    size_t off = 0;
+    ssize_t n;
+
+    while (a->fd >= 0 && off < a->wlen) {
+        if ((n = write(a->fd, a->wbuf + off, a->wlen - off)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            close(a->fd);
+            a->fd = -1;
+            break;
+        }
+        off += n;
+    }
+    a->foff += a->wlen;
+    a->wlen = 0;
+    if (a->fd >= 0) {
+        index_written(&a->index, a->foff);
+    }
+}
+
+/*
+ * Adds a block for the `n' bytes at `p' to the
+ * write buffer, stored as is if they do not
+ * compress.
+ */
+static void
+put_block(struct archive *a, const char *p, size_t n)
+{
+    char *blk;
+    size_t len;
+
+    if (ARCHIVE_WBUF - a->wlen < 4 + LZ4_BLOCK_MAX + 4) {
+        wbuf_flush(a);
+    }
+
+    blk = a->wbuf + a->wlen;
+    len = lz4_compress(p, n, blk + 4, n - 1);
+    if (len == 0) {
+        memcpy(blk + 4, p, n);
+        len = n;
+        put_le32(blk, (uint32_t)len | BLOCK_STORED);
+    } else {
+        put_le32(blk, (uint32_t)len);
+    }
+    put_le32(blk + 4 + len, xxh32(blk + 4, len, 0));
+    a->wlen += 4 + len + 4;
+}
+
+/*
+ * Moves up to a block of queued output into `buf',
+ * returns its size.
+ */
+static size_t
+queue_take(struct archive *a, char *buf, uint64_t avail)
+{
+    uint64_t tail = atomic_load_explicit(&a->tail, memory_order_relaxed);
+    size_t n = avail < LZ4_BLOCK_MAX ? avail : LZ4_BLOCK_MAX;
+    size_t off = tail & (a->size - 1);
+    size_t first = a->size - off < n ? a->size - off : n;
+
+    memcpy(buf, a->queue + off, first);
+    memcpy(buf + first, a->queue, n - first);
+    atomic_store_explicit(&a->tail, tail + n, memory_order_release);
+    return n;
+}
+
+static uint64_t
+queued(struct archive *a)
+{
+    return atomic_load(&a->head) -
+           atomic_load_explicit(&a->tail, memory_order_relaxed);
+}
+
+/*
+ * The compressor thread.
+ */
+static void *
+archive_main(void *arg)
+{
+    struct archive *a = arg;
+    struct timespec ts = { .tv_sec = ARCHIVE_FLUSH };
+    static char block[LZ4_BLOCK_MAX];
+    bool flush = false, done;
+    uint64_t avail;
+    uint32_t how;
+
+    for (;;) {
+        done = atomic_load(&a->done);
+        avail = queued(a);
+        if (avail >= LZ4_BLOCK_MAX || (avail > 0 && (flush || done))) {
+            put_block(a, block, queue_take(a, block, avail));
+            continue;
+        }
+        if (done) {
+            break;
+        }
+        if (flush) {
+            wbuf_flush(a);
+            flush = false;
+        }
+
+        /* Go to sleep, unless output came in meanwhile */
+        how = (avail > 0 || a->wlen > 0) ? WAIT_BLOCK : WAIT_ANY;
+        atomic_store(&a->sleeping, how);
+        avail = queued(a);
+        if (atomic_load(&a->done) || avail >= LZ4_BLOCK_MAX ||
+            (how == WAIT_ANY && avail > 0)) {
+            atomic_store(&a->sleeping, AWAKE);
+            continue;
+        }
+
+        if (syscall(SYS_futex, &a->sleeping, FUTEX_WAIT_PRIVATE, how,
+                    how == WAIT_BLOCK ? &ts : NULL, NULL, 0) < 0 &&
+            errno == ETIMEDOUT) {
+            flush = true;
+        }
+        atomic_store(&a->sleeping, AWAKE);
+    }
+
+    return NULL;
+}
+
+/*
+ * Starts archiving output of the run `ri'.
+ *
+ * Returns 0 on success, otherwise -1 and
+ * `a' is left unused.
+ */
+int
+archive_begin(struct archive *a, const struct run_info *ri)
+{
+    char path[256];
+    sigset_t all, old;
+    void *wbuf;
+    int error;
+
+    *a = (struct archive){ .fd = -1 };
+    if (runs_path(ri->id, ".lz4", path, sizeof(path)) < 0) {
+        return -1;
+    }
+
+    a->size = (size_t)ARCHIVE_QUEUE << 10;
+    if ((a->queue = malloc(a->size)) == NULL) {
+        return -1;
+    }
+    if (posix_memalign(&wbuf, ARCHIVE_ALIGN, ARCHIVE_WBUF) != 0) {
+        free(a->queue);
+        a->queue = NULL;
+        return -1;
+    }
+    a->wbuf = wbuf;
+
+    a->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (a->fd < 0) {
+        goto fail;
+    }
+
+    /* Frame descriptor, its checksum is the second byte of its hash */
+    put_le32(a->wbuf, FRAME_MAGIC);
+    a->wbuf[4] = FRAME_FLG;
+    a->wbuf[5] = FRAME_BD;
+    a->wbuf[6] = (char)(xxh32(a->wbuf + 4, 2, 0) >> 8);
+    a->wlen = 7;
+
+    /* Searches still work without the index, just slower */
+    index_begin(&a->index, ri->id, ri->argv, a->wlen);
+
+    /* Signals are for the main thread, e.g., SIGWINCH with -P */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    error = pthread_create(&a->thread, NULL, archive_main, a);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (error == 0) {
+        return 0;
+    }
+
+    index_end(&a->index);
+    close(a->fd);
+    unlink(path);
+    if (runs_path(ri->id, ".tri", path, sizeof(path)) == 0) {
+        unlink(path);
+    }
+fail:
+    free(a->wbuf);
+    free(a->queue);
+    a->queue = NULL;
+    return -1;
+}
+
+/*
+ * Formats the marker for output left out since
+ * the last one into `buf', returns its length.
+ */
+static size_t
+lost_mark(struct archive *a, char *buf, size_t len)
+{
+    if (a->dropped == 0) {
+        return 0;
+    }
+    return snprintf(buf, len, "\n[cmdnotify: %llu bytes not archived]\n",
+                    (unsigned long long)a->dropped);
+}
+
+/*
+ * Copies `n' bytes of output at `p' into the
+ * queue, or counts them as lost if it is full.
+ */
+void
+archive_write(struct archive *a, const char *p, size_t n)
+{
+    uint64_t head = atomic_load_explicit(&a->head, memory_order_relaxed);
+    uint64_t used = head - atomic_load_explicit(&a->tail, memory_order_acquire);
+    uint32_t how;
+    char mark[64];
+    size_t m = lost_mark(a, mark, sizeof(mark));
+
+    if (used + m + n > a->size) {
+        a->dropped += n;
+        a->lost += n;
+        return;
+    }
+
+    for (int i = 0; i < 2; ++i) {
+        const char *src = i == 0 ? mark : p;
+        size_t len = i == 0 ? m : n;
+        size_t off = head & (a->size - 1);
+        size_t first = a->size - off < len ? a->size - off : len;
+
+        memcpy(a->queue + off, src, first);
+        memcpy(a->queue, src + first, len - first);
+        head += len;
+    }
+    a->dropped = 0;
+    atomic_store(&a->head, head);
+
+    how = atomic_load(&a->sleeping);
+    if ((how == WAIT_ANY || (how == WAIT_BLOCK && used + m + n >= LZ4_BLOCK_MAX)) &&
+        atomic_exchange(&a->sleeping, AWAKE) != AWAKE) {
+        futex_wake(&a->sleeping);
+    }
+}
+
+/*
+ * Archives what is still queued and closes the
+ * archive, once its index is done.
+ *
+ * Returns the number of bytes that were
+ * left out of it.
+ */
+uint64_t
+archive_end(struct archive *a)
+{
+    char mark[64];
+    size_t m;
+
+    if (a->queue == NULL) {
+        return 0;
+    }
+
+    atomic_store(&a->done, 1);
+    atomic_exchange(&a->sleeping, AWAKE);
+    futex_wake(&a->sleeping);
+    pthread_join(a->thread, NULL);
+
+    /* Output lost at the very end has no marker yet */
+    if ((m = lost_mark(a, mark, sizeof(mark))) > 0) {
+        put_block(a, mark, m);
+    }
+
+    /* EndMark */
+    if (ARCHIVE_WBUF - a->wlen < 4) {
+        wbuf_flush(a);
+    }
+    put_le32(a->wbuf + a->wlen, 0);
+    a->wlen += 4;
+    wbuf_flush(a);
+
+    index_end(&a->index);
+    if (a->fd >= 0) {
+        close(a->fd);
+    }
+    free(a->wbuf);
+    free(a->queue);
+    a->queue = NULL;
+    return a->lost;
+}
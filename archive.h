@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "cmdnotify.h"
+#include "index.h"
+
+/*
+ * Compresses the program's output to an LZ4 frame
+ * in the runs directory on a thread of its own,
+ * see archive.c, indexed for searches. The
+ * queue in between has a single producer and a
+ * single consumer.
+ */
+struct archive {
+    char *queue;
+    size_t size;                /* Power of two */
+    _Atomic uint64_t head;      /* Written by the producer */
+    _Atomic uint64_t tail;      /* Written by the compressor */
+    _Atomic uint32_t sleeping;  /* Futex, the compressor waits on it */
+    _Atomic uint32_t done;
+    uint64_t dropped;           /* Bytes not yet marked as lost */
+    uint64_t lost;              /* Total bytes lost */
+    int fd;
+    uint64_t foff;              /* Bytes written out */
+    char *wbuf;                 /* Aligned write buffer */
+    size_t wlen;
+    struct tri_index index;
+    pthread_t thread;
+};
+
+int archive_begin(struct archive *a, const struct run_info *ri);
+void archive_write(struct archive *a, const char *p, size_t n);
+uint64_t archive_end(struct archive *a);
+
+#endif  /* !ARCHIVE_H */
@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Shared by the benchmarks "make bench" runs, see
+ * bench/. Each prints one line per case, and is
+ * run from the top of the tree.
+ */
+
+#define BENCH_NS    500000000LL     /* Time spent on a throughput case */
+
+static inline long long
+bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * Prints the throughput of `bytes' handled in `ns'.
+ */
+static inline void
+bench_rate(const char *bench, const char *what, double bytes, long long ns)
+{
+    printf("%-10s %-34s %9.0f MB/s\n", bench, what, bytes / ns * 1000.0);
+}
+
+static inline int
+bench_cmp(const void *a, const void *b)
+{
+    const long long x = *(const long long *)a, y = *(const long long *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Prints the median and 99th percentile of the
+ * `n' latencies in `ns', sorting them.
+ */
+static inline void
+bench_latency(const char *bench, const char *what, long long *ns, size_t n)
+{
+    qsort(ns, n, sizeof(*ns), bench_cmp);
+    printf("%-10s %-34s p50 %7.1f us  p99 %7.1f us\n", bench, what,
+           ns[n / 2] / 1000.0, ns[n * 99 / 100] / 1000.0);
+}
+
+#endif  /* !BENCH_H */
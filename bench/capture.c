@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Throughput of passing a program's output on to a
+ * file in /dev/shm: written there by the program
+ * itself, through cmdnotify, and through cmdnotify
+ * -T with tee(2)/splice(2) and with read()/write()
+ * (forced by O_APPEND, which splice(2) refuses).
+ *
+ * Runs bin/cmdnotify, so not as root.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "bench.h"
+
+#define OUTPUT_SIZE (1LL << 30)
+#define CHUNK       (64 * 1024)
+
+/*
+ * Writes `n' bytes to stdout, the program
+ * whose output is passed on.
+ */
+static int
+generate(long long n)
+{
+    static char buf[CHUNK];
+    ssize_t r;
+
+    memset(buf, 'x', sizeof(buf));
+    while (n > 0) {
+        if ((r = write(STDOUT_FILENO, buf, n < CHUNK ? n : CHUNK)) < 0) {
+            return 1;
+        }
+        n -= r;
+    }
+    return 0;
+}
+
+/*
+ * Runs `argv' with its stdout on the empty
+ * file `path' opened with `flags'.
+ *
+ * Returns the time it took, or -1 if it
+ * failed.
+ */
+static long long
+run(char **argv, const char *path, int flags)
+{
+    long long start = bench_now();
+    int fd, status;
+    pid_t pid;
+
+    if ((fd = open(path, O_WRONLY | O_TRUNC | flags)) < 0) {
+        return -1;
+    }
+
+    if ((pid = fork()) == 0) {
+        dup2(fd, STDOUT_FILENO);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    close(fd);
+
+    if (pid < 0 || waitpid(pid, &status, 0) < 0 ||
+        !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        return -1;
+    }
+    return bench_now() - start;
+}
+
+int
+main(int argc, char **argv)
+{
+    char cmd[256], path[] = "/dev/shm/cmdnotify-bench-XXXXXX";
+    char *direct[] = { "/bin/sh", "-c", cmd, NULL };
+    char *wrapped[] = { "bin/cmdnotify", "sh", "-c", cmd, NULL };
+    char *tail[] = { "bin/cmdnotify", "-T", "sh", "-c", cmd, NULL };
+    const struct {
+        const char *what;
+        char **argv;
+        int flags;
+    } cases[] = {
+        { "direct", direct, 0 },
+        { "cmdnotify", wrapped, 0 },
+        { "cmdnotify -T, tee/splice", tail, 0 },
+        { "cmdnotify -T, read/write", tail, O_APPEND },
+    };
+    long long ns;
+    int fd;
+
+    if (argc == 3 && strcmp(argv[1], "generate") == 0) {
+        return generate(atoll(argv[2]));
+    }
+
+    if (geteuid() == 0) {
+        printf("%-10s skipped, cmdnotify does not run as root\n", "capture");
+        return 0;
+    }
+
+    if ((fd = mkstemp(path)) < 0) {
+        perror("capture");
+        return 1;
+    }
+    close(fd);
+
+    /* Only programs in /bin are run, see create_progpath() */
+    snprintf(cmd, sizeof(cmd), "exec %s generate %lld", argv[0], OUTPUT_SIZE);
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        if ((ns = run(cases[i].argv, path, cases[i].flags)) < 0) {
+            fprintf(stderr, "capture: %s failed\n", cases[i].what);
+            unlink(path);
+            return 1;
+        }
+        bench_rate("capture", cases[i].what, OUTPUT_SIZE, ns);
+    }
+
+    unlink(path);
+    return 0;
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Linked into the cmdnotifyd that bench/daemon.c
+ * runs, with notify() and deliver_post() wrapped
+ * (ld --wrap) so that nothing is shown. Each message
+ * is timed from when the client sent it (exit_ns)
+ * to when it is queued for delivery. Once
+ * BENCH_EVENTS of them came in, and the delivery
+ * thread is done, a line with
+ *
+ *      <events> <ns> <p50 ns> <p99 ns> <cpu ns> <delivered>
+ *
+ * is written to stdout and the daemon exits.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "bench.h"
+#include "../notify.h"
+
+#define DRAIN_NS    50000000LL  /* Delivery done once idle this long */
+
+void __real_deliver_post(const struct notification *n);
+
+static long long *lat;
+static long events, count;
+static long long first, cpu_first;
+static _Atomic long delivered;
+
+static long long
+cpu_now(void)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000LL +
+           (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000LL;
+}
+
+int
+__wrap_notify(const struct notification *n)
+{
+    (void)n;
+    atomic_fetch_add(&delivered, 1);
+    return 0;
+}
+
+void
+__wrap_deliver_post(const struct notification *n)
+{
+    long long now = bench_now(), ns;
+    long last;
+
+    if (lat == NULL) {
+        if ((events = atol(getenv("BENCH_EVENTS"))) <= 0 ||
+            (lat = malloc(events * sizeof(*lat))) == NULL) {
+            _exit(1);
+        }
+        first = now;
+        cpu_first = cpu_now();
+    }
+
+    lat[count++] = now - n->exit_ns;
+    __real_deliver_post(n);
+    if (count < events) {
+        return;
+    }
+
+    /* Counts the CPU time delivering them took too */
+    ns = now - first;
+    do {
+        last = atomic_load(&delivered);
+        usleep(DRAIN_NS / 1000);
+    } while (atomic_load(&delivered) != last);
+
+    qsort(lat, count, sizeof(*lat), bench_cmp);
+    printf("%ld %lld %lld %lld %lld %ld\n", count, ns, lat[count / 2],
+           lat[count * 99 / 100], cpu_now() - cpu_first,
+           atomic_load(&delivered));
+    fflush(stdout);
+    _exit(0);
+}
@@ -0,0 +1,234 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * cmdnotifyd under load: CLIENTS connections each
+ * sending their share of RATE notifications a
+ * second for SECONDS, to the daemon served from an
+ * io_uring and from epoll. Both are built with
+ * bench/daemon-stub.c, which reports the rate
+ * they came in at, the time from send to the
+ * delivery queue, and the CPU time per message
+ * (delivery thread included), then exits.
+ *
+ * It runs the daemon, so not as root.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "bench.h"
+#include "../daemon.h"
+
+#define CLIENTS     4
+#define SECONDS     2
+#define CONNECT_MS  2000    /* For the daemon to listen */
+
+struct client {
+    const char *path;
+    long rate;              /* Per second */
+    long total;
+};
+
+/*
+ * A client, sending a transient notification like
+ * cmdnotify's at `rate' per second, in batches
+ * once a millisecond.
+ */
+static void *
+client_main(void *arg)
+{
+    const struct client *c = arg;
+    struct sockaddr_un sun = { .sun_family = AF_UNIX };
+    struct daemon_msg m = {
+        .magic = DAEMON_MAGIC,
+        .version = DAEMON_VERSION,
+        .flags = DAEMON_TRANSIENT,
+        .summary = "Success",
+        .body = "'make' returned 0"
+    };
+    size_t len = offsetof(struct daemon_msg, body) + strlen(m.body) + 1;
+    long long start;
+    struct timespec ts;
+    long sent = 0, due;
+    int fd;
+
+    snprintf(sun.sun_path, sizeof(sun.sun_path), "%s", c->path);
+    if ((fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) < 0) {
+        return (void *)-1;
+    }
+    for (int i = 0; connect(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0; ++i) {
+        if (i == CONNECT_MS) {
+            close(fd);
+            return (void *)-1;
+        }
+        usleep(1000);
+    }
+
+    start = bench_now();
+    for (long ms = 1; sent < c->total; ++ms) {
+        due = c->rate * ms / 1000;
+        for (; sent < due && sent < c->total; ++sent) {
+            m.key = sent;
+            m.exit_ns = bench_now();
+            if (send(fd, &m, len, 0) < 0) {
+                close(fd);
+                return (void *)-1;
+            }
+        }
+        ts.tv_sec = (start + ms * 1000000LL) / 1000000000LL;
+        ts.tv_nsec = (start + ms * 1000000LL) % 1000000000LL;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    }
+    close(fd);
+    return NULL;
+}
+
+/*
+ * Runs the daemon at `daemon' and CLIENTS clients
+ * sending `rate' messages a second between them,
+ * then prints what it reported.
+ *
+ * Returns 0 on success, otherwise -1.
+ */
+static int
+run(const char *daemon, const char *what, const char *path, long rate)
+{
+    struct client c = { path, rate / CLIENTS, rate / CLIENTS * SECONDS };
+    pthread_t threads[CLIENTS];
+    long events, delivered;
+    long long ns, p50, p99, cpu;
+    char buf[256], env[64], label[64];
+    void *res;
+    int pfd[2], status, failed = 0;
+    ssize_t n;
+    pid_t pid;
+
+    if (pipe2(pfd, O_CLOEXEC) < 0) {
+        return -1;
+    }
+    snprintf(env, sizeof(env), "%ld", c.total * CLIENTS);
+    if ((pid = fork()) == 0) {
+        setenv("BENCH_EVENTS", env, 1);
+        dup2(pfd[1], STDOUT_FILENO);
+        execl(daemon, daemon, (char *)NULL);
+        _exit(127);
+    }
+    close(pfd[1]);
+    if (pid < 0) {
+        close(pfd[0]);
+        return -1;
+    }
+
+    for (int i = 0; i < CLIENTS; ++i) {
+        pthread_create(&threads[i], NULL, client_main, &c);
+    }
+    for (int i = 0; i < CLIENTS; ++i) {
+        pthread_join(threads[i], &res);
+        failed |= res != NULL;
+    }
+
+    n = failed ? -1 : read(pfd[0], buf, sizeof(buf) - 1);
+    close(pfd[0]);
+    if (n <= 0) {
+        kill(pid, SIGKILL);
+        waitpid(pid, &status, 0);
+        return -1;
+    }
+    waitpid(pid, &status, 0);
+    unlink(path);
+
+    buf[n] = '\0';
+    if (sscanf(buf, "%ld %lld %lld %lld %lld %ld", &events, &ns, &p50, &p99,
+               &cpu, &delivered) != 6) {
+        return -1;
+    }
+    snprintf(label, sizeof(label), "%s, %ld/s", what, rate);
+    printf("%-10s %-34s %8.0f/s  p99 %8.1f us  cpu %5.2f us  dropped %ld\n",
+           "daemon", label, events * 1e9 / ns, p99 / 1000.0,
+           (double)cpu / events / 1000.0, events - delivered);
+    return 0;
+}
+
+int
+main(void)
+{
+    const struct {
+        const char *daemon;
+        const char *what;
+    } daemons[] = {
+        { "bin/bench/cmdnotifyd-uring", "io_uring" },
+        { "bin/bench/cmdnotifyd-epoll", "epoll" }
+    };
+    const long rates[] = { 10000, 100000, 1000000 };
+    char dir[] = "/tmp/cmdnotify-bench.XXXXXX", path[128];
+    int ret = 0;
+
+    if (geteuid() == 0) {
+        printf("%-10s skipped, cmdnotifyd does not run as root\n", "daemon");
+        return 0;
+    }
+
+    if (mkdtemp(dir) == NULL) {
+        perror("daemon");
+        return 1;
+    }
+    /* Nothing to show it on, or to deliver to from before */
+    setenv("XDG_RUNTIME_DIR", dir, 1);
+    setenv("XDG_STATE_HOME", dir, 1);
+    unsetenv("DBUS_SESSION_BUS_ADDRESS");
+    snprintf(path, sizeof(path), "%s/cmdnotify/%s", dir, DAEMON_SOCK);
+
+    for (size_t d = 0; d < sizeof(daemons) / sizeof(daemons[0]); ++d) {
+        for (size_t r = 0; r < sizeof(rates) / sizeof(rates[0]); ++r) {
+            if (run(daemons[d].daemon, daemons[d].what, path, rates[r]) < 0) {
+                fprintf(stderr, "daemon: %s failed\n", daemons[d].daemon);
+                ret = 1;
+                goto out;
+            }
+        }
+    }
+out:
+    snprintf(path, sizeof(path), "rm -r %s", dir);
+    if (system(path) != 0) {
+        ret = 1;
+    }
+    return ret;
+}
@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Time the shell hooks add to each prompt: a
+ * cmdnotify-hook start and end event, run the
+ * way the shell runs them, next to running
+ * /bin/true and to sending the datagram without
+ * a new process. cmdnotifyd is stood in for by
+ * a socket under a temporary XDG_RUNTIME_DIR,
+ * drained after each event.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "bench.h"
+#include "../hook.h"
+
+#define ROUNDS  2000
+
+/*
+ * Forks and runs `argv', waiting for it like
+ * the shell does.
+ *
+ * Returns the time taken, or -1 if it failed.
+ */
+static long long
+spawn(char **argv)
+{
+    long long start = bench_now();
+    int status;
+    pid_t pid;
+
+    if ((pid = fork()) == 0) {
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    if (pid < 0 || waitpid(pid, &status, 0) < 0 ||
+        !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        return -1;
+    }
+    return bench_now() - start;
+}
+
+/*
+ * What cmdnotify-hook itself does for an end
+ * event, see cmdnotify-hook.c.
+ *
+ * Returns the time taken, or -1 if it failed.
+ */
+static long long
+send_end(const struct sockaddr_un *sun)
+{
+    long long start = bench_now();
+    struct hook_msg m = {
+        .magic = HOOK_MAGIC,
+        .version = HOOK_VERSION,
+        .event = HOOK_END,
+        .pid = getpid()
+    };
+    int fd;
+
+    m.time_ns = start;
+    if ((fd = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0) {
+        return -1;
+    }
+    sendto(fd, &m, offsetof(struct hook_msg, cmd) + 1, MSG_DONTWAIT,
+           (const struct sockaddr *)sun, sizeof(*sun));
+    close(fd);
+    return bench_now() - start;
+}
+
+int
+main(void)
+{
+    static long long ns[ROUNDS];
+    struct sockaddr_un sun = { .sun_family = AF_UNIX };
+    char dir[] = "/tmp/cmdnotify-bench.XXXXXX";
+    char *cases[][4] = {
+        { "/bin/true", NULL },
+        { "bin/cmdnotify-hook", "start", "make -j8 all", NULL },
+        { "bin/cmdnotify-hook", "end", "0", NULL }
+    };
+    char buf[sizeof(struct hook_msg)], what[64];
+    int sfd, ret = 0;
+
+    if (mkdtemp(dir) == NULL) {
+        perror("hook");
+        return 1;
+    }
+    setenv("XDG_RUNTIME_DIR", dir, 1);
+    snprintf(sun.sun_path, sizeof(sun.sun_path), "%s/cmdnotify", dir);
+    if (mkdir(sun.sun_path, 0700) < 0) {
+        perror("hook");
+        rmdir(dir);
+        return 1;
+    }
+    snprintf(sun.sun_path, sizeof(sun.sun_path), "%s/cmdnotify/%s", dir,
+             HOOK_SOCK);
+    if ((sfd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0 ||
+        bind(sfd, (struct sockaddr *)&sun, sizeof(sun)) < 0) {
+        perror("hook");
+        ret = 1;
+        goto out;
+    }
+
+    for (size_t i = 0; i < ROUNDS; ++i) {
+        if ((ns[i] = send_end(&sun)) < 0 ||
+            recv(sfd, buf, sizeof(buf), MSG_DONTWAIT) < 0) {
+            fprintf(stderr, "hook: sending failed\n");
+            ret = 1;
+            goto out;
+        }
+    }
+    bench_latency("hook", "socket() and sendto()", ns, ROUNDS);
+
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); ++c) {
+        for (size_t i = 0; i < ROUNDS; ++i) {
+            ns[i] = spawn(cases[c]);
+            /* /bin/true sends nothing, the hook has to */
+            if (ns[i] < 0 || (c > 0 &&
+                recv(sfd, buf, sizeof(buf), MSG_DONTWAIT) < 0)) {
+                fprintf(stderr, "hook: %s failed\n", cases[c][0]);
+                ret = 1;
+                goto out;
+            }
+        }
+        snprintf(what, sizeof(what), "%s%s%s", cases[c][0],
+                 cases[c][1] != NULL ? " " : "",
+                 cases[c][1] != NULL ? cases[c][1] : "");
+        bench_latency("hook", what, ns, ROUNDS);
+    }
+out:
+    if (sfd >= 0) {
+        close(sfd);
+        unlink(sun.sun_path);
+    }
+    snprintf(sun.sun_path, sizeof(sun.sun_path), "%s/cmdnotify", dir);
+    rmdir(sun.sun_path);
+    rmdir(dir);
+    return ret;
+}
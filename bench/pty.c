@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Latency of a keystroke echoed back by cat(1) on
+ * a terminal: run on our pseudo-terminal directly,
+ * and under cmdnotify -P, which passes keys on to
+ * the program's own terminal and its output back.
+ *
+ * The cmdnotify case runs bin/cmdnotify, so not
+ * as root.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include "bench.h"
+
+#define ROUNDS      2000
+#define TIMEOUT_MS  2000
+
+/*
+ * Sends `c' to the terminal `master' and waits
+ * for it to come back.
+ *
+ * Returns the round trip time, or -1 if it
+ * did not.
+ */
+static long long
+echo(int master, char c)
+{
+    long long start = bench_now();
+    struct pollfd pfd = { .fd = master, .events = POLLIN };
+    char buf[64];
+    ssize_t n;
+
+    if (write(master, &c, 1) != 1) {
+        return -1;
+    }
+
+    while (poll(&pfd, 1, TIMEOUT_MS) == 1) {
+        if ((n = read(master, buf, sizeof(buf))) <= 0) {
+            return -1;
+        }
+        if (memchr(buf, c, n) != NULL) {
+            return bench_now() - start;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Runs `argv' on a new raw pseudo-terminal and
+ * times ROUNDS keystrokes through it.
+ *
+ * Returns 0 on success, otherwise -1.
+ */
+static int
+run(const char *what, char **argv)
+{
+    static long long ns[ROUNDS];
+    struct termios raw;
+    char name[64];
+    int master, slave, status;
+    pid_t pid;
+
+    if ((master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC)) < 0 ||
+        grantpt(master) < 0 || unlockpt(master) < 0 ||
+        ptsname_r(master, name, sizeof(name)) != 0 ||
+        (slave = open(name, O_RDWR | O_NOCTTY | O_CLOEXEC)) < 0) {
+        return -1;
+    }
+
+    /* Keys go to cat one at a time and are echoed by it alone */
+    tcgetattr(slave, &raw);
+    cfmakeraw(&raw);
+    tcsetattr(slave, TCSANOW, &raw);
+
+    if ((pid = fork()) == 0) {
+        setsid();
+        ioctl(slave, TIOCSCTTY, 0);
+        dup2(slave, STDIN_FILENO);
+        dup2(slave, STDOUT_FILENO);
+        dup2(slave, STDERR_FILENO);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    close(slave);
+    if (pid < 0) {
+        close(master);
+        return -1;
+    }
+
+    /* The first one waits for the program to start */
+    if (echo(master, '.') < 0) {
+        goto fail;
+    }
+    for (size_t i = 0; i < ROUNDS; ++i) {
+        if ((ns[i] = echo(master, 'a' + i % 26)) < 0) {
+            goto fail;
+        }
+    }
+    bench_latency("pty", what, ns, ROUNDS);
+
+    kill(pid, SIGTERM);
+    waitpid(pid, &status, 0);
+    close(master);
+    return 0;
+fail:
+    kill(pid, SIGKILL);
+    waitpid(pid, &status, 0);
+    close(master);
+    return -1;
+}
+
+int
+main(void)
+{
+    char *direct[] = { "/bin/cat", NULL };
+    char *wrapped[] = { "bin/cmdnotify", "-P", "cat", NULL };
+
+    if (run("cat", direct) < 0) {
+        fprintf(stderr, "pty: cat failed\n");
+        return 1;
+    }
+
+    if (geteuid() == 0) {
+        printf("%-10s skipped -P, cmdnotify does not run as root\n", "pty");
+        return 0;
+    }
+    if (run("cmdnotify -P cat", wrapped) < 0) {
+        fprintf(stderr, "pty: cmdnotify -P cat failed\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Archiving and indexing output (-A) as fast as the
+ * compressor thread goes, and searching it with
+ * "cmdnotify --search", over RUNS runs of
+ * generated C-like text under a temporary
+ * XDG_STATE_HOME. Matching lines are printed to
+ * /dev/null.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include "bench.h"
+#include "../archive.h"
+#include "../index.h"
+#include "../runs.h"
+
+#define RUNS        6
+#define RUN_SIZE    (8 << 20)   /* All of them under RUNS_MAX_SIZE */
+#define WRITE_SIZE  4096
+#define RARE_EVERY  1000        /* Lines between "TODO(bench)" */
+
+/*
+ * Fills `buf' with lines of made up code, one
+ * with "needle_once" in the middle of run 3.
+ *
+ * Returns how much of it was filled.
+ */
+static size_t
+fill(char *buf, size_t len, int run, unsigned *r)
+{
+    size_t off = 0, nlines = 0;
+    char line[128];
+    int n;
+
+    for (;;) {
+        *r = *r * 1103515245 + 12345;
+        if (run == 3 && nlines == 50000) {
+            n = snprintf(line, sizeof(line), "    /* needle_once */\n");
+        } else if (nlines % RARE_EVERY == RARE_EVERY - 1) {
+            n = snprintf(line, sizeof(line), "    /* TODO(bench): %u */\n", *r >> 8);
+        } else {
+            n = snprintf(line, sizeof(line),
+                         "static int fn_%05x(struct s_%04x *p) { return p->f_%03x + %u; }\n",
+                         *r >> 12, (*r >> 4) & 0xffff, *r & 0xfff, *r >> 20);
+        }
+        if (off + n > len) {
+            return off;
+        }
+        memcpy(buf + off, line, n);
+        off += n;
+        ++nlines;
+    }
+}
+
+/*
+ * Runs index_search() for `text' with stdout
+ * on /dev/null, BENCH_NS long or at least
+ * once, and prints the time per search.
+ */
+static void
+search(const char *what, const char *text)
+{
+    long long start, ns;
+    int out = dup(STDOUT_FILENO), null = open("/dev/null", O_WRONLY);
+    size_t n = 0;
+
+    fflush(stdout);
+    dup2(null, STDOUT_FILENO);
+    start = bench_now();
+    do {
+        index_search(text);
+        fflush(stdout);
+        ++n;
+    } while ((ns = bench_now() - start) < BENCH_NS);
+    dup2(out, STDOUT_FILENO);
+    close(out);
+    close(null);
+
+    printf("%-10s %-34s %9.2f ms\n", "search", what, ns / 1e6 / n);
+}
+
+int
+main(void)
+{
+    char dir[] = "/tmp/cmdnotify-bench-XXXXXX", *text = malloc(RUN_SIZE);
+    char *argv[] = { "make", "-j8", NULL }, cmd[64];
+    struct run_info ri = { .progname = "make", .argv = argv };
+    struct archive a;
+    long long start, ns = 0;
+    double bytes = 0;
+    unsigned r = 1;
+    size_t len;
+
+    if (text == NULL || mkdtemp(dir) == NULL) {
+        perror("search");
+        return 1;
+    }
+    setenv("XDG_STATE_HOME", dir, 1);
+
+    for (int i = 0; i < RUNS; ++i) {
+        len = fill(text, RUN_SIZE, i, &r);
+        snprintf(ri.id, sizeof(ri.id), "%016x", i + 1);
+        clock_gettime(CLOCK_REALTIME, &ri.start);
+
+        start = bench_now();
+        if (archive_begin(&a, &ri) < 0) {
+            fprintf(stderr, "search: cannot archive\n");
+            return 1;
+        }
+        for (size_t off = 0; off < len; off += WRITE_SIZE) {
+            /* As fast as the compressor goes, rather than losing output */
+            while (atomic_load(&a.head) - atomic_load(&a.tail) + WRITE_SIZE > a.size) {
+                sched_yield();
+            }
+            archive_write(&a, text + off, len - off < WRITE_SIZE ? len - off : WRITE_SIZE);
+        }
+        if (archive_end(&a) != 0) {
+            fprintf(stderr, "search: output was left out of the archive\n");
+        }
+        ns += bench_now() - start;
+        bytes += len;
+    }
+    bench_rate("search", "archive and index", bytes, ns);
+
+    search("rare string (1 line)", "needle_once");
+    search("every 1000th line", "TODO(bench)");
+    search("absent", "no_such_name");
+    search("every line", "return p->");
+
+    /* The runs directory and what is in it */
+    snprintf(cmd, sizeof(cmd), "rm -r %s", dir);
+    free(text);
+    return system(cmd) == 0 ? 0 : 1;
+}
@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Throughput of scanning output for trigger patterns
+ * (see triggers.c) in 64 KiB reads of build-log-like
+ * text, by number of patterns. None of them occur,
+ * so nothing is sent. The second text also has
+ * words sharing a prefix with patterns, which take
+ * the automaton off its root and the prefilter.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "bench.h"
+#include "../triggers.h"
+
+#define TEXT_SIZE   (64 << 20)
+#define READ_SIZE   (64 * 1024)
+
+static const char *patterns[] = {
+    "error:", "FAILED", "Traceback", "Segmentation fault",
+    "undefined reference", "fatal:", "panic:", "Killed",
+    "warning: unused", "Listening on", "Aborted", "assertion",
+    "out of memory", "Permission denied", "timed out", "core dumped",
+};
+
+static const char *plain[] = {
+    "the ", "compiling ", "object ", "warning ", "linking ",
+    "src/main.c ", "ok\n", "[ 42%] ", "Building CXX ", "done\n",
+    NULL
+};
+
+static const char *near_misses[] = {
+    "the ", "compiling ", "object ", "warning ", "linking ",
+    "src/main.c ", "ok\n", "[ 42%] ", "Building CXX ", "done\n",
+    "error_count ", "Killing ", "Abort ", "timed ", "test_FAIL ",
+    NULL
+};
+
+/*
+ * Fills `buf' with random words from the
+ * NULL terminated `words'.
+ *
+ * Returns how much of it was filled.
+ */
+static size_t
+fill(char *buf, size_t len, const char **words)
+{
+    size_t nwords = 0, off = 0, n;
+    unsigned r = 1;
+    const char *w;
+
+    while (words[nwords] != NULL) {
+        ++nwords;
+    }
+
+    for (;;) {
+        r = r * 1103515245 + 12345;
+        w = words[(r >> 16) % nwords];
+        if (off + (n = strlen(w)) > len) {
+            return off;
+        }
+        memcpy(buf + off, w, n);
+        off += n;
+    }
+}
+
+/*
+ * Writes the first `n' patterns to the
+ * triggers file in `dir'.
+ *
+ * Returns 0 on success, otherwise -1.
+ */
+static int
+write_triggers(const char *dir, size_t n)
+{
+    char path[256];
+    FILE *fp;
+
+    snprintf(path, sizeof(path), "%s/cmdnotify", dir);
+    mkdir(path, 0700);
+    snprintf(path, sizeof(path), "%s/cmdnotify/triggers", dir);
+    if ((fp = fopen(path, "w")) == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        fprintf(fp, "- %s\n", patterns[i]);
+    }
+    return fclose(fp);
+}
+
+/*
+ * Scans `len' bytes of `text' with `t' for
+ * BENCH_NS and prints the throughput.
+ */
+static void
+scan(struct triggers *t, const char *what, const char *text, size_t len)
+{
+    long long start = bench_now(), ns;
+    uint32_t state = 0;
+    double bytes = 0;
+
+    do {
+        for (size_t off = 0; off < len; off += READ_SIZE) {
+            triggers_scan(t, &state, text + off,
+                          len - off < READ_SIZE ? len - off : READ_SIZE, text);
+        }
+        bytes += len;
+    } while ((ns = bench_now() - start) < BENCH_NS);
+    bench_rate("triggers", what, bytes, ns);
+}
+
+int
+main(void)
+{
+    const size_t counts[] = { 1, 3, 8, 16 };
+    char dir[] = "/tmp/cmdnotify-bench-XXXXXX", what[64], path[256];
+    char *text = malloc(TEXT_SIZE), *misses = malloc(TEXT_SIZE);
+    size_t len, mlen;
+    struct triggers *t;
+
+    if (text == NULL || misses == NULL || mkdtemp(dir) == NULL) {
+        perror("triggers");
+        return 1;
+    }
+    len = fill(text, TEXT_SIZE, plain);
+    mlen = fill(misses, TEXT_SIZE, near_misses);
+    setenv("XDG_CONFIG_HOME", dir, 1);
+
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); ++i) {
+        if (write_triggers(dir, counts[i]) < 0 ||
+            (t = triggers_load("bench", 1)) == NULL) {
+            fprintf(stderr, "triggers: cannot load patterns\n");
+            return 1;
+        }
+
+        snprintf(what, sizeof(what), "%zu patterns", counts[i]);
+        scan(t, what, text, len);
+        snprintf(what, sizeof(what), "%zu patterns, near misses", counts[i]);
+        scan(t, what, misses, mlen);
+        triggers_free(t);
+    }
+
+    snprintf(path, sizeof(path), "%s/cmdnotify/triggers", dir);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/cmdnotify", dir);
+    rmdir(path);
+    rmdir(dir);
+    free(text);
+    free(misses);
+    return 0;
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Throughput of utf8_sanitize() as notify() calls it
+ * on a body: escaping markup, over plain ASCII, text
+ * full of markup, mixed scripts and invalid bytes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "../utf8.h"
+
+#define INPUT_SIZE  (1 << 20)
+
+/*
+ * Fills `buf' with copies of `s'.
+ */
+static void
+fill(char *buf, size_t len, const char *s)
+{
+    size_t n = strlen(s);
+
+    for (size_t off = 0; off < len; off += n) {
+        memcpy(buf + off, s, len - off < n ? len - off : n);
+    }
+}
+
+int
+main(void)
+{
+    const struct {
+        const char *what;
+        const char *text;
+    } cases[] = {
+        { "ascii", "make[2]: Entering directory '/src/build/lib' " },
+        { "markup", "<b>a & b</b> <i>x</i> & " },
+        { "mixed scripts", "caf\xc3\xa9 \xd0\xbf\xd1\x80\xd0\xb8 \xe4\xb8\xad \xf0\x9f\x91\x8d\xf0\x9f\x8f\xbd " },
+        { "invalid bytes", "ok \xff\xfe \xed\xa0\x80 \xc0\xaf " },
+    };
+    char *src = malloc(INPUT_SIZE), *dst = malloc(6 * INPUT_SIZE);
+    long long start, ns;
+    double bytes;
+
+    if (src == NULL || dst == NULL) {
+        perror("utf8");
+        return 1;
+    }
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        fill(src, INPUT_SIZE, cases[i].text);
+        bytes = 0;
+        start = bench_now();
+        do {
+            utf8_sanitize(dst, 6 * INPUT_SIZE, src, INPUT_SIZE, UTF8_ESCAPE);
+            bytes += INPUT_SIZE;
+        } while ((ns = bench_now() - start) < BENCH_NS);
+        bench_rate("utf8", cases[i].what, bytes, ns);
+    }
+
+    free(src);
+    free(dst);
+    return 0;
+}
@@ -0,0 +1,460 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Build progress (-B): for ninja and make, the
+ * status lines in the output are turned into
+ * progress notifications.
+ *
+ * ninja prints "[done/total] description" (we
+ * set $NINJA_STATUS to that if unset), CMake's
+ * Makefiles print "[ 42%] description". Both are
+ * matched at the start of lines as the output
+ * passes through, a byte at a time.
+ *
+ * ninja records each edge it runs in .ninja_log
+ * with its duration. The durations from past
+ * builds tell how long the edges still to run
+ * take, those appended during this build how
+ * much work got done so far in the time taken:
+ *
+ *      ETA = elapsed * (edges left * mean past
+ *            duration of targets not yet built)
+ *            / duration of edges built so far
+ *
+ * so parallelism needs no guessing. Without a
+ * log the ETA follows the rate edges finish, or
+ * the percentage for make.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "build.h"
+#include "util.h"
+
+#define NINJA_STATUS    "[%f/%t] "
+#define NINJA_LOG       ".ninja_log"
+#define UPDATE_MS       250         /* Least time between ETA updates */
+#define TABLE_INIT      1024
+
+/* Status line parser states */
+#define S_LINE      0       /* At the start of a line */
+#define S_TEXT      1
+#define S_FIRST     2       /* "[ 12" */
+#define S_SECOND    3       /* "[12/34" */
+#define S_PERCENT   4       /* "[ 42%" */
+
+struct build_target {
+    uint64_t hash;          /* Of its path, 0 if free */
+    uint32_t ms;            /* Last duration */
+    bool done;              /* Built by this build */
+};
+
+static long long
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * Returns the entry for the target with the path
+ * hash `h', added if `add', or NULL.
+ */
+static struct build_target *
+target_get(struct build *b, uint64_t h, bool add)
+{
+    struct build_target *old = b->targets, *t;
+    size_t size, i;
+
+    if (b->targets == NULL || (add && b->ntargets * 2 >= b->mask)) {
+        if (!add) {
+            return NULL;
+        }
+        size = b->targets == NULL ? TABLE_INIT : (b->mask + 1) * 2;
+        if ((b->targets = calloc(size, sizeof(*t))) == NULL) {
+            b->targets = old;
+            return NULL;
+        }
+        b->mask = size - 1;
+        for (size_t j = 0; old != NULL && j < size / 2; ++j) {
+            if (old[j].hash == 0) {
+                continue;
+            }
+            for (i = old[j].hash & b->mask; b->targets[i].hash != 0;
+                 i = (i + 1) & b->mask);
+            b->targets[i] = old[j];
+        }
+        free(old);
+    }
+
+    for (i = h & b->mask;; i = (i + 1) & b->mask) {
+        t = &b->targets[i];
+        if (t->hash == h) {
+            return t;
+        }
+        if (t->hash == 0) {
+            if (!add) {
+                return NULL;
+            }
+            t->hash = h;
+            ++b->ntargets;
+            ++b->unfinished;
+            return t;
+        }
+    }
+}
+
+/*
+ * Handles a .ninja_log line, "start\tend\tmtime\t
+ * target\thash" with times in ms. Lines from
+ * before the build give the last duration of
+ * each target, later ones finished edges.
+ */
+static void
+log_line(struct build *b, char *line, bool live)
+{
+    struct build_target *t;
+    unsigned long start, end;
+    char *p = line, *target;
+    uint64_t h;
+
+    if (line[0] == '#') {
+        return;
+    }
+    start = strtoul(p, &p, 10);
+    if (*p++ != '\t') {
+        return;
+    }
+    end = strtoul(p, &p, 10);
+    if (*p++ != '\t' || (p = strchr(p, '\t')) == NULL) {
+        return;
+    }
+    target = p + 1;
+    if ((p = strchr(target, '\t')) == NULL || end < start) {
+        return;
+    }
+
+    h = hash_bytes(target, p - target, HASH_INIT) | 1;
+    if (!live) {
+        if ((t = target_get(b, h, true)) != NULL) {
+            b->unfinished_ms += (end - start) - (uint64_t)t->ms;
+            t->ms = end - start;
+        }
+        return;
+    }
+
+    b->work_ms += end - start;
+    ++b->nwork;
+    if ((t = target_get(b, h, false)) != NULL && !t->done) {
+        t->done = true;
+        b->unfinished_ms -= t->ms;
+        --b->unfinished;
+    }
+}
+
+/*
+ * Reads the log from where we left off up to
+ * its last complete line, following it once it
+ * is created or rewritten if `live'.
+ */
+static void
+log_read(struct build *b, bool live)
+{
+    char buf[65536], *start, *nl;
+    size_t len = 0, used;
+    struct stat sb;
+    ssize_t n;
+
+    /*
+     * A new log only has entries of this build, but
+     * ninja also rewrites the log to drop old ones
+     * as it starts.
+     */
+    if (live && stat(b->logpath, &sb) == 0 &&
+        (b->logfd < 0 || sb.st_ino != b->ino)) {
+        b->logoff = b->logfd < 0 ? 0 : sb.st_size;
+        if (b->logfd >= 0) {
+            close(b->logfd);
+        }
+        if ((b->logfd = open(b->logpath, O_RDONLY | O_CLOEXEC)) < 0) {
+            return;
+        }
+        b->ino = sb.st_ino;
+    }
+    if (b->logfd < 0) {
+        return;
+    }
+
+    while ((n = pread(b->logfd, buf + len, sizeof(buf) - len,
+                      b->logoff + len)) > 0) {
+        len += n;
+        for (start = buf; (nl = memchr(start, '\n', buf + len - start)) != NULL;
+             start = nl + 1) {
+            *nl = '\0';
+            log_line(b, start, live);
+        }
+
+        used = start - buf;
+        if (used == 0 && len == sizeof(buf)) {
+            /* Overlong line, skip it */
+            used = len;
+        }
+        b->logoff += used;
+        memmove(buf, buf + used, len - used);
+        len -= used;
+    }
+}
+
+/*
+ * Returns the expected time left in seconds,
+ * rounded up, or -1 if not known yet or if
+ * there is nothing left.
+ */
+static long
+build_eta(struct build *b, long long now)
+{
+    const long long elapsed = (now - b->start_ns) / 1000000;
+    uint64_t left, per;
+
+    if (elapsed < 1000) {
+        return -1;
+    }
+
+    if (b->total == 0) {
+        if (b->percent <= 0 || b->percent >= 100) {
+            return -1;
+        }
+        return (elapsed * (100 - b->percent) / b->percent + 999) / 1000;
+    }
+
+    if ((left = b->total - b->done) == 0) {
+        return -1;
+    }
+    if (b->work_ms > 0) {
+        per = b->unfinished > 0 ? b->unfinished_ms / b->unfinished :
+                                  b->work_ms / b->nwork;
+        return (elapsed * (left * per) / b->work_ms + 999) / 1000;
+    }
+    if (b->done == 0) {
+        return -1;
+    }
+    return (elapsed * left / b->done + 999) / 1000;
+}
+
+/*
+ * Updates the progress notification, at most
+ * every UPDATE_MS ms but for the last step.
+ */
+static void
+build_update(struct build *b)
+{
+    long long now = now_ns();
+    char stage[32] = "";
+    int percent = b->percent;
+
+    if (now - b->update_ns < UPDATE_MS * 1000000LL &&
+        (b->total == 0 || b->done < b->total)) {
+        return;
+    }
+    b->update_ns = now;
+
+    if (b->logpath[0] != '\0') {
+        log_read(b, true);
+    }
+    if (b->total > 0) {
+        percent = (int)(b->done * 100ULL / b->total);
+        snprintf(stage, sizeof(stage), "%u/%u", b->done, b->total);
+    }
+    progress_set(b->prog, percent, stage, build_eta(b, now));
+}
+
+/*
+ * Returns the argument after `opt' in `argv',
+ * also for "-Cdir", or NULL.
+ */
+static const char *
+find_arg(char **argv, const char *opt)
+{
+    const size_t len = strlen(opt);
+
+    for (; *argv != NULL; ++argv) {
+        if (strncmp(*argv, opt, len) != 0) {
+            continue;
+        }
+        if ((*argv)[len] != '\0') {
+            return opt[1] != '-' ? *argv + len : NULL;
+        }
+        return argv[1];
+    }
+    return NULL;
+}
+
+/*
+ * Starts following the build if `progname'
+ * is ninja, make or "cmake --build".
+ *
+ * Returns 0 if it is, otherwise -1.
+ */
+int
+build_begin(struct build *b, const char *progname, char **argv,
+            struct progress *p)
+{
+    const char *name = strrchr(progname, '/'), *dir = ".";
+    struct stat sb;
+
+    memset(b, 0, sizeof(*b));
+    b->logfd = -1;
+    b->percent = -1;
+    b->prog = p;
+    b->start_ns = now_ns();
+
+    name = name != NULL ? name + 1 : progname;
+    if (strcmp(name, "ninja") == 0 || strcmp(name, "samu") == 0) {
+        b->tool = BUILD_NINJA;
+        dir = find_arg(argv, "-C");
+    } else if (strcmp(name, "make") == 0 || strcmp(name, "gmake") == 0) {
+        b->tool = BUILD_MAKE;
+    } else if (strcmp(name, "cmake") == 0 &&
+               (dir = find_arg(argv, "--build")) != NULL) {
+        b->tool = BUILD_CMAKE;
+    } else {
+        return -1;
+    }
+
+    if (b->tool == BUILD_MAKE) {
+        return 0;
+    }
+
+    if (getenv("NINJA_STATUS") == NULL) {
+        setenv("NINJA_STATUS", NINJA_STATUS, 1);
+        b->set_status = true;
+    }
+
+    snprintf(b->logpath, sizeof(b->logpath), "%s/%s",
+             dir != NULL ? dir : ".", NINJA_LOG);
+    if ((b->logfd = open(b->logpath, O_RDONLY | O_CLOEXEC)) >= 0 &&
+        fstat(b->logfd, &sb) == 0) {
+        b->ino = sb.st_ino;
+        log_read(b, false);
+    }
+    return 0;
+}
+
+/*
+ * Looks for status lines in `n' bytes of
+ * output at `p'.
+ */
+void
+build_scan(struct build *b, const char *p, size_t n)
+{
+    const char *end = p + n;
+    char c;
+
+    while (p < end) {
+        c = *p++;
+
+        switch (b->state) {
+        case S_LINE:
+            if (c == '[') {
+                b->state = S_FIRST;
+                b->num = b->digits = 0;
+                continue;
+            }
+            break;
+        case S_FIRST:
+        case S_SECOND:
+            if (c >= '0' && c <= '9' && b->digits < 9) {
+                b->num = b->num * 10 + (c - '0');
+                ++b->digits;
+                continue;
+            }
+            if (c == ' ' && b->state == S_FIRST && b->digits == 0) {
+                continue;
+            }
+            if (c == '/' && b->state == S_FIRST && b->digits > 0) {
+                b->state = S_SECOND;
+                b->first = b->num;
+                b->num = b->digits = 0;
+                continue;
+            }
+            if (c == '%' && b->state == S_FIRST && b->digits > 0) {
+                b->state = S_PERCENT;
+                continue;
+            }
+            if (c == ']' && b->state == S_SECOND && b->digits > 0 &&
+                b->first <= b->num) {
+                b->done = b->first;
+                b->total = b->num;
+                b->state = S_TEXT;
+                build_update(b);
+                continue;
+            }
+            break;
+        case S_PERCENT:
+            if (c == ']' && b->num <= 100) {
+                b->percent = b->num;
+                b->state = S_TEXT;
+                build_update(b);
+                continue;
+            }
+            break;
+        }
+
+        /* Skip to the next line */
+        b->state = S_TEXT;
+        while (c != '\n' && c != '\r' && p < end) {
+            c = *p++;
+        }
+        if (c == '\n' || c == '\r') {
+            b->state = S_LINE;
+        }
+    }
+}
+
+void
+build_end(struct build *b)
+{
+    if (b->logfd >= 0) {
+        close(b->logfd);
+    }
+    if (b->set_status) {
+        unsetenv("NINJA_STATUS");
+    }
+    free(b->targets);
+    b->targets = NULL;
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BUILD_H
+#define BUILD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "progress.h"
+
+enum build_tool {
+    BUILD_NONE,
+    BUILD_NINJA,
+    BUILD_MAKE,
+    BUILD_CMAKE         /* cmake --build, either of the above */
+};
+
+struct build_target;
+
+/*
+ * Progress of a ninja or make build, read from
+ * its status lines and .ninja_log, see build.c.
+ */
+struct build {
+    enum build_tool tool;
+    struct progress *prog;
+    long long start_ns;
+    long long update_ns;        /* Last progress update */
+    bool set_status;            /* We set $NINJA_STATUS */
+
+    /* Status line parser */
+    uint8_t state;
+    uint8_t digits;
+    uint32_t num;
+    uint32_t first;
+    uint32_t done;              /* Latest "[done/total]" */
+    uint32_t total;
+    int percent;                /* Latest "[ 42%]", -1 if none */
+
+    /* .ninja_log, logfd is -1 without one */
+    int logfd;
+    char logpath[256];
+    ino_t ino;
+    off_t logoff;
+    struct build_target *targets;
+    size_t ntargets;
+    size_t mask;
+    uint64_t unfinished_ms;     /* Last duration of targets not yet built */
+    size_t unfinished;
+    uint64_t work_ms;           /* Duration of edges built so far */
+    size_t nwork;
+};
+
+int build_begin(struct build *b, const char *progname, char **argv,
+                struct progress *p);
+void build_scan(struct build *b, const char *p, size_t n);
+void build_end(struct build *b);
+
+#endif  /* !BUILD_H */
@@ -0,0 +1,718 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include "capture.h"
+#include "util.h"
+#include "config.h"
+
+/*
+ * Maps a ring of `size' bytes twice in a row,
+ * a write past the end of the first mapping
+ * lands at the start of the ring.
+ *
+ * Returns the ring, or NULL on failure.
+ */
+static char *
+ring_map(size_t size)
+{
+    char *base;
+    int fd;
+
+    if ((fd = memfd_create("cmdnotify-tail", MFD_CLOEXEC)) < 0) {
+        return NULL;
+    }
+    if (ftruncate(fd, size) < 0) {
+        close(fd);
+        return NULL;
+    }
+
+    /* Reserve both halves, then put the ring in each */
+    base = mmap(NULL, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+
+    if (mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+             fd, 0) == MAP_FAILED ||
+        mmap(base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+             fd, 0) == MAP_FAILED) {
+        munmap(base, 2 * size);
+        close(fd);
+        return NULL;
+    }
+
+    close(fd);
+    return base;
+}
+
+static int
+stream_open(struct capture *c, struct capture_stream *s, int outfd)
+{
+    int fds[2];
+
+    if (pipe2(fds, O_CLOEXEC) < 0) {
+        return -1;
+    }
+
+    /* The program writes blocking, only we are non-blocking */
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    s->rfd = fds[0];
+    s->wfd = fds[1];
+    s->outfd = outfd;
+    s->cap = c;
+
+    /* Without a second pipe we read() and write() instead */
+    if (pipe2(fds, O_CLOEXEC | O_NONBLOCK) == 0) {
+        s->tee_rfd = fds[0];
+        s->tee_wfd = fds[1];
+    }
+    return 0;
+}
+
+static void
+stream_untee(struct capture_stream *s)
+{
+    if (s->tee_rfd >= 0) {
+        close(s->tee_rfd);
+        close(s->tee_wfd);
+        s->tee_rfd = s->tee_wfd = -1;
+    }
+}
+
+static void
+stream_close(struct capture_stream *s)
+{
+    stream_untee(s);
+    if (s->rfd >= 0) {
+        close(s->rfd);
+        s->rfd = -1;
+    }
+    if (s->wfd >= 0) {
+        close(s->wfd);
+        s->wfd = -1;
+    }
+}
+
+/*
+ * Writes all of `buf' to `fd', waiting
+ * for room if `fd' is non-blocking.
+ *
+ * Returns 0 on success, otherwise -1.
+ */
+static int
+write_all(int fd, const char *buf, size_t len)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+    ssize_t n;
+
+    while (len > 0) {
+        n = write(fd, buf, len);
+        if (n < 0 && errno == EAGAIN) {
+            poll(&pfd, 1, -1);
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/*
+ * Moves `len' bytes from the pipe `in' to
+ * `out' without copying them to us.
+ *
+ * Returns 0 on success, otherwise -1 with
+ * errno set. Nothing was moved if errno
+ * is EINVAL.
+ */
+static int
+splice_all(int in, int out, size_t len)
+{
+    struct pollfd pfd = { .fd = out, .events = POLLOUT };
+    ssize_t n;
+
+    while (len > 0) {
+        n = splice(in, NULL, out, NULL, len, SPLICE_F_MOVE);
+        if (n < 0 && errno == EAGAIN) {
+            poll(&pfd, 1, -1);
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        len -= n;
+    }
+    return 0;
+}
+
+/*
+ * Duplicates what is in the program's pipe
+ * with tee(2) and reads the copy into the
+ * ring, then splices the original to our
+ * output, so only the ring's copy ever
+ * passes through user space.
+ *
+ * Returns the number of bytes moved, 0 at
+ * the end of the stream or -1 with errno
+ * set, see stream_drain().
+ */
+static ssize_t
+stream_tee(struct capture_stream *s, char *p)
+{
+    ssize_t n;
+
+    n = tee(s->rfd, s->tee_wfd, s->cap->size, SPLICE_F_NONBLOCK);
+    if (n <= 0) {
+        return n;
+    }
+
+    /* The copy is all there, nothing else writes the tee pipe */
+    if (read(s->tee_rfd, p, n) != n) {
+        return -1;
+    }
+
+    if (s->outfd < 0 || splice_all(s->rfd, s->outfd, n) == 0) {
+        return n;
+    }
+
+    /* Our output can't be spliced to, e.g., a terminal */
+    if (errno == EINVAL) {
+        stream_untee(s);
+        if (read(s->rfd, p, n) == n && write_all(s->outfd, p, n) == 0) {
+            return n;
+        }
+    }
+
+    errno = EPIPE;
+    return -1;
+}
+
+/*
+ * Adds the `n' bytes of output just put in the
+ * ring at `p', looking for triggers, errors and
+ * build progress in them, timing their lines and
+ * archiving them.
+ */
+static void
+ring_commit(struct capture_stream *s, const char *p, size_t n)
+{
+    struct capture *c = s->cap;
+    size_t before = c->head < c->size - n ? c->head : c->size - n;
+
+    if (c->trig != NULL) {
+        triggers_scan(c->trig, &s->trig_state, p, n, p - before);
+    }
+    if (c->lines != NULL) {
+        lines_add(c->lines, s == &c->err, p, n);
+    }
+    if (c->diag != NULL) {
+        diag_scan(c->diag, s == &c->err, p, n);
+    }
+    if (c->build != NULL && s == &c->out) {
+        build_scan(c->build, p, n);
+    }
+    if (c->arch != NULL) {
+        archive_write(c->arch, p, n);
+    }
+    c->head += n;
+}
+
+/*
+ * Moves everything the program wrote so far
+ * into the ring and on to our own output.
+ *
+ * Returns 0 once the program closed the
+ * stream, otherwise -1 (nothing left).
+ */
+static int
+stream_drain(struct capture_stream *s)
+{
+    struct capture *c = s->cap;
+    char *p;
+    ssize_t n;
+
+    if (s->rfd < 0) {
+        return 0;
+    }
+
+    for (;;) {
+        p = c->ring + c->head % c->size;
+        if (s->tee_rfd >= 0) {
+            n = stream_tee(s, p);
+            if (n < 0 && errno == EINVAL) {
+                /* No tee(2) for these pipes */
+                stream_untee(s);
+                continue;
+            }
+            if (n < 0 && errno == EPIPE) {
+                s->outfd = -1;
+                return 0;
+            }
+            if (n > 0) {
+                ring_commit(s, p, n);
+                continue;
+            }
+        } else {
+            n = read(s->rfd, p, c->size);
+        }
+
+        /* A terminal whose program side is all closed */
+        if (n < 0 && errno == EIO) {
+            n = 0;
+        }
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+
+        if (s->outfd >= 0 && write_all(s->outfd, p, n) < 0) {
+            /*
+             * Whoever read our output went away, so
+             * should the program's reader.
+             */
+            s->outfd = -1;
+            return 0;
+        }
+        ring_commit(s, p, n);
+    }
+
+    return n == 0 ? 0 : -1;
+}
+
+static void
+capture_read(struct ev_watch *w, uint32_t events)
+{
+    struct capture_stream *s = w->arg;
+
+    if (stream_drain(s) == 0 || (events & EPOLLERR) != 0) {
+        ev_del(s->cap->ev, w);
+        stream_close(s);
+    }
+}
+
+/*
+ * Passes keys typed on our terminal on to
+ * the program's terminal.
+ */
+static void
+pty_input(struct ev_watch *w, uint32_t events)
+{
+    struct capture *c = w->arg;
+    char buf[4096];
+    ssize_t n;
+
+    (void)events;
+    n = read(STDIN_FILENO, buf, sizeof(buf));
+    if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+        return;
+    }
+    if (n <= 0 || write_all(c->out.rfd, buf, n) < 0) {
+        ev_del(c->ev, w);
+    }
+}
+
+/*
+ * Gives the program's terminal the size
+ * of ours, the kernel then sends it
+ * SIGWINCH itself.
+ */
+static void
+pty_resize(struct capture *c)
+{
+    struct winsize ws;
+
+    if (ioctl(STDIN_FILENO, TIOCGWINSZ, &ws) == 0) {
+        ioctl(c->out.rfd, TIOCSWINSZ, &ws);
+    }
+}
+
+/*
+ * Puts our terminal in raw mode, so keys reach
+ * the program's terminal as typed.
+ */
+static void
+pty_raw(struct capture *c)
+{
+    struct termios raw = c->tio;
+
+    cfmakeraw(&raw);
+    tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+}
+
+static void pty_close(struct capture *c);
+
+/*
+ * Handles the signals pty_open() blocked. Our
+ * terminal is given back before we stop or are
+ * killed, and raw again once we continue.
+ */
+static void
+pty_signals(struct capture *c)
+{
+    struct signalfd_siginfo si;
+
+    while (read(c->sigfd, &si, sizeof(si)) == sizeof(si)) {
+        switch (si.ssi_signo) {
+        case SIGWINCH:
+            pty_resize(c);
+            break;
+        case SIGTSTP:
+            /* SIGCONT is queued for us once we are back */
+            tcsetattr(STDIN_FILENO, TCSADRAIN, &c->tio);
+            raise(SIGSTOP);
+            break;
+        case SIGCONT:
+            pty_raw(c);
+            pty_resize(c);
+            break;
+        default:
+            /* Die of it as we would have, unblocked again */
+            pty_close(c);
+            raise(si.ssi_signo);
+            break;
+        }
+    }
+}
+
+static void
+pty_signal(struct ev_watch *w, uint32_t events)
+{
+    (void)events;
+    pty_signals(w->arg);
+}
+
+/*
+ * Creates a pseudo-terminal like ours for
+ * the program, and puts ours in raw mode so
+ * keys reach the program's terminal as typed.
+ *
+ * Returns 0 on success, otherwise -1.
+ */
+static int
+pty_open(struct capture *c)
+{
+    const int sigs[] = { SIGTERM, SIGHUP, SIGINT, SIGTSTP };
+    struct sigaction sa;
+    sigset_t set;
+    char name[64];
+    int master, slave;
+
+    if (!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &c->tio) < 0) {
+        return -1;
+    }
+
+    if ((master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC)) < 0) {
+        return -1;
+    }
+    if (grantpt(master) < 0 || unlockpt(master) < 0 ||
+        ptsname_r(master, name, sizeof(name)) != 0 ||
+        (slave = open(name, O_RDWR | O_NOCTTY | O_CLOEXEC)) < 0) {
+        close(master);
+        return -1;
+    }
+
+    tcsetattr(slave, TCSANOW, &c->tio);
+    fcntl(master, F_SETFL, O_NONBLOCK);
+    c->out.rfd = master;
+    c->out.wfd = slave;
+    c->out.outfd = STDOUT_FILENO;
+    c->out.cap = c;
+    pty_resize(c);
+
+    /*
+     * Window size changes, and signals that would
+     * stop or kill us with our terminal still raw,
+     * are read from a signalfd. Ignored ones stay
+     * ignored.
+     */
+    sigemptyset(&set);
+    sigaddset(&set, SIGWINCH);
+    sigaddset(&set, SIGCONT);
+    for (size_t i = 0; i < sizeof(sigs) / sizeof(sigs[0]); ++i) {
+        if (sigaction(sigs[i], NULL, &sa) == 0 && sa.sa_handler != SIG_IGN) {
+            sigaddset(&set, sigs[i]);
+        }
+    }
+    sigprocmask(SIG_BLOCK, &set, &c->sigmask);
+    c->sigfd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+
+    pty_raw(c);
+    c->pty = true;
+    return 0;
+}
+
+static void
+pty_close(struct capture *c)
+{
+    if (!c->pty) {
+        return;
+    }
+
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &c->tio);
+    sigprocmask(SIG_SETMASK, &c->sigmask, NULL);
+    if (c->sigfd >= 0) {
+        close(c->sigfd);
+    }
+    c->pty = false;
+}
+
+/*
+ * Creates pipes for the program's stdout and
+ * stderr and the ring keeping their tail. With
+ * `pty', the program gets a pseudo-terminal
+ * instead if we run on a terminal ourselves.
+ *
+ * Returns 0 on success, otherwise -1 and
+ * the program keeps our stdout and stderr.
+ */
+int
+capture_begin(struct capture *c, bool pty)
+{
+    memset(c, 0, sizeof(*c));
+    c->out.rfd = c->out.wfd = c->out.tee_rfd = c->out.tee_wfd = -1;
+    c->err.rfd = c->err.wfd = c->err.tee_rfd = c->err.tee_wfd = -1;
+    c->sigfd = -1;
+    c->size = CAPTURE_SIZE * 1024;
+
+    if ((c->ring = ring_map(c->size)) == NULL) {
+        return -1;
+    }
+
+    if ((!pty || pty_open(c) < 0) &&
+        (stream_open(c, &c->out, STDOUT_FILENO) < 0 ||
+         stream_open(c, &c->err, STDERR_FILENO) < 0)) {
+        stream_close(&c->out);
+        munmap(c->ring, 2 * c->size);
+        c->ring = NULL;
+        return -1;
+    }
+
+    /* A closed reader of ours must not kill us before notifying */
+    c->sigpipe = signal(SIGPIPE, SIG_IGN);
+    return 0;
+}
+
+/*
+ * Points the program's stdout and stderr at
+ * our pipes, or all of its stdio at its
+ * terminal, called in the child before exec.
+ */
+void
+capture_child(struct capture *c)
+{
+    if (c->ring == NULL) {
+        return;
+    }
+
+    if (c->pty) {
+        setsid();
+        ioctl(c->out.wfd, TIOCSCTTY, 0);
+        dup2(c->out.wfd, STDIN_FILENO);
+        dup2(c->out.wfd, STDOUT_FILENO);
+        dup2(c->out.wfd, STDERR_FILENO);
+        sigprocmask(SIG_SETMASK, &c->sigmask, NULL);
+    } else {
+        dup2(c->out.wfd, STDOUT_FILENO);
+        dup2(c->err.wfd, STDERR_FILENO);
+    }
+    signal(SIGPIPE, c->sigpipe);
+}
+
+/*
+ * Starts passing output on, must be called
+ * after the program was forked.
+ */
+void
+capture_attach(struct capture *c, struct evloop *ev)
+{
+    struct capture_stream *streams[] = { &c->out, &c->err };
+    struct capture_stream *s;
+
+    if (c->ring == NULL) {
+        return;
+    }
+
+    c->ev = ev;
+    for (size_t i = 0; i < 2; ++i) {
+        s = streams[i];
+        if (s->rfd < 0) {
+            continue;
+        }
+
+        /* Only the program keeps the write end */
+        close(s->wfd);
+        s->wfd = -1;
+
+        s->w = (struct ev_watch){ .fd = s->rfd, .fn = capture_read, .arg = s };
+        ev_add(ev, &s->w, EPOLLIN);
+    }
+
+    if (c->pty) {
+        c->inw = (struct ev_watch){ .fd = STDIN_FILENO, .fn = pty_input, .arg = c };
+        ev_add(ev, &c->inw, EPOLLIN);
+    }
+    if (c->sigfd >= 0) {
+        c->winw = (struct ev_watch){ .fd = c->sigfd, .fn = pty_signal, .arg = c };
+        ev_add(ev, &c->winw, EPOLLIN);
+    }
+}
+
+/*
+ * Passes output (and with a pseudo-terminal,
+ * input) on until the program closes both
+ * streams, for when no event loop is
+ * available to do it while waiting.
+ */
+void
+capture_relay(struct capture *c)
+{
+    struct pollfd pfds[4];
+    struct capture_stream *streams[] = { &c->out, &c->err };
+    char buf[4096];
+    ssize_t n;
+
+    if (c->ring == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < 2; ++i) {
+        if (streams[i]->wfd >= 0) {
+            close(streams[i]->wfd);
+            streams[i]->wfd = -1;
+        }
+    }
+
+    pfds[2] = (struct pollfd){ .fd = c->pty ? STDIN_FILENO : -1, .events = POLLIN };
+    pfds[3] = (struct pollfd){ .fd = c->sigfd, .events = POLLIN };
+    while (c->out.rfd >= 0 || c->err.rfd >= 0) {
+        for (size_t i = 0; i < 2; ++i) {
+            pfds[i] = (struct pollfd){ .fd = streams[i]->rfd, .events = POLLIN };
+        }
+        if (poll(pfds, 4, -1) < 0 && errno != EINTR) {
+            break;
+        }
+
+        for (size_t i = 0; i < 2; ++i) {
+            if (pfds[i].revents != 0 && stream_drain(streams[i]) == 0) {
+                stream_close(streams[i]);
+            }
+        }
+
+        if (pfds[2].revents != 0) {
+            n = read(STDIN_FILENO, buf, sizeof(buf));
+            if (n <= 0 || write_all(c->out.rfd, buf, n) < 0) {
+                pfds[2].fd = -1;
+            }
+        }
+        if (pfds[3].revents != 0) {
+            pty_signals(c);
+        }
+    }
+}
+
+/*
+ * Passes on what is left of the output and
+ * copies the last CAPTURE_LINES lines of it
+ * to `tail'.
+ *
+ * Returns the length of the tail.
+ */
+size_t
+capture_end(struct capture *c, char *tail, size_t len)
+{
+    const char *start, *end, *p;
+    size_t avail, nl = 0;
+
+    tail[0] = '\0';
+    if (c->ring == NULL) {
+        return 0;
+    }
+
+    /*
+     * Output may still be in the pipes, but
+     * don't wait on anything the program left
+     * running in the background.
+     */
+    stream_drain(&c->out);
+    stream_drain(&c->err);
+    stream_close(&c->out);
+    stream_close(&c->err);
+    pty_close(c);
+    signal(SIGPIPE, c->sigpipe);
+
+    avail = c->head < c->size ? c->head : c->size;
+    start = c->ring + (c->head - avail) % c->size;
+    end = start + avail;
+
+    while (end > start && (end[-1] == '\n' || end[-1] == ' ' ||
+                           end[-1] == '\r' || end[-1] == '\t')) {
+        --end;
+    }
+
+    for (p = end; p > start; --p) {
+        if (p[-1] == '\n' && ++nl == CAPTURE_LINES) {
+            break;
+        }
+    }
+
+    if ((size_t)(end - p) > len - 1) {
+        p = end - (len - 1);
+    }
+
+    len = term_clean(tail, len, p, end);
+    munmap(c->ring, 2 * c->size);
+    c->ring = NULL;
+    return len;
+}
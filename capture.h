@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <signal.h>
+#include <termios.h>
+#include "evloop.h"
+#include "triggers.h"
+#include "lines.h"
+#include "archive.h"
+#include "diag.h"
+#include "build.h"
+
+#define CAPTURE_TAIL_MAX    512
+
+struct capture;
+
+/*
+ * One of the program's output streams, passed
+ * on to `outfd' as it arrives.
+ */
+struct capture_stream {
+    int rfd;                /* Our end of the pipe */
+    int wfd;                /* The program's end */
+    int outfd;              /* Our stdout or stderr, -1 once gone */
+    int tee_rfd;            /* Copy of the output for the ring, -1 */
+    int tee_wfd;            /* if not splicing */
+    uint32_t trig_state;    /* See triggers_scan() */
+    struct ev_watch w;
+    struct capture *cap;
+};
+
+/*
+ * Keeps the last CAPTURE_SIZE bytes of the
+ * program's output, read from pipes or from
+ * a pseudo-terminal. The ring is mapped twice
+ * back to back so any window of it is
+ * contiguous in memory.
+ */
+struct capture {
+    char *ring;             /* NULL if not capturing */
+    size_t size;
+    uint64_t head;          /* Total bytes seen */
+    struct triggers *trig;  /* Patterns to notify of, may be NULL */
+    struct line_log *lines; /* Line timing, may be NULL */
+    struct archive *arch;   /* Output archive, may be NULL */
+    struct diag *diag;      /* Error parsers, may be NULL */
+    struct build *build;    /* Build progress, may be NULL */
+    struct capture_stream out;
+    struct capture_stream err;
+    struct evloop *ev;
+    void (*sigpipe)(int);   /* Disposition to restore in the program */
+
+    /* With a pseudo-terminal, `out' is its master side */
+    bool pty;
+    int sigfd;              /* SIGWINCH, SIGCONT and fatal ones */
+    struct ev_watch inw;
+    struct ev_watch winw;
+    struct termios tio;     /* Our terminal before raw mode */
+    sigset_t sigmask;       /* Signal mask before those were blocked */
+};
+
+int capture_begin(struct capture *c, bool pty);
+void capture_child(struct capture *c);
+void capture_attach(struct capture *c, struct evloop *ev);
+void capture_relay(struct capture *c);
+size_t capture_end(struct capture *c, char *tail, size_t len);
+
+#endif  /* !CAPTURE_H */
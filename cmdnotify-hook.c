@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * cmdnotify-hook, run by the shell hooks in hooks/
+ * before and after each interactive command:
+ *
+ *      cmdnotify-hook start <command line>
+ *      cmdnotify-hook end <status>
+ *
+ * Each is a single non-blocking datagram to
+ * cmdnotifyd, which decides what to notify of.
+ * The prompt waits for this program, so it is
+ * linked statically and does nothing else.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "hook.h"
+
+int
+main(int argc, char **argv)
+{
+    struct sockaddr_un sun = { .sun_family = AF_UNIX };
+    const char *rt = getenv("XDG_RUNTIME_DIR");
+    struct hook_msg m;
+    struct timespec ts;
+    struct stat sb;
+    size_t len = 0;
+    int fd;
+
+    if (argc != 3) {
+        fprintf(stderr, "Usage: cmdnotify-hook start <command>\n"
+                "       cmdnotify-hook end <status>\n");
+        return 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    m.magic = HOOK_MAGIC;
+    m.version = HOOK_VERSION;
+    m.pid = getppid();
+    m.status = 0;
+    m.time_ns = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+
+    if (strcmp(argv[1], "start") == 0) {
+        m.event = HOOK_START;
+        len = strlen(argv[2]);
+        if (len >= sizeof(m.cmd)) {
+            len = sizeof(m.cmd) - 1;
+        }
+        memcpy(m.cmd, argv[2], len);
+    } else if (strcmp(argv[1], "end") == 0) {
+        m.event = HOOK_END;
+        m.status = atoi(argv[2]);
+    } else {
+        return 1;
+    }
+    m.cmd[len] = '\0';
+
+    /* Same as xdg_path(XDG_RUNTIME, HOOK_SOCK, ...) */
+    if (rt != NULL && rt[0] == '/') {
+        snprintf(sun.sun_path, sizeof(sun.sun_path), "%s/cmdnotify/%s",
+                 rt, HOOK_SOCK);
+    } else {
+        /* Only if it is ours, see xdg_private() */
+        snprintf(sun.sun_path, sizeof(sun.sun_path), "/tmp/cmdnotify-%u",
+                 (unsigned)getuid());
+        if (lstat(sun.sun_path, &sb) < 0 || !S_ISDIR(sb.st_mode) ||
+            sb.st_uid != getuid() || (sb.st_mode & 0777) != 0700) {
+            return 0;
+        }
+        snprintf(sun.sun_path, sizeof(sun.sun_path), "/tmp/cmdnotify-%u/%s",
+                 (unsigned)getuid(), HOOK_SOCK);
+    }
+
+    /* Nobody listening is fine, so is a full queue */
+    if ((fd = socket(AF_UNIX, SOCK_DGRAM, 0)) >= 0) {
+        sendto(fd, &m, offsetof(struct hook_msg, cmd) + len + 1, MSG_DONTWAIT,
+               (struct sockaddr *)&sun, sizeof(sun));
+    }
+    return 0;
+}
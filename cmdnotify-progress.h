@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Header-only helper for programs run under
+ * cmdnotify to report their progress, e.g.,
+ *
+ *      cmdnotify_stage("linking");
+ *      cmdnotify_progress(42);
+ *      cmdnotify_eta(300);
+ *
+ * Each call is a single write() to the fd in
+ * CMDNOTIFY_PROGRESS_FD with no allocation, and
+ * does nothing when not run under cmdnotify.
+ */
+
+#ifndef CMDNOTIFY_PROGRESS_H
+#define CMDNOTIFY_PROGRESS_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CMDNOTIFY_MSG_MAX   128
+
+/*
+ * Returns the progress fd, or -1 when not
+ * run under cmdnotify.
+ */
+static inline int
+cmdnotify_progress_fd(void)
+{
+    static int fd = -2;
+    const char *env;
+
+    if (fd == -2) {
+        env = getenv("CMDNOTIFY_PROGRESS_FD");
+        fd = env != NULL ? atoi(env) : -1;
+    }
+    return fd;
+}
+
+/*
+ * Sends "<key> <val>\n" where `val' is a
+ * string if `s' is non-NULL, otherwise
+ * the number `num'.
+ */
+static inline void
+cmdnotify_send(const char *key, const char *s, long num)
+{
+    char buf[CMDNOTIFY_MSG_MAX];
+    char digits[24];
+    size_t len = strlen(key), n = 0;
+    int fd = cmdnotify_progress_fd();
+
+    if (fd < 0 || len + 3 > sizeof(buf)) {
+        return;
+    }
+
+    memcpy(buf, key, len);
+    buf[len++] = ' ';
+
+    if (s != NULL) {
+        while (*s != '\0' && *s != '\n' && len < sizeof(buf) - 1) {
+            buf[len++] = *s++;
+        }
+    } else {
+        if (num < 0) {
+            num = 0;
+        }
+        do {
+            digits[n++] = '0' + num % 10;
+            num /= 10;
+        } while (num > 0);
+        while (n > 0 && len < sizeof(buf) - 1) {
+            buf[len++] = digits[--n];
+        }
+    }
+
+    buf[len++] = '\n';
+    (void)!write(fd, buf, len);
+}
+
+/* Reports completion, 0 to 100 percent */
+static inline void
+cmdnotify_progress(int percent)
+{
+    cmdnotify_send("progress", NULL, percent);
+}
+
+/* Reports the current stage, e.g., "linking" */
+static inline void
+cmdnotify_stage(const char *stage)
+{
+    cmdnotify_send("stage", stage, 0);
+}
+
+/* Reports the estimated seconds remaining */
+static inline void
+cmdnotify_eta(long seconds)
+{
+    cmdnotify_send("eta", NULL, seconds);
+}
+
+#endif  /* !CMDNOTIFY_PROGRESS_H */
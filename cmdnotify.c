@@ -28,48 +28,252 @@
  */
 
 #include <stdio.h>
+#include <errno.h>
 #include <assert.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <limits.h>
+#include <getopt.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/epoll.h>
+#include "cmdnotify.h"
+#include "trace.h"
+#include "nest.h"
+#include "util.h"
+#include "notify.h"
+#include "storm.h"
+#include "evloop.h"
+#include "progress.h"
+#include "heartbeat.h"
+#include "rules.h"
+#include "template.h"
+#include "outbox.h"
+#include "latency.h"
+#include "capture.h"
+#include "idle.h"
+#include "lines.h"
+#include "archive.h"
+#include "index.h"
+#include "diag.h"
+#include "build.h"
+#include "runs.h"
+#include "daemon.h"
+#include "status.h"
 #include "config.h"
 
 #define DEFAULT_BINDIR_PREFIX   "/bin/"
-#define NOTIFY_SEND_BINLOC  DEFAULT_BINDIR_PREFIX "notify-send"
 
-#define SUCCESS_SUMMARY "Success"
-#define FAILURE_SUMMARY "Error"
+/* Long options without a short one */
+#define OPT_PS      256
+#define OPT_SEARCH  257
+
+#define NOTIFY_SUMMARY_MAX  128
+#define NOTIFY_BODY_MAX     1024
+
+/*
+ * Command line options, see usage().
+ */
+static struct {
+    bool heartbeat;
+    bool flush;
+    bool stats;
+    bool tail;
+    bool pty;
+    bool lines;
+    bool archive;
+    bool build;
+    bool ps;
+    const char *search;
+} opts;
+
+/*
+ * What we kept of the program's output.
+ */
+struct run_output {
+    char tail[CAPTURE_TAIL_MAX];    /* Last lines */
+    char gaps[LINES_GAPS_MAX];      /* Longest pauses, with -L */
+    bool archived;                  /* All of it is in runs/<id>.lz4, -A */
+    char first_error[DIAG_FIRST_MAX];
+    unsigned errors;
+    unsigned warnings;
+};
+
+static const struct option long_opts[] = {
+    { "heartbeat", no_argument, NULL, 'H' },
+    { "flush", no_argument, NULL, 'F' },
+    { "stats", no_argument, NULL, 'S' },
+    { "tail", no_argument, NULL, 'T' },
+    { "pty", no_argument, NULL, 'P' },
+    { "lines", no_argument, NULL, 'L' },
+    { "archive", no_argument, NULL, 'A' },
+    { "build", no_argument, NULL, 'B' },
+    { "ps", no_argument, NULL, OPT_PS },
+    { "search", required_argument, NULL, OPT_SEARCH },
+    { NULL, 0, NULL, 0 }
+};
 
 static char *create_progpath(const char *progname);
 
+/*
+ * Called once the pidfd of the program
+ * becomes readable, i.e., it exited.
+ */
+static void
+child_exited(struct ev_watch *w, uint32_t events)
+{
+    struct evloop *ev = w->arg;
+
+    (void)events;
+    ev->done = true;
+}
+
 /*
  * Runs the program, returns its status
  * code.
+ *
+ * @ri: Filled in with timing and resource
+ *      usage of the run.
+ * @out: Filled in with what we kept of the
+ *       output, empty without -T.
  */
 static int
-run_prog(const char *progname, char *argv[])
+run_prog(const char *progname, char *argv[], struct run_info *ri,
+         struct run_output *out)
 {
     pid_t child;
     int status = 0;
     char *progpath = create_progpath(progname);
+    struct trace_ctx tc;
+    struct progress prog;
+    struct evloop ev;
+    struct ev_watch cw;
+    struct heartbeat hb = { .timerfd = -1 };
+    struct capture cap = { .ring = NULL };
+    struct idle idl;
+    struct line_log lines;
+    struct archive arch;
+    struct diag diag = {0};
+    struct build bld;
+    struct status sts;
+    const char *first;
+    int pidfd;
 
+    ri->progname = progname;
+    ri->argv = argv;
+    trace_begin(&tc);
+    for (int i = 0; i < SPAN_ID_LEN; ++i) {
+        sprintf(ri->id + i * 2, "%02x", tc.span_id[i]);
+    }
+    progress_begin(&prog, progname, argv_key(argv));
+    status_begin(&sts, argv);
+    if (opts.heartbeat) {
+        heartbeat_begin(&hb, progname, argv_key(argv));
+    }
+    idle_begin(&idl, progname, argv_key(argv));
+    if (opts.tail && capture_begin(&cap, opts.pty) == 0) {
+        cap.trig = triggers_load(progname, argv_key(argv));
+        cap.diag = &diag;
+        if (opts.build && build_begin(&bld, progname, argv, &prog) == 0) {
+            cap.build = &bld;
+        }
+        if (opts.lines) {
+            lines_begin(&lines, ri->id);
+            cap.lines = &lines;
+        }
+        if (opts.archive && archive_begin(&arch, ri) == 0) {
+            cap.arch = &arch;
+        }
+    }
+
+    clock_gettime(CLOCK_REALTIME, &ri->start);
+    clock_gettime(CLOCK_MONOTONIC, &ri->mono_start);
     child = fork();
     assert(child >= 0);
 
     if (child == 0) {
         /* Child side */
+        capture_child(&cap);
         execv(progpath, argv);
         __builtin_unreachable();
     }
 
     /* Parent side */
-    while (waitpid(child, &status, 0) > 0);
+    ri->pid = child;
+
+    /*
+     * Wait for the program to exit while serving
+     * its progress channel and passing on its
+     * output. Without pidfd support we simply
+     * block in wait4() below.
+     */
+    pidfd = syscall(SYS_pidfd_open, child, 0);
+    if (pidfd >= 0 && ev_init(&ev) == 0) {
+        progress_attach(&prog, &ev);
+        status_attach(&sts, &ev, child, &prog);
+        capture_attach(&cap, &ev);
+        idle_attach(&idl, &ev, child, cap.ring != NULL ? &cap.head : NULL);
+        heartbeat_attach(&hb, &ev, child);
+        cw = (struct ev_watch){ .fd = pidfd, .fn = child_exited, .arg = &ev };
+        ev_add(&ev, &cw, EPOLLIN);
+        notify_use_loop(&ev);
+        ev_run(&ev);
+        notify_use_loop(NULL);
+        ev_fini(&ev);
+    } else {
+        progress_ignore(&prog);
+        capture_relay(&cap);
+    }
+    if (pidfd >= 0) {
+        close(pidfd);
+    }
+
+    while (wait4(child, &status, 0, &ri->rusage) < 0 && errno == EINTR);
+    clock_gettime(CLOCK_REALTIME, &ri->end);
+    clock_gettime(CLOCK_MONOTONIC, &ri->mono_end);
     free(progpath);
+    progress_end(&prog);
+    status_end(&sts);
+    heartbeat_end(&hb);
+    idle_end(&idl);
+    capture_end(&cap, out->tail, sizeof(out->tail));
+    triggers_free(cap.trig);
+    if (cap.build != NULL) {
+        build_end(&bld);
+    }
+
+    first = diag_end(&diag);
+    snprintf(out->first_error, sizeof(out->first_error), "%s",
+             first != NULL ? first : "");
+    out->errors = diag.errors;
+    out->warnings = diag.warnings;
+
+    out->gaps[0] = '\0';
+    if (cap.lines != NULL) {
+        lines_end(&lines, ri->mono_end.tv_sec * 1000000000LL + ri->mono_end.tv_nsec,
+                  out->gaps, sizeof(out->gaps));
+    }
+    out->archived = cap.arch != NULL;
+    if (cap.arch != NULL) {
+        archive_end(&arch);
+    }
+    if (cap.lines != NULL || cap.arch != NULL) {
+        runs_prune();
+    }
+
+    if (WIFSIGNALED(status)) {
+        ri->signo = WTERMSIG(status);
+        ri->status = 128 + ri->signo;
+    } else {
+        ri->status = WEXITSTATUS(status);
+    }
 
-    return WEXITSTATUS(status);
+    trace_end(&tc, ri);
+    return ri->status;
 }
 
 /*
@@ -89,7 +293,7 @@ create_progpath(const char *progname)
 
     /* Allocate our path */
     pathlen += strlen(progname);
-    progpath = malloc(pathlen + 1);
+    progpath = calloc(1, pathlen + 1);
     assert(progpath != NULL);
 
     /* Create the full path */
@@ -116,57 +320,192 @@ prog_exists(const char *progname)
 }
 
 /*
- * XXX: Used internally by notify_status()
+ * Compiles the template in the environment
+ * variable `env', or `def' if unset or invalid.
  */
 static void
-notify(const char *summary, const char *body)
+load_template(struct tmpl *t, const char *env, const char *def)
 {
-    int child;
-    int tmp;
+    const char *src = getenv(env);
 
-    /*
-     * Forking will create a child that will
-     * then be overwritten by execl() therefore
-     * allowing us to continue this main thread
-     * and cleanup
-     */
-    child = fork();
-    if (child == 0) {
-        /* Child side */
-        execl(NOTIFY_SEND_BINLOC, NOTIFY_SEND_BINLOC,
-              "-t", NOTIFY_SEND_TIMEOUT, "-u",
-              NOTIFY_SEND_URGENCY, summary, body,
-              NULL);
+    if (src != NULL && tmpl_compile(t, src) == 0) {
+        return;
+    }
 
-        __builtin_unreachable();
+    if (src != NULL) {
+        fprintf(stderr, "cmdnotify: bad template in %s\n", env);
     }
-    while (wait(&tmp) > 0);
+    tmpl_compile(t, def);
+}
+
+/*
+ * Writes e.g., "2 errors, 1 warning" to `buf',
+ * returns its length.
+ */
+static size_t
+diag_counts(char *buf, size_t len, unsigned errors, unsigned warnings)
+{
+    size_t off = 0;
+
+    if (errors > 0) {
+        off = snprintf(buf, len, "%u error%s", errors, errors != 1 ? "s" : "");
+    }
+    if (warnings > 0 && off < len) {
+        off += snprintf(buf + off, len - off, "%s%u warning%s",
+                        off > 0 ? ", " : "", warnings, warnings != 1 ? "s" : "");
+    }
+    return off;
 }
 
 /*
  * Causes notification of program status.
  *
- * @status: Status code.
- * @cmd: Command that was ran.
+ * @ri: The run to report.
+ * @out: What we kept of the output.
+ * @act: Urgency and timeout to use.
  */
 static void
-notify_status(int status, const char *cmd)
+notify_status(const struct run_info *ri, const struct run_output *out,
+              const struct rule_action *act)
 {
-    const size_t MAX_BODY_BUFSIZE = 256;
-    char *summary, *body;
+    char summary[NOTIFY_SUMMARY_MAX], body[NOTIFY_BODY_MAX];
+    char cwd[PATH_MAX], host[HOST_NAME_MAX + 1];
+    struct tmpl_ctx ctx = {
+        .ri = ri, .cwd = cwd, .host = host,
+        .tail = out->tail, .gaps = out->gaps,
+        .first_error = out->first_error,
+        .errors = out->errors, .warnings = out->warnings
+    };
+    struct notification n = {0};
+    struct tmpl st, bt;
+    size_t off;
 
-    if (status == 0) {
+    load_template(&st, "CMDNOTIFY_SUMMARY", NOTIFY_SUMMARY_TEMPLATE);
+    load_template(&bt, "CMDNOTIFY_BODY", NOTIFY_BODY_TEMPLATE);
+
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        cwd[0] = '\0';
+    }
+    if (gethostname(host, sizeof(host)) < 0) {
+        host[0] = '\0';
+    }
+
+    tmpl_render(&st, &ctx, summary, sizeof(summary));
+    off = tmpl_render(&bt, &ctx, body, sizeof(body));
+
+    /* Show where the time went, unless the template already does */
+    if (out->gaps[0] != '\0' && strstr(bt.src, "{gaps}") == NULL &&
+        off < sizeof(body)) {
+        off += snprintf(body + off, sizeof(body) - off, "\n%s", out->gaps);
+    }
+
+    /* Count diagnostics and show the first error, likewise */
+    if ((out->errors > 0 || out->warnings > 0) && off < sizeof(body) &&
+        strstr(bt.src, "{errors}") == NULL && strstr(bt.src, "{warnings}") == NULL) {
+        off += snprintf(body + off, sizeof(body) - off, "\n");
+        off += diag_counts(body + off, sizeof(body) - off, out->errors,
+                           out->warnings);
+    }
+    if (ri->status != 0 && out->first_error[0] != '\0' && off < sizeof(body) &&
+        strstr(bt.src, "{first_error}") == NULL) {
+        off += snprintf(body + off, sizeof(body) - off, "\n%s", out->first_error);
+    }
+
+    /* Show why it failed, likewise */
+    if (ri->status != 0 && out->tail[0] != '\0' &&
+        strstr(bt.src, "{tail}") == NULL && off < sizeof(body)) {
+        off += snprintf(body + off, sizeof(body) - off, "\n%s", out->tail);
+    }
+
+    /* Say where to find the rest */
+    if (out->archived && strstr(bt.src, "{id}") == NULL && off < sizeof(body)) {
+        snprintf(body + off, sizeof(body) - off, "\nOutput: %s", ri->id);
+    }
+
+    n.summary = summary;
+    n.body = body;
+    n.key = argv_key(ri->argv);
+    n.exit_ns = ri->mono_end.tv_sec * 1000000000LL + ri->mono_end.tv_nsec;
+    n.urgency = act->urgency;
+    n.has_timeout = act->has_timeout;
+    n.timeout = act->timeout;
+    notify(&n);
+}
+
+/*
+ * Causes a single notification for all steps
+ * reported by nested cmdnotify instances, e.g.,
+ * "12 steps, 1 failed: 'link' returned 1",
+ * followed by the time each step took.
+ *
+ * @ri: Our own run.
+ * @sum: Steps reported by inner instances.
+ * @act: Urgency and timeout to use.
+ */
+static void
+notify_steps(const struct run_info *ri, const struct nest_summary *sum,
+             const struct rule_action *act)
+{
+    const char *cmd = ri->progname;
+    int status = ri->status;
+    char body[1024], dur[32];
+    const struct nest_step *step;
+    struct notification n = {0};
+    size_t off;
+    char *summary;
+
+    if (status == 0 && sum->nfailed == 0) {
         summary = SUCCESS_SUMMARY;
     } else {
         summary = FAILURE_SUMMARY;
     }
 
-    /* Length will be plus 3 to account for quote pair and '\0' */
-    body = malloc(MAX_BODY_BUFSIZE + strlen(cmd));
+    if (sum->nfailed > 0) {
+        off = snprintf(body, sizeof(body), "%zu steps, %zu failed: '%s' returned %d",
+                       sum->nsteps, sum->nfailed, sum->first_fail.name,
+                       sum->first_fail.status);
+    } else {
+        off = snprintf(body, sizeof(body), "%zu steps, '%s' returned %d",
+                       sum->nsteps, cmd, status);
+    }
 
-    snprintf(body, MAX_BODY_BUFSIZE, "'%s' returned %d", cmd, status);
-    notify(summary, body);
-    free(body);
+    for (size_t i = 0; i < sum->nlisted && off < sizeof(body); ++i) {
+        step = &sum->listed[i];
+        fmt_duration(dur, sizeof(dur), step->duration_ms);
+        off += snprintf(body + off, sizeof(body) - off, "\n%s%s %s",
+                        step->status != 0 ? "! " : "", step->name, dur);
+    }
+
+    if (sum->nsteps > sum->nlisted && off < sizeof(body)) {
+        snprintf(body + off, sizeof(body) - off, "\n... and %zu more",
+                 sum->nsteps - sum->nlisted);
+    }
+
+    n.summary = summary;
+    n.body = body;
+    n.key = argv_key(ri->argv);
+    n.exit_ns = ri->mono_end.tv_sec * 1000000000LL + ri->mono_end.tv_nsec;
+    n.urgency = act->urgency;
+    n.has_timeout = act->has_timeout;
+    n.timeout = act->timeout;
+    notify(&n);
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr, "Usage: cmdnotify [-HTPLAB] <command> <args ...>\n"
+            "       cmdnotify -F | --stats | --ps | --search <text>\n"
+            "  -H, --heartbeat  Show heartbeats while the command runs\n"
+            "  -F, --flush      Deliver notifications missed earlier and exit\n"
+            "  -S, --stats      Show notification latency percentiles and exit\n"
+            "      --ps         List the commands running under cmdnotify and exit\n"
+            "      --search     Show the lines of archived output (-A) with <text> and exit\n"
+            "  -T, --tail       Add the last lines of output to failure notifications\n"
+            "  -P, --pty        Like -T, but run the command on its own terminal\n"
+            "  -L, --lines      Like -T, also list the longest pauses in the output\n"
+            "  -A, --archive    Like -T, also keep all output compressed, see the run ID\n"
+            "  -B, --build      Like -P, also show progress of ninja and make builds\n");
 }
 
 int
@@ -175,10 +514,78 @@ main(int argc, char **argv)
     const char space_chr = ' ';
     char **argbuf = NULL;
     size_t argbuf_entries = 1, newsize = 0;
+    struct run_info ri = {0};
+    struct nest_ctx nc;
+    struct nest_summary sum;
+    struct rule_action act;
+    struct run_output out;
     int status = 0;
+    int c;
+
+    /* Stop at the command, its options are its own */
+    while ((c = getopt_long(argc, argv, "+HFSTPLAB", long_opts, NULL)) != -1) {
+        switch (c) {
+        case 'H':
+            opts.heartbeat = true;
+            break;
+        case 'F':
+            opts.flush = true;
+            break;
+        case 'S':
+            opts.stats = true;
+            break;
+        case 'T':
+            opts.tail = true;
+            break;
+        case 'P':
+            opts.tail = opts.pty = true;
+            break;
+        case 'L':
+            opts.tail = opts.lines = true;
+            break;
+        case 'A':
+            opts.tail = opts.archive = true;
+            break;
+        case 'B':
+            opts.tail = opts.pty = opts.build = true;
+            break;
+        case OPT_PS:
+            opts.ps = true;
+            break;
+        case OPT_SEARCH:
+            opts.search = optarg;
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+
+    /* Make argv[1] the command */
+    argc -= optind - 1;
+    argv += optind - 1;
+
+    if (opts.stats) {
+        return latency_print() < 0 ? 1 : 0;
+    }
+
+    if (opts.ps) {
+        return status_print() < 0 ? 1 : 0;
+    }
+
+    if (opts.search != NULL) {
+        status = index_search(opts.search);
+        return status < 0 ? 2 : status;
+    }
+
+    if (opts.flush && argc < 2) {
+        outbox_flush();
+        return 0;
+    }
 
     if (argc < 2) {
         fprintf(stderr, "Error: Too few arguments!\n");
+        usage();
         return 1;
     }
 
@@ -232,13 +639,45 @@ main(int argc, char **argv)
     }
 
     /* Denote end of arglist */
-    argbuf = realloc(argbuf, sizeof(char *) + (argbuf_entries + 1));
+    argbuf = realloc(argbuf, sizeof(char *) * (argbuf_entries + 1));
     argbuf[argbuf_entries] = NULL;
 
+    /* Hand notifications to cmdnotifyd, if it runs */
+    daemon_connect();
+
     /* Run the command and report the status! */
-    status = run_prog(argv[1], argbuf);
-    notify_status(status, argv[1]);
-    free(argbuf);
+    nest_begin(&nc);
+    status = run_prog(argv[1], argbuf, &ri, &out);
+
+    /* Let the outermost cmdnotify report for us */
+    if (nest_report(&nc, &ri)) {
+        free(argbuf);
+        return status;
+    }
+
+    /* Deliver anything missed earlier first */
+    outbox_flush();
+
+    /* Silenced by a rule */
+    nest_collect(&nc, &sum);
+    rules_eval(&ri, &act);
+    if (act.suppress) {
+        free(argbuf);
+        return status;
+    }
 
+    /* Coalesced or over the rate limit */
+    if (!storm_admit(argv_key(argbuf), argv[1], status)) {
+        free(argbuf);
+        return status;
+    }
+
+    if (sum.nsteps > 0) {
+        notify_steps(&ri, &sum, &act);
+    } else {
+        notify_status(&ri, &out, &act);
+    }
+
+    free(argbuf);
     return status;
 }
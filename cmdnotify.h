@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef CMDNOTIFY_H
+#define CMDNOTIFY_H
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <time.h>
+
+/*
+ * Describes a single run of the
+ * wrapped program.
+ */
+struct run_info {
+    char id[17];                /* Run ID in hex, also its trace span ID */
+    const char *progname;       /* e.g., "ls" */
+    char **argv;                /* NULL terminated */
+    pid_t pid;
+    int status;                 /* Exit status */
+    int signo;                  /* Terminating signal, 0 if none */
+    struct timespec start;      /* CLOCK_REALTIME */
+    struct timespec end;        /* CLOCK_REALTIME */
+    struct timespec mono_start; /* CLOCK_MONOTONIC */
+    struct timespec mono_end;   /* CLOCK_MONOTONIC */
+    struct rusage rusage;
+};
+
+/*
+ * Returns the difference between two
+ * timespecs in nanoseconds.
+ */
+static inline long long
+ts_diff_ns(const struct timespec *a, const struct timespec *b)
+{
+    return (b->tv_sec - a->tv_sec) * 1000000000LL +
+           (b->tv_nsec - a->tv_nsec);
+}
+
+#endif  /* !CMDNOTIFY_H */
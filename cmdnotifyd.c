@@ -0,0 +1,452 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * cmdnotifyd, a per-user daemon that shows the
+ * notifications of every cmdnotify. It keeps its
+ * session bus connection open, so a notification
+ * costs neither a notify-send process nor a bus
+ * connect and auth, and cmdnotify does not wait
+ * for the notification server.
+ *
+ * Clients connect to $XDG_RUNTIME_DIR/cmdnotify/daemon.sock
+ * and send a struct daemon_msg per notification,
+ * see daemon.c. The shell hooks send datagrams to
+ * hook.sock next to it, see hook.c.
+ *
+ * Both sockets are served from an io_uring where
+ * the kernel has what we need (see uring.c): one
+ * multishot accept, a multishot recv per client
+ * into a shared ring of provided buffers, and a
+ * multishot poll for the hook socket. A burst of
+ * messages then costs one io_uring_enter() rather
+ * than a recv() each. Elsewhere it is epoll, and
+ * so it is from then on if the ring fails.
+ *
+ * Either way, the notifications are delivered on a
+ * thread of their own, see deliver.c.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include "daemon.h"
+#include "hook.h"
+#include "notify.h"
+#include "deliver.h"
+#include "evloop.h"
+#include "outbox.h"
+#include "uring.h"
+
+/*
+ * Delivers whatever a client sent, in order,
+ * and forgets about it once it is gone.
+ */
+static void
+client_ready(struct ev_watch *w, uint32_t events)
+{
+    struct evloop *ev = w->arg;
+    struct daemon_msg m;
+    struct notification n;
+    int r;
+
+    (void)events;
+    while ((r = daemon_recv(w->fd, &m, &n)) > 0) {
+        deliver_post(&n);
+    }
+
+    if (r == 0 || errno != EAGAIN) {
+        ev_del(ev, w);
+        close(w->fd);
+        free(w);
+    }
+}
+
+/*
+ * Starts serving the client connected on `fd',
+ * or closes it on failure.
+ */
+static void
+client_add(struct evloop *ev, int fd)
+{
+    struct ev_watch *w;
+
+    if ((w = malloc(sizeof(*w))) == NULL) {
+        close(fd);
+        return;
+    }
+
+    *w = (struct ev_watch){ .fd = fd, .fn = client_ready, .arg = ev };
+    if (ev_add(ev, w, EPOLLIN) < 0) {
+        close(fd);
+        free(w);
+    }
+}
+
+static void
+client_accept(struct ev_watch *lw, uint32_t events)
+{
+    struct evloop *ev = lw->arg;
+    int fd;
+
+    (void)events;
+    while ((fd = daemon_accept(lw->fd)) >= 0) {
+        client_add(ev, fd);
+    }
+}
+
+static void
+hook_ready(struct ev_watch *w, uint32_t events)
+{
+    (void)events;
+    hook_recv(w->fd);
+}
+
+#if DAEMON_IO_URING
+#define RING_ENTRIES    64
+#define RING_BUFS       256     /* Messages received but not yet delivered */
+#define RING_GROUP      0
+
+/* What a completion is for, with the fd in user_data */
+#define OP_ACCEPT   0
+#define OP_RECV     1
+#define OP_HOOK     2
+#define OP_BITS     2
+
+static struct uring ring;
+static struct uring_bufs bufs;
+static int ring_lfd = -1;
+static bool ring_failed;
+
+/* Taking the last completions, nothing is rearmed */
+static bool ring_draining;
+
+/* Clients with a recv on the ring, handed to epoll if it fails */
+static int *ring_fds;
+static size_t ring_nfds, ring_cap;
+
+/*
+ * The ring keeps the listening socket open until
+ * the kernel is done tearing it down after we are
+ * gone, and a new cmdnotifyd would take it for a
+ * running one. Shut it down on the way out.
+ */
+static void
+ring_exit(int signo)
+{
+    shutdown(ring_lfd, SHUT_RDWR);
+    signal(signo, SIG_DFL);
+    raise(signo);
+}
+
+/*
+ * Queues the multishot request `op' on `fd'.
+ *
+ * Returns 0 on success, otherwise -1.
+ */
+static int
+ring_arm(int op, int fd)
+{
+    struct io_uring_sqe *sqe;
+
+    if ((sqe = uring_sqe(&ring)) == NULL) {
+        return -1;
+    }
+
+    switch (op) {
+    case OP_ACCEPT:
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+        break;
+    case OP_RECV:
+        sqe->opcode = IORING_OP_RECV;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = RING_GROUP;
+        break;
+    case OP_HOOK:
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->poll32_events = POLLIN;
+        sqe->len = IORING_POLL_ADD_MULTI;
+        break;
+    }
+
+    sqe->fd = fd;
+    sqe->user_data = (uint64_t)fd << OP_BITS | op;
+    return 0;
+}
+
+/*
+ * Starts receiving from the client connected
+ * on `fd'.
+ *
+ * Returns 0 on success, otherwise -1.
+ */
+static int
+ring_client(int fd)
+{
+    int *p;
+
+    if (ring_nfds == ring_cap) {
+        ring_cap = ring_cap == 0 ? 16 : 2 * ring_cap;
+        if ((p = realloc(ring_fds, ring_cap * sizeof(*p))) == NULL) {
+            ring_cap = ring_nfds;
+            return -1;
+        }
+        ring_fds = p;
+    }
+
+    if (!ring_draining && ring_arm(OP_RECV, fd) < 0) {
+        return -1;
+    }
+    ring_fds[ring_nfds++] = fd;
+    return 0;
+}
+
+static void
+ring_client_close(int fd)
+{
+    for (size_t i = 0; i < ring_nfds; ++i) {
+        if (ring_fds[i] == fd) {
+            ring_fds[i] = ring_fds[--ring_nfds];
+            break;
+        }
+    }
+    close(fd);
+}
+
+/*
+ * Queues a message a client sent for delivery,
+ * the buffer goes back to the kernel after.
+ */
+static void
+ring_recv(const struct io_uring_cqe *cqe)
+{
+    struct notification n;
+    unsigned bid;
+
+    if ((cqe->flags & IORING_CQE_F_BUFFER) == 0) {
+        return;
+    }
+
+    bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    if (cqe->res > 0 &&
+        daemon_decode(uring_buf(&bufs, bid), cqe->res, &n) == 0) {
+        deliver_post(&n);
+    }
+    uring_buf_put(&bufs, bid);
+}
+
+static void
+ring_complete(const struct io_uring_cqe *cqe)
+{
+    int op = cqe->user_data & ((1 << OP_BITS) - 1);
+    int fd = cqe->user_data >> OP_BITS;
+    bool more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+
+    switch (op) {
+    case OP_ACCEPT:
+        if (cqe->res >= 0) {
+            if (!daemon_trusted(cqe->res) || ring_client(cqe->res) < 0) {
+                close(cqe->res);
+            }
+        }
+        if (!more && !ring_draining && ring_arm(OP_ACCEPT, fd) < 0) {
+            ring_failed = true;
+        }
+        break;
+    case OP_RECV:
+        ring_recv(cqe);
+        if (more) {
+            break;
+        }
+
+        /*
+         * Multishot recv also stops when we run out
+         * of buffers; those are back by now. When
+         * draining, epoll takes over the client.
+         */
+        if (ring_draining && cqe->res != 0) {
+            break;
+        }
+        if ((cqe->res > 0 || cqe->res == -ENOBUFS) &&
+            ring_arm(OP_RECV, fd) == 0) {
+            break;
+        }
+        ring_client_close(fd);
+        break;
+    case OP_HOOK:
+        hook_recv(fd);
+        if (!more && !ring_draining && ring_arm(OP_HOOK, fd) < 0) {
+            perror("cmdnotifyd: hook socket");
+        }
+        break;
+    }
+}
+
+/*
+ * Serves clients on `lfd' and the hooks on `hfd'
+ * (if not -1) until the ring fails, then hands
+ * the clients to `ev'.
+ *
+ * Returns -1 if the kernel lacks what we need,
+ * without having touched either socket, or
+ * once the ring failed.
+ */
+static int
+serve_uring(int lfd, int hfd, struct evloop *ev)
+{
+    struct io_uring_cqe *cqe;
+
+    if (uring_init(&ring, RING_ENTRIES) < 0) {
+        return -1;
+    }
+
+    if (uring_bufs_init(&ring, &bufs, RING_GROUP, RING_BUFS,
+                        sizeof(struct daemon_msg)) < 0) {
+        uring_fini(&ring);
+        return -1;
+    }
+
+    ring_lfd = lfd;
+    signal(SIGTERM, ring_exit);
+    signal(SIGINT, ring_exit);
+
+    ring_arm(OP_ACCEPT, lfd);
+    if (hfd >= 0) {
+        ring_arm(OP_HOOK, hfd);
+    }
+
+    while (!ring_failed && uring_wait(&ring) == 0) {
+        while ((cqe = uring_cqe(&ring)) != NULL) {
+            ring_complete(cqe);
+            uring_cqe_seen(&ring);
+        }
+    }
+
+    if (ring_failed) {
+        fprintf(stderr, "cmdnotifyd: io_uring: accept not rearmed, using epoll\n");
+    } else {
+        perror("cmdnotifyd: io_uring, using epoll");
+    }
+
+    /*
+     * Whatever the kernel received or accepted
+     * so far is only on the CQ, take it before
+     * epoll takes over.
+     */
+    ring_draining = true;
+    if (uring_cancel(&ring) < 0) {
+        perror("cmdnotifyd: io_uring cancel");
+    }
+    while ((cqe = uring_cqe(&ring)) != NULL) {
+        ring_complete(cqe);
+        uring_cqe_seen(&ring);
+    }
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+
+    /* The kernel may still be receiving into the buffers, keep them */
+    uring_fini(&ring);
+
+    for (size_t i = 0; i < ring_nfds; ++i) {
+        client_add(ev, ring_fds[i]);
+    }
+    free(ring_fds);
+    ring_fds = NULL;
+    ring_nfds = ring_cap = 0;
+    return -1;
+}
+#endif  /* DAEMON_IO_URING */
+
+int
+main(int argc, char **argv)
+{
+    struct evloop ev;
+    struct ev_watch lw, hw;
+
+    (void)argv;
+    if (argc > 1) {
+        fprintf(stderr, "Usage: cmdnotifyd\n");
+        return 1;
+    }
+
+    if (geteuid() == 0) {
+        fprintf(stderr, "Please do not run as root.\n");
+        return 1;
+    }
+
+    if ((lw.fd = daemon_listen()) < 0) {
+        if (errno == EADDRINUSE) {
+            fprintf(stderr, "cmdnotifyd: already running\n");
+        } else {
+            perror("cmdnotifyd: listen");
+        }
+        return 1;
+    }
+
+    notify_use_bus();
+    outbox_flush();
+    if (deliver_begin() < 0) {
+        perror("cmdnotifyd: delivery thread");
+    }
+
+    /* Not fatal, cmdnotify works without */
+    if ((hw.fd = hook_listen()) < 0) {
+        perror("cmdnotifyd: hook socket");
+    }
+
+    if (ev_init(&ev) < 0) {
+        perror("cmdnotifyd: epoll");
+        return 1;
+    }
+
+#if DAEMON_IO_URING
+    serve_uring(lw.fd, hw.fd, &ev);
+#endif
+
+    lw.fn = client_accept;
+    lw.arg = &ev;
+    ev_add(&ev, &lw, EPOLLIN);
+
+    if (hw.fd >= 0) {
+        hw.fn = hook_ready;
+        ev_add(&ev, &hw, EPOLLIN);
+    }
+    ev_run(&ev);
+    ev_fini(&ev);
+    return 0;
+}
@@ -36,4 +36,147 @@
 /* low, normal or critical */
 #define NOTIFY_SEND_URGENCY "normal"
 
+/*
+ * Max bytes of the summary and body sent to the
+ * server, longer text is cut at a character
+ * boundary and ends with an ellipsis.
+ */
+#define NOTIFY_SUMMARY_BUDGET   128
+#define NOTIFY_BODY_BUDGET      1024
+
+/*
+ * Notification summary and body, overridden by
+ * $CMDNOTIFY_SUMMARY and $CMDNOTIFY_BODY. Fields:
+ * {cmd} {argv} {status} {signal} {duration} {maxrss}
+ * {cwd} {host} {tail} {gaps} {id} {errors} {warnings}
+ * {first_error} and {result} (Success or Error).
+ */
+#define NOTIFY_SUMMARY_TEMPLATE "{result}"
+#define NOTIFY_BODY_TEMPLATE    "'{cmd}' returned {status}"
+
+/*
+ * Set to 1 to update a command's last notification
+ * in place, needs notify-send with -p and -r
+ * (libnotify 0.7.9 or newer).
+ */
+#define NOTIFY_SEND_REPLACE 1
+
+/*
+ * Max notify-send runs in flight while the program
+ * runs, transient notifications beyond that are
+ * dropped rather than waited for.
+ */
+#define NOTIFY_PENDING      4
+
+/* Max time cmdnotifyd waits for the notification server (in milliseconds) */
+#define NOTIFY_BUS_TIMEOUT  5000
+
+/*
+ * Set to 1 to have cmdnotifyd serve its sockets
+ * from an io_uring on Linux 6.1 and newer. It
+ * has not measured faster than epoll, so epoll
+ * stays the default. The benchmarks build it
+ * both ways with -D.
+ */
+#ifndef DAEMON_IO_URING
+#define DAEMON_IO_URING     0
+#endif
+
+/*
+ * Progress notifications are limited to one
+ * per PROGRESS_INTERVAL ms, with bursts of
+ * up to PROGRESS_BURST.
+ */
+#define PROGRESS_INTERVAL   2000
+#define PROGRESS_BURST      2
+
+/*
+ * With -H, heartbeats are shown after HEARTBEAT_INTERVAL
+ * seconds, doubling each time up to HEARTBEAT_MAX.
+ */
+#define HEARTBEAT_INTERVAL  60
+#define HEARTBEAT_MAX       3600
+
+/*
+ * With -T, the last CAPTURE_SIZE KiB of output are
+ * kept and its last CAPTURE_LINES lines added to
+ * failure notifications. CAPTURE_SIZE must be a
+ * multiple of the page size.
+ */
+#define CAPTURE_SIZE    64
+#define CAPTURE_LINES   5
+
+/*
+ * With -L, the LINES_TOP longest pauses in the output
+ * of at least LINES_GAP_MIN ms are listed.
+ */
+#define LINES_TOP       3
+#define LINES_GAP_MIN   1000
+
+/* How often cmdnotify --ps figures are updated (in milliseconds) */
+#define STATUS_INTERVAL 1000
+
+/* Space kept for files of past runs (in MiB), oldest runs go first */
+#define RUNS_MAX_SIZE   64
+
+/*
+ * With -A, output is queued for the compressor in
+ * up to ARCHIVE_QUEUE KiB (a power of two), and
+ * written out at least every ARCHIVE_FLUSH seconds.
+ */
+#define ARCHIVE_QUEUE   4096
+#define ARCHIVE_FLUSH   1
+
+/*
+ * The archive's index is written out every
+ * INDEX_SEGMENT blocks (of 64 KiB), the postings
+ * of that many are kept in memory.
+ */
+#define INDEX_SEGMENT   256
+
+/*
+ * With the shell hooks, cmdnotifyd notifies of commands
+ * that took at least HOOK_MIN_DURATION seconds, but for
+ * the ones in HOOK_IGNORE (space separated).
+ */
+#define HOOK_MIN_DURATION   10
+#define HOOK_IGNORE "vi vim nvim emacs nano less more man ssh top htop tmux screen cmdnotify"
+
+/* Default time between notifications for a trigger (in seconds) */
+#define TRIGGER_COOLDOWN    30
+
+/*
+ * Notify once the program printed nothing and made
+ * no CPU progress for IDLE_TIMEOUT seconds while
+ * reading a terminal, 0 to never. Needs -T or one
+ * of the options implying it.
+ */
+#define IDLE_TIMEOUT    30
+
+/* Replay more missed notifications than this as one summary */
+#define OUTBOX_COALESCE 5
+
+/* Samples kept per latency histogram before old ones fade */
+#define LATENCY_WINDOW  10000
+
+/* Trace span spool file, kept in $XDG_RUNTIME_DIR/cmdnotify */
+#define TRACE_SPOOL_NAME "spans.json"
+
+/* Max time to wait for the trace collector (in milliseconds) */
+#define TRACE_SEND_TIMEOUT 50
+
+/* Max nested steps listed in an aggregated notification */
+#define NEST_MAX_LISTED 8
+
+/*
+ * Storm control, identical (command, status) events
+ * within STORM_WINDOW ms are coalesced into one
+ * notification. Notifications are rate limited to
+ * STORM_RATE per second with bursts of up to
+ * STORM_BURST, overflow is folded into a summary.
+ */
+#define STORM_WINDOW    2000
+#define STORM_RATE      2
+#define STORM_BURST     8
+
 #endif  /* !CONFIG_H */
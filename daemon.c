@@ -0,0 +1,318 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * cmdnotify hands its notifications to cmdnotifyd
+ * if it runs, see cmdnotifyd.c. The connection is
+ * made before the command starts, so sending a
+ * notification is a single sendmsg(). Without a
+ * daemon, cmdnotify delivers them itself.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include "daemon.h"
+#include "xdg.h"
+
+static int daemon_fd = -1;
+
+/*
+ * Copies `src' to `dst', cut at a character
+ * boundary if it does not fit.
+ *
+ * Returns the length of the copy.
+ */
+static size_t
+copy_str(char *dst, size_t len, const char *src)
+{
+    size_t n = strlen(src);
+
+    if (n >= len) {
+        n = len - 1;
+        while (n > 0 && ((unsigned char)src[n] & 0xc0) == 0x80) {
+            --n;
+        }
+    }
+
+    memcpy(dst, src, n);
+    dst[n] = '\0';
+    return n;
+}
+
+/*
+ * Connects to cmdnotifyd, if it runs, for
+ * daemon_send() to use.
+ *
+ * Returns 0 on success, otherwise -1.
+ */
+int
+daemon_connect(void)
+{
+    struct sockaddr_un sun = { .sun_family = AF_UNIX };
+    int fd;
+
+    if (xdg_path(XDG_RUNTIME, DAEMON_SOCK, sun.sun_path, sizeof(sun.sun_path)) < 0) {
+        return -1;
+    }
+
+    fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (connect(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    daemon_fd = fd;
+    return 0;
+}
+
+/*
+ * Puts `n' into `m' as it is sent.
+ *
+ * Returns the length of the message, up
+ * to the body's NUL.
+ */
+size_t
+daemon_encode(const struct notification *n, struct daemon_msg *m)
+{
+    /* Sent up to the body's NUL, keep the rest of our stack out */
+    memset(m, 0, offsetof(struct daemon_msg, body));
+    m->magic = DAEMON_MAGIC;
+    m->version = DAEMON_VERSION;
+    m->flags = (n->has_timeout ? DAEMON_TIMEOUT : 0) |
+               (n->has_progress ? DAEMON_PROGRESS : 0) |
+               (n->transient ? DAEMON_TRANSIENT : 0);
+    m->key = n->key;
+    m->exit_ns = n->exit_ns;
+    m->timeout = n->timeout;
+    m->progress = n->progress;
+    copy_str(m->urgency, sizeof(m->urgency), n->urgency != NULL ? n->urgency : "");
+    copy_str(m->summary, sizeof(m->summary), n->summary);
+    return offsetof(struct daemon_msg, body) +
+           copy_str(m->body, sizeof(m->body), n->body) + 1;
+}
+
+/*
+ * Hands `n' to cmdnotifyd, if connected.
+ *
+ * Returns 0 on success, otherwise -1 and
+ * the caller has to deliver it.
+ */
+int
+daemon_send(const struct notification *n)
+{
+    struct daemon_msg m;
+    struct iovec iov = { .iov_base = &m };
+    struct msghdr mh = { .msg_iov = &iov, .msg_iovlen = 1 };
+
+    if (daemon_fd < 0) {
+        return -1;
+    }
+
+    iov.iov_len = daemon_encode(n, &m);
+    if (sendmsg(daemon_fd, &mh, MSG_NOSIGNAL) == (ssize_t)iov.iov_len) {
+        return 0;
+    }
+
+    /* Gone or falling behind, deliver ourselves from now on */
+    close(daemon_fd);
+    daemon_fd = -1;
+    return -1;
+}
+
+/*
+ * Creates the socket cmdnotifyd listens on,
+ * taking over the path from a daemon that
+ * went away.
+ *
+ * Returns the socket, or -1 on failure with
+ * errno EADDRINUSE if a daemon is running.
+ */
+int
+daemon_listen(void)
+{
+    struct sockaddr_un sun = { .sun_family = AF_UNIX };
+    int fd, probe;
+
+    if (xdg_path(XDG_RUNTIME, DAEMON_SOCK, sun.sun_path, sizeof(sun.sun_path)) < 0) {
+        return -1;
+    }
+
+    fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0) {
+        if (errno != EADDRINUSE) {
+            goto fail;
+        }
+
+        /* Nobody answering means the socket is stale */
+        probe = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (probe >= 0 && connect(probe, (struct sockaddr *)&sun, sizeof(sun)) == 0) {
+            close(probe);
+            errno = EADDRINUSE;
+            goto fail;
+        }
+        if (probe >= 0) {
+            close(probe);
+        }
+
+        unlink(sun.sun_path);
+        if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0) {
+            goto fail;
+        }
+    }
+
+    if (listen(fd, SOMAXCONN) < 0) {
+        goto fail;
+    }
+    return fd;
+
+fail:
+    close(fd);
+    return -1;
+}
+
+/*
+ * Returns true if the client socket `fd' is
+ * connected to a process of our own user.
+ */
+bool
+daemon_trusted(int fd)
+{
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+
+    return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 &&
+           cred.uid == getuid();
+}
+
+/*
+ * Accepts a client on the listening socket
+ * `lfd', refusing other users.
+ *
+ * Returns the client socket, or -1 once there
+ * are none left.
+ */
+int
+daemon_accept(int lfd)
+{
+    int fd;
+
+    for (;;) {
+        fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0 && errno == EINTR) {
+            continue;
+        }
+        if (fd < 0) {
+            return -1;
+        }
+
+        if (daemon_trusted(fd)) {
+            return fd;
+        }
+        close(fd);
+    }
+}
+
+/*
+ * Checks the `len' byte message received into
+ * `m' and points `n' into it.
+ *
+ * Returns 0 on success, or -1 if the message
+ * is not ours.
+ */
+int
+daemon_decode(struct daemon_msg *m, size_t len, struct notification *n)
+{
+    const size_t hdrlen = offsetof(struct daemon_msg, body);
+
+    if (len <= hdrlen || len > sizeof(*m) || m->magic != DAEMON_MAGIC ||
+        m->version != DAEMON_VERSION) {
+        return -1;
+    }
+
+    m->urgency[sizeof(m->urgency) - 1] = '\0';
+    m->summary[sizeof(m->summary) - 1] = '\0';
+    ((char *)m)[len - 1] = '\0';
+
+    memset(n, 0, sizeof(*n));
+    n->summary = m->summary;
+    n->body = m->body;
+    n->key = m->key;
+    n->urgency = m->urgency[0] != '\0' ? m->urgency : NULL;
+    n->has_timeout = (m->flags & DAEMON_TIMEOUT) != 0;
+    n->timeout = m->timeout;
+    n->has_progress = (m->flags & DAEMON_PROGRESS) != 0;
+    n->progress = m->progress;
+    n->transient = (m->flags & DAEMON_TRANSIENT) != 0;
+    n->exit_ns = m->exit_ns;
+    return 0;
+}
+
+/*
+ * Receives the next message from the client
+ * socket `fd' into `m', with `n' pointing into
+ * it. Messages that are not ours are skipped.
+ *
+ * Returns 1 on success, 0 once the client is
+ * gone, or -1 (errno EAGAIN if there is
+ * nothing left to read).
+ */
+int
+daemon_recv(int fd, struct daemon_msg *m, struct notification *n)
+{
+    ssize_t r;
+
+    for (;;) {
+        r = recv(fd, m, sizeof(*m), 0);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            return r;
+        }
+        if (daemon_decode(m, r, n) == 0) {
+            return 1;
+        }
+    }
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "notify.h"
+#include "config.h"
+
+#define DAEMON_SOCK     "daemon.sock"   /* In $XDG_RUNTIME_DIR/cmdnotify */
+#define DAEMON_MAGIC    0x444e4d43U     /* "CMND" */
+#define DAEMON_VERSION  1
+
+/* Flags of a daemon_msg */
+#define DAEMON_TIMEOUT      0x01
+#define DAEMON_PROGRESS     0x02
+#define DAEMON_TRANSIENT    0x04
+
+/*
+ * A notification as sent to cmdnotifyd, one per
+ * SOCK_SEQPACKET message. Strings are terminated,
+ * the message ends after the body's NUL.
+ */
+struct daemon_msg {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t flags;
+    uint64_t key;
+    int64_t exit_ns;
+    int32_t timeout;
+    int32_t progress;
+    char urgency[16];
+    char summary[NOTIFY_SUMMARY_BUDGET];
+    char body[NOTIFY_BODY_BUDGET];
+};
+
+int daemon_connect(void);
+size_t daemon_encode(const struct notification *n, struct daemon_msg *m);
+int daemon_send(const struct notification *n);
+int daemon_listen(void);
+int daemon_accept(int lfd);
+bool daemon_trusted(int fd);
+int daemon_decode(struct daemon_msg *m, size_t len, struct notification *n);
+int daemon_recv(int fd, struct daemon_msg *m, struct notification *n);
+
+#endif  /* !DAEMON_H */
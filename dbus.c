@@ -0,0 +1,599 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Just enough of a D-Bus client to call
+ * org.freedesktop.Notifications.Notify over a
+ * session bus connection that stays open, so
+ * cmdnotifyd does not pay for a notify-send
+ * process and a bus connect and auth for every
+ * notification.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include "dbus.h"
+#include "config.h"
+
+#define DBUS_MSG_MAX    4096    /* Messages we send, or look at */
+
+/* Message types */
+#define MSG_METHOD_CALL     1
+#define MSG_METHOD_RETURN   2
+#define MSG_ERROR           3
+
+/* Header fields */
+#define FIELD_PATH          1
+#define FIELD_INTERFACE     2
+#define FIELD_MEMBER        3
+#define FIELD_REPLY_SERIAL  5
+#define FIELD_DESTINATION   6
+#define FIELD_SIGNATURE     8
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define DBUS_ENDIAN 'B'
+#else
+#define DBUS_ENDIAN 'l'
+#endif  /* __BYTE_ORDER__ */
+
+#define ALIGN(x, a) (((x) + (a) - 1) & ~(size_t)((a) - 1))
+
+#define BUS_NAME        "org.freedesktop.DBus"
+#define BUS_PATH        "/org/freedesktop/DBus"
+#define NOTIFY_NAME     "org.freedesktop.Notifications"
+#define NOTIFY_PATH     "/org/freedesktop/Notifications"
+
+/*
+ * A message being marshalled, alignment
+ * is relative to its start.
+ */
+struct msgbuf {
+    char p[DBUS_MSG_MAX];
+    size_t len;
+    size_t body;        /* Offset of the body */
+    bool overflow;
+};
+
+static void
+put(struct msgbuf *m, const void *p, size_t n)
+{
+    if (n > sizeof(m->p) - m->len) {
+        m->overflow = true;
+        return;
+    }
+    memcpy(m->p + m->len, p, n);
+    m->len += n;
+}
+
+static void
+put_align(struct msgbuf *m, size_t a)
+{
+    static const char zero[8];
+
+    put(m, zero, ALIGN(m->len, a) - m->len);
+}
+
+static void
+put_u8(struct msgbuf *m, uint8_t v)
+{
+    put(m, &v, 1);
+}
+
+static void
+put_u32(struct msgbuf *m, uint32_t v)
+{
+    put_align(m, 4);
+    put(m, &v, 4);
+}
+
+/*
+ * Overwrites the uint32 at `off', for
+ * lengths only known afterwards.
+ */
+static void
+patch_u32(struct msgbuf *m, size_t off, uint32_t v)
+{
+    if (off + 4 <= m->len) {
+        memcpy(m->p + off, &v, 4);
+    }
+}
+
+/* Strings and object paths */
+static void
+put_str(struct msgbuf *m, const char *s)
+{
+    size_t n = strlen(s);
+
+    put_u32(m, n);
+    put(m, s, n + 1);
+}
+
+/* Signatures */
+static void
+put_sig(struct msgbuf *m, const char *s)
+{
+    size_t n = strlen(s);
+
+    put_u8(m, n);
+    put(m, s, n + 1);
+}
+
+/*
+ * Adds a header field, `type' is the
+ * type of `val' ('s', 'o' or 'g').
+ */
+static void
+put_field(struct msgbuf *m, uint8_t code, char type, const char *val)
+{
+    char sig[2] = { type, '\0' };
+
+    put_align(m, 8);
+    put_u8(m, code);
+    put_sig(m, sig);
+    if (type == 'g') {
+        put_sig(m, val);
+    } else {
+        put_str(m, val);
+    }
+}
+
+/*
+ * Starts a method call with the signature
+ * `sig' (NULL if it takes no arguments),
+ * the arguments follow.
+ */
+static void
+msg_begin(struct dbus *b, struct msgbuf *m, const char *dest, const char *path,
+          const char *iface, const char *member, const char *sig)
+{
+    if (++b->serial == 0) {
+        b->serial = 1;
+    }
+
+    m->len = 0;
+    m->overflow = false;
+    put_u8(m, DBUS_ENDIAN);
+    put_u8(m, MSG_METHOD_CALL);
+    put_u8(m, 0);               /* Flags */
+    put_u8(m, 1);               /* Protocol version */
+    put_u32(m, 0);              /* Body length, see call() */
+    put_u32(m, b->serial);
+    put_u32(m, 0);              /* Header fields length */
+
+    put_field(m, FIELD_PATH, 'o', path);
+    put_field(m, FIELD_INTERFACE, 's', iface);
+    put_field(m, FIELD_MEMBER, 's', member);
+    put_field(m, FIELD_DESTINATION, 's', dest);
+    if (sig != NULL) {
+        put_field(m, FIELD_SIGNATURE, 'g', sig);
+    }
+    patch_u32(m, 12, m->len - 16);
+
+    put_align(m, 8);
+    m->body = m->len;
+}
+
+static uint32_t
+get_u32(const char *p, bool swap)
+{
+    uint32_t v;
+
+    memcpy(&v, p, 4);
+    return swap ? __builtin_bswap32(v) : v;
+}
+
+/*
+ * Returns the serial of the call the message
+ * in `buf' with `fieldlen' bytes of header
+ * fields answers, 0 if none.
+ */
+static uint32_t
+reply_serial(const char *buf, size_t fieldlen, bool swap)
+{
+    size_t off = 16, end = 16 + fieldlen, n;
+    uint8_t code;
+    char type;
+
+    while ((off = ALIGN(off, 8)) + 4 <= end) {
+        code = buf[off];
+        type = buf[off + 2];
+        if (buf[off + 1] != 1) {
+            break;
+        }
+        off += 4;
+
+        switch (type) {
+        case 'u':
+            off = ALIGN(off, 4);
+            if (off + 4 > end) {
+                return 0;
+            }
+            if (code == FIELD_REPLY_SERIAL) {
+                return get_u32(buf + off, swap);
+            }
+            off += 4;
+            break;
+        case 's':
+        case 'o':
+            off = ALIGN(off, 4);
+            if (off + 4 > end) {
+                return 0;
+            }
+            n = get_u32(buf + off, swap);
+            off += 4 + n + 1;
+            break;
+        case 'g':
+            off += 1 + (uint8_t)buf[off] + 1;
+            break;
+        default:
+            return 0;
+        }
+    }
+    return 0;
+}
+
+static int
+read_full(int fd, char *p, size_t n)
+{
+    ssize_t r;
+
+    while (n > 0) {
+        r = recv(fd, p, n, 0);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            return -1;
+        }
+        p += r;
+        n -= r;
+    }
+    return 0;
+}
+
+static int
+write_full(int fd, const char *p, size_t n)
+{
+    ssize_t r;
+
+    while (n > 0) {
+        r = send(fd, p, n, MSG_NOSIGNAL);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            return -1;
+        }
+        p += r;
+        n -= r;
+    }
+    return 0;
+}
+
+/*
+ * Sends the call in `m' and waits for its reply,
+ * skipping signals and anything else on the way.
+ * For a method return, its first argument is
+ * stored in `retp' if it is a uint32.
+ *
+ * Returns 0 on success, -1 if the call failed.
+ * The connection is closed if it broke.
+ */
+static int
+call(struct dbus *b, struct msgbuf *m, uint32_t *retp)
+{
+    char buf[DBUS_MSG_MAX];
+    uint32_t bodylen, fieldlen;
+    size_t total, body, n;
+    bool swap;
+
+    if (m->overflow) {
+        return -1;
+    }
+
+    patch_u32(m, 4, m->len - m->body);
+    if (write_full(b->fd, m->p, m->len) < 0) {
+        goto broken;
+    }
+
+    for (;;) {
+        if (read_full(b->fd, buf, 16) < 0 || buf[3] != 1) {
+            goto broken;
+        }
+
+        swap = buf[0] != DBUS_ENDIAN;
+        bodylen = get_u32(buf + 4, swap);
+        fieldlen = get_u32(buf + 12, swap);
+        body = ALIGN(16 + (size_t)fieldlen, 8);
+        total = body + bodylen;
+
+        /* Too big to be our reply */
+        if (total > sizeof(buf)) {
+            for (total -= 16; total > 0; total -= n) {
+                n = total < sizeof(buf) ? total : sizeof(buf);
+                if (read_full(b->fd, buf, n) < 0) {
+                    goto broken;
+                }
+            }
+            continue;
+        }
+
+        if (read_full(b->fd, buf + 16, total - 16) < 0) {
+            goto broken;
+        }
+
+        if ((buf[1] != MSG_METHOD_RETURN && buf[1] != MSG_ERROR) ||
+            reply_serial(buf, fieldlen, swap) != b->serial) {
+            continue;
+        }
+
+        if (buf[1] == MSG_ERROR) {
+            return -1;
+        }
+        if (retp != NULL && bodylen >= 4) {
+            *retp = get_u32(buf + body, swap);
+        }
+        return 0;
+    }
+
+broken:
+    dbus_close(b);
+    return -1;
+}
+
+/*
+ * Finds the session bus socket from
+ * $DBUS_SESSION_BUS_ADDRESS, e.g.,
+ * "unix:path=/run/user/1000/bus", or else
+ * uses $XDG_RUNTIME_DIR/bus.
+ *
+ * Returns 0 on success, otherwise -1.
+ */
+static int
+bus_addr(struct sockaddr_un *sun, socklen_t *lenp)
+{
+    const char *addr = getenv("DBUS_SESSION_BUS_ADDRESS");
+    const char *p, *end, *kv, *kvend, *v;
+    char hex[3] = {0};
+    size_t off;
+    int n;
+
+    if (addr == NULL) {
+        if ((p = getenv("XDG_RUNTIME_DIR")) == NULL) {
+            return -1;
+        }
+        n = snprintf(sun->sun_path, sizeof(sun->sun_path), "%s/bus", p);
+        *lenp = sizeof(*sun);
+        return n < 0 || (size_t)n >= sizeof(sun->sun_path) ? -1 : 0;
+    }
+
+    /* Addresses to try are separated by ';' */
+    for (p = addr; *p != '\0'; p = *end == ';' ? end + 1 : end) {
+        end = p + strcspn(p, ";");
+        if (strncmp(p, "unix:", 5) != 0) {
+            continue;
+        }
+
+        for (kv = p + 5; kv < end; kv = kvend + 1) {
+            kvend = kv + strcspn(kv, ",;");
+            if (strncmp(kv, "path=", 5) == 0) {
+                v = kv + 5;
+                off = 0;
+            } else if (strncmp(kv, "abstract=", 9) == 0) {
+                v = kv + 9;
+                sun->sun_path[0] = '\0';
+                off = 1;
+            } else {
+                continue;
+            }
+
+            /* Values are %-escaped */
+            while (v < kvend && off < sizeof(sun->sun_path) - 1) {
+                if (*v == '%' && kvend - v >= 3) {
+                    memcpy(hex, v + 1, 2);
+                    sun->sun_path[off++] = strtol(hex, NULL, 16);
+                    v += 3;
+                } else {
+                    sun->sun_path[off++] = *v++;
+                }
+            }
+            if (v < kvend) {
+                return -1;
+            }
+
+            if (sun->sun_path[0] != '\0') {
+                sun->sun_path[off++] = '\0';
+            }
+            *lenp = offsetof(struct sockaddr_un, sun_path) + off;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Connects and authenticates to the session
+ * bus. Calls wait for up to NOTIFY_BUS_TIMEOUT
+ * ms for their reply.
+ *
+ * Returns 0 on success, otherwise -1.
+ */
+int
+dbus_open(struct dbus *b)
+{
+    struct sockaddr_un sun = { .sun_family = AF_UNIX };
+    struct timeval tv = {
+        .tv_sec = NOTIFY_BUS_TIMEOUT / 1000,
+        .tv_usec = NOTIFY_BUS_TIMEOUT % 1000 * 1000
+    };
+    struct msgbuf m;
+    char buf[64], uid[16];
+    socklen_t len;
+    size_t off = 0;
+    ssize_t r;
+    int n;
+
+    b->fd = -1;
+    b->serial = 0;
+    if (bus_addr(&sun, &len) < 0) {
+        return -1;
+    }
+
+    b->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (b->fd < 0) {
+        return -1;
+    }
+
+    setsockopt(b->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(b->fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    if (connect(b->fd, (struct sockaddr *)&sun, len) < 0) {
+        goto fail;
+    }
+
+    /*
+     * SASL EXTERNAL, the server checks our
+     * credentials against the hex encoded
+     * decimal uid. The NUL byte in front
+     * is required.
+     */
+    snprintf(uid, sizeof(uid), "%u", (unsigned)getuid());
+    buf[0] = '\0';
+    n = 1 + snprintf(buf + 1, sizeof(buf) - 1, "AUTH EXTERNAL ");
+    for (size_t i = 0; uid[i] != '\0'; ++i) {
+        n += snprintf(buf + n, sizeof(buf) - n, "%02x", uid[i]);
+    }
+    n += snprintf(buf + n, sizeof(buf) - n, "\r\n");
+    if (write_full(b->fd, buf, n) < 0) {
+        goto fail;
+    }
+
+    while (off < 4 || memcmp(buf + off - 2, "\r\n", 2) != 0) {
+        if (off == sizeof(buf)) {
+            goto fail;
+        }
+        r = recv(b->fd, buf + off, sizeof(buf) - off, 0);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            goto fail;
+        }
+        off += r;
+    }
+    if (memcmp(buf, "OK ", 3) != 0 || write_full(b->fd, "BEGIN\r\n", 7) < 0) {
+        goto fail;
+    }
+
+    /* Must be the first call on a connection */
+    msg_begin(b, &m, BUS_NAME, BUS_PATH, BUS_NAME, "Hello", NULL);
+    return call(b, &m, NULL);
+
+fail:
+    dbus_close(b);
+    return -1;
+}
+
+/*
+ * Shows a notification, like notify-send would.
+ *
+ * @urgency: "low", "normal" or "critical".
+ * @timeout: Expiry in ms.
+ * @progress: Percentage, or -1 for none.
+ * @replaces: ID of the notification to update
+ *            in place, 0 for a new one.
+ * @idp: Set to the ID of the notification.
+ *
+ * Returns 0 on success, otherwise -1.
+ */
+int
+dbus_notify(struct dbus *b, const char *summary, const char *body,
+            const char *urgency, int timeout, int progress,
+            uint32_t replaces, uint32_t *idp)
+{
+    struct msgbuf m;
+    uint8_t level = 1;
+    size_t lenoff, start;
+
+    if (b->fd < 0) {
+        return -1;
+    }
+
+    if (strcmp(urgency, "low") == 0) {
+        level = 0;
+    } else if (strcmp(urgency, "critical") == 0) {
+        level = 2;
+    }
+
+    msg_begin(b, &m, NOTIFY_NAME, NOTIFY_PATH, NOTIFY_NAME, "Notify",
+              "susssasa{sv}i");
+    put_str(&m, "cmdnotify");
+    put_u32(&m, replaces);
+    put_str(&m, "");            /* Icon */
+    put_str(&m, summary);
+    put_str(&m, body);
+    put_u32(&m, 0);             /* No actions */
+
+    /* Hints, dict entries are 8 byte aligned */
+    put_u32(&m, 0);
+    lenoff = m.len - 4;
+    put_align(&m, 8);
+    start = m.len;
+
+    put_str(&m, "urgency");
+    put_sig(&m, "y");
+    put_u8(&m, level);
+    if (progress >= 0) {
+        put_align(&m, 8);
+        put_str(&m, "value");
+        put_sig(&m, "i");
+        put_u32(&m, progress);
+    }
+    patch_u32(&m, lenoff, m.len - start);
+
+    put_u32(&m, timeout);
+    return call(b, &m, idp);
+}
+
+void
+dbus_close(struct dbus *b)
+{
+    if (b->fd >= 0) {
+        close(b->fd);
+        b->fd = -1;
+    }
+}
@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Delivery of what cmdnotifyd receives, on a thread
+ * of its own. Serving the sockets only copies each
+ * notification into a queue, so a notification server
+ * slow to reply (up to NOTIFY_BUS_TIMEOUT), or a run
+ * of notify-send once the bus is gone, never holds up
+ * reading them.
+ *
+ * The queue has a single producer and a single
+ * consumer, which sleeps on a futex while it is
+ * empty, like the archive's (see archive.c). If it
+ * is full, transient notifications are dropped and
+ * the others go to the outbox.
+ */
+
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include "deliver.h"
+#include "daemon.h"
+#include "outbox.h"
+
+#define DELIVER_SLOTS   256     /* Power of two */
+
+struct slot {
+    struct daemon_msg m;
+    size_t len;
+};
+
+static struct slot queue[DELIVER_SLOTS];
+static _Atomic uint64_t head;       /* Written by the loop */
+static _Atomic uint64_t tail;       /* Written by the deliverer */
+static _Atomic uint32_t sleeping;   /* Futex, the deliverer waits on it */
+static bool running;
+
+/*
+ * The delivery thread.
+ */
+static void *
+deliver_main(void *arg)
+{
+    struct notification n;
+    struct slot *s;
+    uint64_t t;
+
+    (void)arg;
+    for (;;) {
+        t = atomic_load_explicit(&tail, memory_order_relaxed);
+
+        /* Go to sleep, unless one came in meanwhile */
+        if (atomic_load(&head) == t) {
+            atomic_store(&sleeping, 1);
+            if (atomic_load(&head) == t) {
+                syscall(SYS_futex, &sleeping, FUTEX_WAIT_PRIVATE, 1, NULL, NULL, 0);
+            }
+            atomic_store(&sleeping, 0);
+            continue;
+        }
+
+        s = &queue[t & (DELIVER_SLOTS - 1)];
+        if (daemon_decode(&s->m, s->len, &n) == 0) {
+            notify(&n);
+        }
+        atomic_store_explicit(&tail, t + 1, memory_order_release);
+    }
+
+    return NULL;
+}
+
+/*
+ * Starts the delivery thread.
+ *
+ * Returns 0 on success, otherwise -1 and
+ * deliver_post() delivers right away.
+ */
+int
+deliver_begin(void)
+{
+    sigset_t all, old;
+    pthread_t thread;
+    int error;
+
+    /* Signals are for the loop, e.g., SIGTERM */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    error = pthread_create(&thread, NULL, deliver_main, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (error != 0) {
+        return -1;
+    }
+
+    pthread_detach(thread);
+    running = true;
+    return 0;
+}
+
+/*
+ * Queues `n' for delivery.
+ */
+void
+deliver_post(const struct notification *n)
+{
+    uint64_t h = atomic_load_explicit(&head, memory_order_relaxed);
+    struct slot *s;
+
+    if (!running) {
+        notify(n);
+        return;
+    }
+
+    if (h - atomic_load_explicit(&tail, memory_order_acquire) == DELIVER_SLOTS) {
+        if (!n->transient) {
+            outbox_append(n);
+        }
+        return;
+    }
+
+    s = &queue[h & (DELIVER_SLOTS - 1)];
+    s->len = daemon_encode(n, &s->m);
+    atomic_store(&head, h + 1);
+
+    if (atomic_exchange(&sleeping, 0) != 0) {
+        syscall(SYS_futex, &sleeping, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+}
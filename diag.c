@@ -0,0 +1,436 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Error and warning parsers for build and test
+ * output. Output is read as it passes through,
+ * one byte at a time per stream, into a line of
+ * at most DIAG_LINE_MAX bytes without escape
+ * sequences. Each complete line is matched once
+ * from left to right against the formats of:
+ *
+ *      gcc, clang, rustc and ld diagnostics,
+ *          "file:line:col: error: message"
+ *      GNU make, "make[1]: *** [all] Error 2"
+ *          and "Makefile:3: *** message.  Stop."
+ *      ninja, "FAILED: target"
+ *      pytest, "FAILED test.py::test - message"
+ *      go test, "--- FAIL: TestFoo (0.00s)"
+ *      cargo test, "test foo ... FAILED"
+ *      CTest, "The following tests FAILED:"
+ *
+ * A line may add a location to the error on the
+ * line before it (rustc's "--> file:line:col",
+ * go test's "file_test.go:12: message"), which
+ * is the only state kept between lines.
+ *
+ * Failures reported by build tools about their
+ * subcommands, e.g., "make: *** [all] Error 1"
+ * or "collect2: error: ld returned 1", only
+ * count when nothing else explains them.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif  /* __SSE2__ */
+#include "diag.h"
+
+#define PREFIX(s, lit)  (strncmp((s), lit, sizeof(lit) - 1) == 0)
+
+/* Escape sequence states */
+#define ESC_NONE    0
+#define ESC_START   1
+#define ESC_CSI     2
+
+/* What the next line may add to the first error */
+#define WANT_NONE   0
+#define WANT_ARROW  1       /* rustc, "  --> src/main.rs:2:13" */
+#define WANT_INDENT 2       /* go test, "    foo_test.go:12: message" */
+
+/*
+ * Appends `n' bytes at `s' to the `*len' bytes
+ * in `buf', as many as fit in DIAG_FIRST_MAX.
+ */
+static void
+append(char *buf, size_t *len, const char *s, size_t n)
+{
+    if (n > DIAG_FIRST_MAX - 1 - *len) {
+        n = DIAG_FIRST_MAX - 1 - *len;
+    }
+    memcpy(buf + *len, s, n);
+    *len += n;
+    buf[*len] = '\0';
+}
+
+/*
+ * Sets the first error to "loc: msg", or just
+ * `msg' if `loc' is NULL, unless it is set.
+ *
+ * Returns true if it was set.
+ */
+static bool
+set_first(char *first, const char *loc, size_t loclen, const char *msg)
+{
+    char buf[DIAG_FIRST_MAX];
+    size_t len = 0;
+
+    if (first[0] != '\0') {
+        return false;
+    }
+    if (loc != NULL && loclen > 0) {
+        append(buf, &len, loc, loclen);
+        append(buf, &len, ": ", 2);
+    }
+    append(buf, &len, msg, strlen(msg));
+    memcpy(first, buf, len + 1);
+    return true;
+}
+
+static void
+error(struct diag *d, struct diag_stream *s, const char *loc, size_t loclen,
+      const char *msg, uint8_t want)
+{
+    ++d->errors;
+    if (set_first(d->first, loc, loclen, msg)) {
+        s->want = want;
+    }
+}
+
+/*
+ * Lets the line after an error add its location,
+ * returns true if it did.
+ */
+static bool
+add_location(struct diag *d, struct diag_stream *s, const char *line)
+{
+    char msg[DIAG_FIRST_MAX];
+    const char *p = line;
+    size_t len = 0;
+    uint8_t want = s->want;
+
+    s->want = WANT_NONE;
+    while (*p == ' ' || *p == '\t') {
+        ++p;
+    }
+
+    if (want == WANT_ARROW && PREFIX(p, "--> ")) {
+        snprintf(msg, sizeof(msg), "%s", d->first);
+        d->first[0] = '\0';
+        set_first(d->first, p + 4, strlen(p + 4), msg);
+        return true;
+    }
+
+    /* "name.go:12: message" */
+    if (want == WANT_INDENT && p != line && strstr(p, ".go:") != NULL) {
+        append(msg, &len, p, strlen(p));
+        append(msg, &len, " (", 2);
+        append(msg, &len, d->first, strlen(d->first));
+        append(msg, &len, ")", 1);
+        memcpy(d->first, msg, len + 1);
+        return true;
+    }
+    return false;
+}
+
+/*
+ * Matches "make: *** ..." and "make[2]: *** ...",
+ * returns true if the line is one.
+ */
+static bool
+make_line(struct diag *d, struct diag_stream *s, const char *line)
+{
+    const char *p = line + 4;
+
+    if (*p == '[') {
+        while ((*p >= '0' && *p <= '9') || *p == '[') {
+            ++p;
+        }
+        if (*p++ != ']') {
+            return false;
+        }
+    }
+    if (!PREFIX(p, ": *** ")) {
+        return false;
+    }
+
+    /* "[target] Error 2" is about a subcommand */
+    p += 6;
+    if (*p == '[') {
+        set_first(d->fallback, NULL, 0, line);
+    } else {
+        error(d, s, NULL, 0, p, WANT_NONE);
+    }
+    return true;
+}
+
+/*
+ * Matches a whole line of test runner or build
+ * tool output, returns true if the line is one.
+ */
+static bool
+tool_line(struct diag *d, struct diag_stream *s, char *line, size_t len)
+{
+    char *p;
+
+    if (PREFIX(line, "make") && make_line(d, s, line)) {
+        return true;
+    }
+
+    /* ninja */
+    if (PREFIX(line, "FAILED: ")) {
+        set_first(d->fallback, NULL, 0, line);
+        return true;
+    }
+
+    /* pytest's short summary */
+    if (PREFIX(line, "FAILED ") || PREFIX(line, "ERROR ")) {
+        error(d, s, NULL, 0, line + (line[0] == 'F' ? 7 : 6), WANT_NONE);
+        return true;
+    }
+
+    /* go test, "--- FAIL: TestFoo (0.00s)" */
+    if (PREFIX(line, "--- FAIL: ")) {
+        if ((p = strchr(line + 10, ' ')) != NULL) {
+            *p = '\0';
+        }
+        error(d, s, NULL, 0, line + 10, WANT_INDENT);
+        return true;
+    }
+
+    /* cargo test, "test foo::bar ... FAILED" */
+    if (PREFIX(line, "test ") && len > 12 &&
+        strcmp(line + len - 11, " ... FAILED") == 0) {
+        line[len - 11] = '\0';
+        error(d, s, NULL, 0, line + 5, WANT_NONE);
+        return true;
+    }
+
+    /* CTest, "  3 - name (Failed)" after its header */
+    if (d->ctest) {
+        for (p = line; *p == ' ' || *p == '\t'; ++p);
+        if (*p >= '0' && *p <= '9' && (p = strstr(p, " - ")) != NULL) {
+            error(d, s, NULL, 0, p + 3, WANT_NONE);
+            return true;
+        }
+        d->ctest = false;
+    }
+    if (strcmp(line, "The following tests FAILED:") == 0) {
+        d->ctest = true;
+        return true;
+    }
+    return false;
+}
+
+/*
+ * Matches compiler and linker diagnostics,
+ * "loc: error: message", "loc: warning: message",
+ * "loc: undefined reference to ...", and rustc's
+ * "error[E0425]: message".
+ */
+static void
+diag_line(struct diag *d, struct diag_stream *s, char *line, size_t len)
+{
+    const char *q, *r;
+
+    if (s->want != WANT_NONE && add_location(d, s, line)) {
+        return;
+    }
+
+    /* Most lines are none of the above */
+    if (!d->ctest && strchr("mFE-tT", line[0]) == NULL &&
+        memchr(line, ':', len) == NULL) {
+        return;
+    }
+    if (tool_line(d, s, line, len)) {
+        return;
+    }
+
+    /* No location */
+    if (PREFIX(line, "error:") || PREFIX(line, "error[")) {
+        q = strchr(line, ':');
+        r = q[1] == ' ' ? q + 2 : q + 1;
+        if (PREFIX(r, "aborting due to") || PREFIX(r, "could not compile")) {
+            set_first(d->fallback, NULL, 0, line);
+        } else {
+            error(d, s, NULL, 0, r, WANT_ARROW);
+        }
+        return;
+    }
+    if (PREFIX(line, "warning:") || PREFIX(line, "warning[")) {
+        if (strstr(line, "generated") == NULL) {
+            ++d->warnings;
+        }
+        return;
+    }
+
+    for (q = line; (q = strchr(q, ':')) != NULL; ++q) {
+        if (q[1] != ' ') {
+            continue;
+        }
+
+        r = q + 2;
+        if (PREFIX(r, "warning: ")) {
+            ++d->warnings;
+            return;
+        }
+        if (PREFIX(r, "fatal error: ")) {
+            r += 13;
+        } else if (PREFIX(r, "error: ")) {
+            r += 7;
+        } else if (PREFIX(r, "*** ")) {
+            r += 4;
+        } else if (!PREFIX(r, "undefined reference to") &&
+                   !PREFIX(r, "multiple definition of")) {
+            continue;
+        }
+
+        /* The compiler driver saying the linker failed */
+        if (PREFIX(r, "ld returned") || PREFIX(r, "linker command failed")) {
+            set_first(d->fallback, NULL, 0, line);
+        } else {
+            error(d, s, line, q - line, r, WANT_NONE);
+        }
+        return;
+    }
+}
+
+/*
+ * Returns the number of bytes at `p' before
+ * the first control character.
+ */
+static size_t
+text_len(const char *p, size_t n)
+{
+    size_t i = 0;
+
+#ifdef __SSE2__
+    const __m128i sp = _mm_set1_epi8(' ');
+    int ctl;
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+
+        /* Bytes below ' ', as unsigned */
+        ctl = ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(v, sp), v)) & 0xffff;
+        if (ctl != 0) {
+            return i + __builtin_ctz(ctl);
+        }
+    }
+#endif  /* __SSE2__ */
+
+    for (; i < n && (unsigned char)p[i] >= ' '; ++i);
+    return i;
+}
+
+/*
+ * Parses `n' bytes of output from `stream',
+ * 0 for stdout or 1 for stderr.
+ */
+void
+diag_scan(struct diag *d, int stream, const char *p, size_t n)
+{
+    struct diag_stream *s = &d->streams[stream];
+    const char *end = p + n;
+    size_t run, room;
+    char c;
+
+    for (; p < end; ++p) {
+        /* Copy text up to the next control character at once */
+        if (s->esc == ESC_NONE && !s->cr &&
+            (run = text_len(p, end - p)) > 0) {
+            room = sizeof(s->line) - 1 - s->len;
+            memcpy(s->line + s->len, p, run < room ? run : room);
+            s->len += run < room ? run : room;
+            if ((p += run) == end) {
+                break;
+            }
+        }
+
+        c = *p;
+        if (s->esc != ESC_NONE) {
+            /* CSI sequences end at 0x40-0x7e, others after a byte */
+            if (s->esc == ESC_START && c == '[') {
+                s->esc = ESC_CSI;
+            } else if (s->esc == ESC_START || (c >= 0x40 && c <= 0x7e)) {
+                s->esc = ESC_NONE;
+            }
+            continue;
+        }
+
+        if (c == '\n') {
+            while (s->len > 0 && (s->line[s->len - 1] == ' ' ||
+                                  s->line[s->len - 1] == '\t')) {
+                --s->len;
+            }
+            s->line[s->len] = '\0';
+            diag_line(d, s, s->line, s->len);
+            s->len = 0;
+            s->cr = false;
+            continue;
+        }
+
+        /* A '\r' not ending the line redraws it */
+        if (s->cr) {
+            s->len = 0;
+            s->cr = false;
+        }
+        if (c == '\r') {
+            s->cr = true;
+        } else if (c == '\033') {
+            s->esc = ESC_START;
+        } else if (s->len < sizeof(s->line) - 1 &&
+                   ((unsigned char)c >= ' ' || c == '\t')) {
+            s->line[s->len++] = c;
+        }
+    }
+}
+
+/*
+ * Parses what is left of unterminated lines.
+ *
+ * Returns the first error, or the first failure
+ * a build tool reported if there was none, or
+ * NULL.
+ */
+const char *
+diag_end(struct diag *d)
+{
+    for (int i = 0; i < 2; ++i) {
+        if (d->streams[i].len > 0) {
+            diag_scan(d, i, "\n", 1);
+        }
+    }
+
+    if (d->first[0] != '\0') {
+        return d->first;
+    }
+    return d->fallback[0] != '\0' ? d->fallback : NULL;
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef DIAG_H
+#define DIAG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define DIAG_LINE_MAX   512
+#define DIAG_FIRST_MAX  256
+
+/*
+ * The line being read from one output
+ * stream.
+ */
+struct diag_stream {
+    char line[DIAG_LINE_MAX];
+    size_t len;
+    uint8_t esc;            /* Escape sequence state */
+    bool cr;                /* Last byte was '\r' */
+    uint8_t want;           /* What the next line may add */
+};
+
+/*
+ * Errors and warnings found in the output
+ * of a build or test run, see diag.c.
+ */
+struct diag {
+    unsigned errors;
+    unsigned warnings;
+    bool ctest;                     /* In CTest's list of failed tests */
+    char first[DIAG_FIRST_MAX];     /* First error, "file:line:col: message" */
+    char fallback[DIAG_FIRST_MAX];  /* First failure a build tool reported */
+    struct diag_stream streams[2];  /* stdout, stderr */
+};
+
+void diag_scan(struct diag *d, int stream, const char *p, size_t n);
+const char *diag_end(struct diag *d);
+
+#endif  /* !DIAG_H */
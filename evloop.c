@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include "evloop.h"
+
+#define EV_MAX_EVENTS   16
+
+int
+ev_init(struct evloop *ev)
+{
+    ev->done = false;
+    ev->epfd = epoll_create1(EPOLL_CLOEXEC);
+    return ev->epfd < 0 ? -1 : 0;
+}
+
+/*
+ * Starts watching `w->fd' for `events'.
+ *
+ * Returns 0 on success, otherwise -1.
+ */
+int
+ev_add(struct evloop *ev, struct ev_watch *w, uint32_t events)
+{
+    struct epoll_event e = { .events = events, .data.ptr = w };
+
+    return epoll_ctl(ev->epfd, EPOLL_CTL_ADD, w->fd, &e);
+}
+
+void
+ev_del(struct evloop *ev, struct ev_watch *w)
+{
+    epoll_ctl(ev->epfd, EPOLL_CTL_DEL, w->fd, NULL);
+}
+
+/*
+ * Dispatches events until a handler
+ * sets `ev->done'.
+ */
+void
+ev_run(struct evloop *ev)
+{
+    struct epoll_event events[EV_MAX_EVENTS];
+    struct ev_watch *w;
+    int n;
+
+    while (!ev->done) {
+        n = epoll_wait(ev->epfd, events, EV_MAX_EVENTS, -1);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            break;
+        }
+
+        for (int i = 0; i < n; ++i) {
+            w = events[i].data.ptr;
+            w->fn(w, events[i].events);
+        }
+    }
+}
+
+void
+ev_fini(struct evloop *ev)
+{
+    close(ev->epfd);
+}
+
+/*
+ * Creates a one-shot timer that can
+ * be watched by the event loop.
+ */
+int
+timer_create_fd(void)
+{
+    return timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+}
+
+/*
+ * Arms `fd' to fire in `ns' nanoseconds,
+ * disarms it if `ns' is 0.
+ */
+void
+timer_arm(int fd, long long ns)
+{
+    struct itimerspec its = {0};
+
+    its.it_value.tv_sec = ns / 1000000000LL;
+    its.it_value.tv_nsec = ns % 1000000000LL;
+    timerfd_settime(fd, 0, &its, NULL);
+}
@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include "heartbeat.h"
+#include "procstat.h"
+#include "notify.h"
+#include "util.h"
+#include "config.h"
+
+static long long
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * Shows a heartbeat with the elapsed time, CPU
+ * usage and RSS of the program, then schedules
+ * the next one at twice the interval.
+ */
+static void
+heartbeat_fire(struct ev_watch *w, uint32_t events)
+{
+    struct heartbeat *hb = w->arg;
+    struct notification n = {0};
+    struct proc_stat ps;
+    char body[256], elapsed[32], stalled[32];
+    long long now = now_ns();
+    unsigned long long cpu_ns, cpu_delta;
+    uint64_t exp;
+    double cpu_pct;
+    size_t off;
+
+    (void)events;
+    read(hb->timerfd, &exp, sizeof(exp));
+
+    if (proc_stat(hb->pid, &ps) < 0) {
+        return;
+    }
+
+    /* Make and scripts do their work in children */
+    cpu_ns = proc_tree_cpu(hb->pid, &ps);
+    cpu_delta = cpu_ns > hb->last_cpu_ns ? cpu_ns - hb->last_cpu_ns : 0;
+    cpu_pct = 100.0 * cpu_delta / (now - hb->last_ns);
+    if (cpu_delta == 0) {
+        hb->stalled_ns += now - hb->last_ns;
+    } else {
+        hb->stalled_ns = 0;
+    }
+
+    fmt_duration(elapsed, sizeof(elapsed), (now - hb->start_ns) / 1000000);
+    off = snprintf(body, sizeof(body),
+                   "'%s' running for %s\nCPU %.1f%%, RSS %llu MiB",
+                   hb->cmd, elapsed, cpu_pct, ps.rss >> 20);
+
+    if (hb->stalled_ns > 0 && off < sizeof(body)) {
+        fmt_duration(stalled, sizeof(stalled), hb->stalled_ns / 1000000);
+        snprintf(body + off, sizeof(body) - off,
+                 "\nNo CPU progress for %s (state %c)", stalled, ps.state);
+    }
+
+    n.summary = PROGRESS_SUMMARY;
+    n.body = body;
+    n.transient = true;
+    n.key = hb->key;
+    notify(&n);
+
+    hb->last_ns = now;
+    hb->last_cpu_ns = cpu_ns;
+
+    /* 1m, 2m, 4m, ... up to HEARTBEAT_MAX */
+    hb->interval_ns *= 2;
+    if (hb->interval_ns > HEARTBEAT_MAX * 1000000000LL) {
+        hb->interval_ns = HEARTBEAT_MAX * 1000000000LL;
+    }
+    timer_arm(hb->timerfd, hb->interval_ns);
+}
+
+/*
+ * Sets up heartbeats for `cmd'.
+ *
+ * Returns 0 on success, otherwise -1.
+ */
+int
+heartbeat_begin(struct heartbeat *hb, const char *cmd, uint64_t key)
+{
+    memset(hb, 0, sizeof(*hb));
+    hb->cmd = cmd;
+    hb->key = key;
+    hb->interval_ns = HEARTBEAT_INTERVAL * 1000000000LL;
+    hb->timerfd = timer_create_fd();
+    return hb->timerfd < 0 ? -1 : 0;
+}
+
+/*
+ * Starts the heartbeat timer for the
+ * program running as `pid'.
+ */
+void
+heartbeat_attach(struct heartbeat *hb, struct evloop *ev, pid_t pid)
+{
+    if (hb->timerfd < 0) {
+        return;
+    }
+
+    hb->pid = pid;
+    hb->start_ns = hb->last_ns = now_ns();
+    hb->w = (struct ev_watch){ .fd = hb->timerfd, .fn = heartbeat_fire, .arg = hb };
+    ev_add(ev, &hb->w, EPOLLIN);
+    timer_arm(hb->timerfd, hb->interval_ns);
+}
+
+void
+heartbeat_end(struct heartbeat *hb)
+{
+    if (hb->timerfd >= 0) {
+        close(hb->timerfd);
+        hb->timerfd = -1;
+    }
+}
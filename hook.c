@@ -0,0 +1,257 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Collector for the shell hooks, run by cmdnotifyd.
+ * Shells report when each interactive command starts
+ * and ends (see cmdnotify-hook.c), and commands that
+ * took at least HOOK_MIN_DURATION seconds are notified
+ * of, subject to the rules like any wrapped command.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "hook.h"
+#include "notify.h"
+#include "deliver.h"
+#include "rules.h"
+#include "util.h"
+#include "xdg.h"
+#include "config.h"
+
+#define HOOK_SESSIONS   64      /* Shells tracked at once */
+#define HOOK_ARGV_MAX   16
+
+/*
+ * The command running in a shell.
+ */
+struct hook_session {
+    pid_t pid;              /* Of the shell, 0 if free */
+    long long start_ns;
+    char cmd[HOOK_CMD_MAX];
+};
+
+static struct hook_session sessions[HOOK_SESSIONS];
+
+/*
+ * Returns the session of the shell `pid', or
+ * with `create', a free one (or the oldest).
+ */
+static struct hook_session *
+hook_session(pid_t pid, bool create)
+{
+    struct hook_session *s, *victim = &sessions[0];
+
+    for (s = sessions; s < &sessions[HOOK_SESSIONS]; ++s) {
+        if (s->pid == pid) {
+            return s;
+        }
+        if (victim->pid != 0 && (s->pid == 0 || s->start_ns < victim->start_ns)) {
+            victim = s;
+        }
+    }
+    return create ? victim : NULL;
+}
+
+/*
+ * Returns true if `name' is one of the
+ * commands in HOOK_IGNORE.
+ */
+static bool
+hook_ignored(const char *name)
+{
+    const char *p = HOOK_IGNORE;
+    const char *slash = strrchr(name, '/');
+    size_t len, n;
+
+    if (slash != NULL) {
+        name = slash + 1;
+    }
+    len = strlen(name);
+
+    while (*p != '\0') {
+        n = strcspn(p, " ");
+        if (n == len && strncmp(p, name, n) == 0) {
+            return true;
+        }
+        p += n + (p[n] == ' ');
+    }
+    return false;
+}
+
+/*
+ * Notifies of the command in `s' having
+ * ended as reported by `m', if it took
+ * long enough and no rule says otherwise.
+ */
+static void
+hook_end(struct hook_session *s, const struct hook_msg *m)
+{
+    char buf[HOOK_CMD_MAX], body[NOTIFY_BODY_BUDGET], dur[32];
+    char *argv[HOOK_ARGV_MAX + 1], *p;
+    long long ns = m->time_ns - s->start_ns;
+    struct run_info ri = {0};
+    struct rule_action act;
+    struct notification n = {0};
+    int argc = 0;
+
+    if (ns < HOOK_MIN_DURATION * 1000000000LL) {
+        return;
+    }
+
+    /* Good enough to match rules, skips "VAR=value" */
+    snprintf(buf, sizeof(buf), "%s", s->cmd);
+    for (p = strtok(buf, " \t"); p != NULL && argc < HOOK_ARGV_MAX;
+         p = strtok(NULL, " \t")) {
+        if (argc > 0 || strchr(p, '=') == NULL) {
+            argv[argc++] = p;
+        }
+    }
+    argv[argc] = NULL;
+    if (argc == 0 || hook_ignored(argv[0])) {
+        return;
+    }
+
+    ri.progname = argv[0];
+    ri.argv = argv;
+    ri.status = m->status;
+    ri.mono_start.tv_sec = s->start_ns / 1000000000LL;
+    ri.mono_start.tv_nsec = s->start_ns % 1000000000LL;
+    ri.mono_end.tv_sec = m->time_ns / 1000000000LL;
+    ri.mono_end.tv_nsec = m->time_ns % 1000000000LL;
+    rules_eval(&ri, &act);
+    if (act.suppress) {
+        return;
+    }
+
+    fmt_duration(dur, sizeof(dur), ns / 1000000);
+    snprintf(body, sizeof(body), "'%s' returned %d after %s", s->cmd,
+             m->status, dur);
+
+    n.summary = m->status == 0 ? SUCCESS_SUMMARY : FAILURE_SUMMARY;
+    n.body = body;
+    n.key = argv_key(argv);
+    n.exit_ns = m->time_ns;
+    n.urgency = act.urgency;
+    n.has_timeout = act.has_timeout;
+    n.timeout = act.timeout;
+    deliver_post(&n);
+}
+
+/*
+ * Creates the socket the shell hooks
+ * send to.
+ *
+ * Returns the socket, or -1 on failure.
+ */
+int
+hook_listen(void)
+{
+    struct sockaddr_un sun = { .sun_family = AF_UNIX };
+    int fd, on = 1;
+
+    if (xdg_path(XDG_RUNTIME, HOOK_SOCK, sun.sun_path, sizeof(sun.sun_path)) < 0) {
+        return -1;
+    }
+
+    fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    /* Only one cmdnotifyd gets this far, see daemon_listen() */
+    unlink(sun.sun_path);
+    if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0 ||
+        setsockopt(fd, SOL_SOCKET, SO_PASSCRED, &on, sizeof(on)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * Handles every event queued on the
+ * hook socket `fd'.
+ */
+void
+hook_recv(int fd)
+{
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(struct ucred))];
+    } ctl;
+    struct hook_msg m;
+    struct iovec iov = { .iov_base = &m, .iov_len = sizeof(m) };
+    struct msghdr mh = { .msg_iov = &iov, .msg_iovlen = 1 };
+    struct hook_session *s;
+    struct cmsghdr *c;
+    struct ucred *cred;
+    ssize_t r;
+
+    for (;;) {
+        mh.msg_control = ctl.buf;
+        mh.msg_controllen = sizeof(ctl.buf);
+        r = recvmsg(fd, &mh, 0);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r < 0) {
+            return;
+        }
+
+        /* Only from ourselves, and only what we understand */
+        c = CMSG_FIRSTHDR(&mh);
+        if (c == NULL || c->cmsg_type != SCM_CREDENTIALS) {
+            continue;
+        }
+        cred = (struct ucred *)CMSG_DATA(c);
+        if (cred->uid != getuid() || (size_t)r <= offsetof(struct hook_msg, cmd) ||
+            m.magic != HOOK_MAGIC || m.version != HOOK_VERSION || m.pid <= 0) {
+            continue;
+        }
+        ((char *)&m)[r - 1] = '\0';
+
+        if (m.event == HOOK_START) {
+            s = hook_session(m.pid, true);
+            s->pid = m.pid;
+            s->start_ns = m.time_ns;
+            snprintf(s->cmd, sizeof(s->cmd), "%s", m.cmd);
+        } else if (m.event == HOOK_END && (s = hook_session(m.pid, false)) != NULL) {
+            hook_end(s, &m);
+            s->pid = 0;
+        }
+    }
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef HOOK_H
+#define HOOK_H
+
+#include <stdint.h>
+
+#define HOOK_SOCK       "hook.sock"     /* In $XDG_RUNTIME_DIR/cmdnotify */
+#define HOOK_MAGIC      0x4b4f4f48U     /* "HOOK" */
+#define HOOK_VERSION    1
+#define HOOK_CMD_MAX    256
+
+/* Events */
+#define HOOK_START  1
+#define HOOK_END    2
+
+/*
+ * A shell hook event, one datagram each. The
+ * message ends after the command's NUL.
+ */
+struct hook_msg {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t event;
+    int32_t pid;            /* Of the shell */
+    int32_t status;         /* HOOK_END only */
+    int64_t time_ns;        /* CLOCK_MONOTONIC */
+    char cmd[HOOK_CMD_MAX]; /* HOOK_START only */
+};
+
+int hook_listen(void);
+void hook_recv(int fd);
+
+#endif  /* !HOOK_H */
@@ -0,0 +1,39 @@
+# cmdnotify shell hook for bash, source it from ~/.bashrc:
+#
+#   . /usr/share/cmdnotify/cmdnotify.bash
+#
+# cmdnotifyd then notifies of commands that took long. This
+# takes over the DEBUG trap, and only the first command of a
+# pipeline or list is shown.
+
+__cmdnotify_preexec() {
+    # Also after an empty command line, PROMPT_COMMAND is not one
+    case $BASH_COMMAND in
+    __cmdnotify_precmd*) unset __cmdnotify_ready; return ;;
+    esac
+    [ -n "$__cmdnotify_ready" ] && [ -z "$COMP_LINE" ] || return
+    unset __cmdnotify_ready
+    __cmdnotify_started=1
+    cmdnotify-hook start "$BASH_COMMAND"
+}
+
+__cmdnotify_precmd() {
+    local st=$?
+
+    if [ -n "$__cmdnotify_started" ]; then
+        unset __cmdnotify_started
+        cmdnotify-hook end "$st"
+    fi
+    return $st
+}
+
+# Last in PROMPT_COMMAND, so that only the next command line starts one
+__cmdnotify_prompt() {
+    local st=$?
+
+    __cmdnotify_ready=1
+    return $st
+}
+
+trap '__cmdnotify_preexec' DEBUG
+PROMPT_COMMAND="__cmdnotify_precmd${PROMPT_COMMAND:+; $PROMPT_COMMAND}; __cmdnotify_prompt"
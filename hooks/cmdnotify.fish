@@ -0,0 +1,18 @@
+# cmdnotify shell hook for fish, source it from
+# ~/.config/fish/config.fish:
+#
+#   source /usr/share/cmdnotify/cmdnotify.fish
+#
+# cmdnotifyd then notifies of commands that took long.
+
+function __cmdnotify_preexec --on-event fish_preexec
+    set -g __cmdnotify_started 1
+    cmdnotify-hook start $argv[1]
+end
+
+function __cmdnotify_postexec --on-event fish_postexec
+    set -l st $status
+    set -q __cmdnotify_started; or return
+    set -e __cmdnotify_started
+    cmdnotify-hook end $st
+end
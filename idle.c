@@ -0,0 +1,325 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Notices the program waiting for input: no output
+ * and no CPU progress for IDLE_TIMEOUT seconds, and
+ * a process in the terminal's foreground group
+ * asleep in a read() of a terminal.
+ *
+ * A timer checks a few times per IDLE_TIMEOUT,
+ * nothing is done per read of the output, so this
+ * costs nothing while the program is busy.
+ *
+ * Only done when the output is captured: otherwise
+ * an editor or REPL would look the same as a
+ * program stuck at a prompt.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include "idle.h"
+#include "procstat.h"
+#include "notify.h"
+#include "util.h"
+#include "config.h"
+
+#define IDLE_CHECKS 4       /* Per IDLE_TIMEOUT */
+
+static long long
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * Reads the small /proc file `name' of `pid'
+ * into `buf' without a trailing newline.
+ *
+ * Returns 0 on success, otherwise -1.
+ */
+static int
+proc_read(pid_t pid, const char *name, char *buf, size_t len)
+{
+    char path[64];
+    ssize_t n;
+    int fd;
+
+    snprintf(path, sizeof(path), "/proc/%d/%s", (int)pid, name);
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+        return -1;
+    }
+
+    n = read(fd, buf, len - 1);
+    close(fd);
+    if (n <= 0) {
+        return -1;
+    }
+
+    if (buf[n - 1] == '\n') {
+        --n;
+    }
+    buf[n] = '\0';
+    return 0;
+}
+
+static bool
+fd_is_tty(pid_t pid, long fd)
+{
+    char path[64], target[64];
+    ssize_t n;
+
+    snprintf(path, sizeof(path), "/proc/%d/fd/%ld", (int)pid, fd);
+    if ((n = readlink(path, target, sizeof(target) - 1)) < 0) {
+        return false;
+    }
+    target[n] = '\0';
+
+    return strncmp(target, "/dev/pts/", 9) == 0 ||
+           strncmp(target, "/dev/tty", 8) == 0 ||
+           strcmp(target, "/dev/console") == 0;
+}
+
+/*
+ * Returns true if `pid' is asleep reading
+ * a terminal, going by the system call it
+ * is in, or its wait channel if that isn't
+ * available to us.
+ */
+static bool
+reads_tty(pid_t pid)
+{
+    char buf[256];
+    long nr;
+    unsigned long arg0;
+
+    if (proc_read(pid, "syscall", buf, sizeof(buf)) < 0 ||
+        sscanf(buf, "%ld %lx", &nr, &arg0) != 2) {
+        return proc_read(pid, "wchan", buf, sizeof(buf)) == 0 &&
+               strstr(buf, "tty_read") != NULL;
+    }
+
+    if (nr == SYS_read || nr == SYS_readv) {
+        return fd_is_tty(pid, arg0);
+    }
+
+    /* Prompts built on poll() wait on their stdin */
+    switch (nr) {
+#ifdef SYS_poll
+    case SYS_poll:
+#endif  /* SYS_poll */
+#ifdef SYS_select
+    case SYS_select:
+#endif  /* SYS_select */
+    case SYS_ppoll:
+    case SYS_pselect6:
+        return fd_is_tty(pid, 0);
+    }
+    return false;
+}
+
+/*
+ * Looks for the process waiting for input, the
+ * program itself or one in the foreground group
+ * of its terminal.
+ *
+ * Returns its pid, or -1 if none is, or if
+ * any of them is running.
+ */
+static pid_t
+find_reader(pid_t pid, const struct proc_stat *ps)
+{
+    struct proc_stat other;
+    struct dirent *d;
+    pid_t reader = -1, p;
+    DIR *dir;
+
+    if (ps->state != 'S') {
+        return -1;
+    }
+    if (reads_tty(pid)) {
+        return pid;
+    }
+    if (ps->tpgid <= 0 || (dir = opendir("/proc")) == NULL) {
+        return -1;
+    }
+
+    while ((d = readdir(dir)) != NULL) {
+        if (!isdigit((unsigned char)d->d_name[0])) {
+            continue;
+        }
+
+        /* We share the group without -P, and are running right now */
+        p = atoi(d->d_name);
+        if (p == pid || p == getpid() || proc_stat(p, &other) < 0 ||
+            other.pgrp != ps->tpgid) {
+            continue;
+        }
+        if (other.state == 'R') {
+            reader = -1;
+            break;
+        }
+        if (reader < 0 && other.state == 'S' && reads_tty(p)) {
+            reader = p;
+        }
+    }
+
+    closedir(dir);
+    return reader;
+}
+
+static void
+idle_notify(struct idle *id, pid_t reader, long long idle_ns)
+{
+    struct notification n = {0};
+    char body[256], comm[32], dur[32];
+    size_t off;
+
+    off = snprintf(body, sizeof(body), "'%s' is waiting for input", id->cmd);
+    if (reader != id->pid && proc_read(reader, "comm", comm, sizeof(comm)) == 0 &&
+        off < sizeof(body)) {
+        off += snprintf(body + off, sizeof(body) - off, " in '%s'", comm);
+    }
+
+    if (off < sizeof(body)) {
+        fmt_duration(dur, sizeof(dur), idle_ns / 1000000);
+        snprintf(body + off, sizeof(body) - off, "\nNo output for %s", dur);
+    }
+
+    n.summary = IDLE_SUMMARY;
+    n.body = body;
+    n.transient = true;
+    n.key = id->key;
+    notify(&n);
+}
+
+static void
+idle_check(struct ev_watch *w, uint32_t events)
+{
+    struct idle *id = w->arg;
+    struct proc_stat ps;
+    long long now = now_ns();
+    uint64_t output = *id->output;
+    unsigned long long cpu_ns;
+    uint64_t exp;
+    pid_t reader;
+
+    (void)events;
+    read(id->timerfd, &exp, sizeof(exp));
+    timer_arm(id->timerfd, IDLE_TIMEOUT * 1000000000LL / IDLE_CHECKS);
+
+    if (proc_stat(id->pid, &ps) < 0) {
+        return;
+    }
+
+    /* Quiet builds still keep their children busy */
+    cpu_ns = proc_tree_cpu(id->pid, &ps);
+    if (output != id->last_output || cpu_ns != id->last_cpu_ns) {
+        id->last_output = output;
+        id->last_cpu_ns = cpu_ns;
+        id->active_ns = now;
+        id->notified = false;
+        return;
+    }
+
+    if (id->notified || now - id->active_ns < IDLE_TIMEOUT * 1000000000LL) {
+        return;
+    }
+
+    if ((reader = find_reader(id->pid, &ps)) > 0) {
+        idle_notify(id, reader, now - id->active_ns);
+        id->notified = true;
+    }
+}
+
+/*
+ * Sets up waiting for input detection
+ * for `cmd'.
+ *
+ * Returns 0 on success, otherwise -1.
+ */
+int
+idle_begin(struct idle *id, const char *cmd, uint64_t key)
+{
+    memset(id, 0, sizeof(*id));
+    id->cmd = cmd;
+    id->key = key;
+    id->timerfd = -1;
+
+    if (IDLE_TIMEOUT == 0) {
+        return -1;
+    }
+
+    id->timerfd = timer_create_fd();
+    return id->timerfd < 0 ? -1 : 0;
+}
+
+/*
+ * Starts checking on the program running
+ * as `pid'.
+ *
+ * @output: Counts the program's output if
+ *          captured, otherwise NULL and
+ *          nothing is checked.
+ */
+void
+idle_attach(struct idle *id, struct evloop *ev, pid_t pid,
+            const uint64_t *output)
+{
+    if (id->timerfd < 0 || output == NULL) {
+        return;
+    }
+
+    id->pid = pid;
+    id->output = output;
+    id->active_ns = now_ns();
+    id->w = (struct ev_watch){ .fd = id->timerfd, .fn = idle_check, .arg = id };
+    ev_add(ev, &id->w, EPOLLIN);
+    timer_arm(id->timerfd, IDLE_TIMEOUT * 1000000000LL / IDLE_CHECKS);
+}
+
+void
+idle_end(struct idle *id)
+{
+    if (id->timerfd >= 0) {
+        close(id->timerfd);
+        id->timerfd = -1;
+    }
+}
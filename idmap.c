@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stddef.h>
+#include <sys/file.h>
+#include "idmap.h"
+#include "xdg.h"
+
+#define IDMAP_FILE      "ids"
+#define IDMAP_ENTRIES   128
+
+/*
+ * Maps a command key to the ID the notification
+ * server gave the last notification for it.
+ */
+struct idmap_entry {
+    uint64_t key;       /* 0 if free */
+    uint32_t id;
+    uint32_t stamp;     /* For LRU eviction */
+};
+
+struct idmap {
+    uint32_t clock;
+    uint32_t reserved;
+    struct idmap_entry ent[IDMAP_ENTRIES];
+};
+
+/*
+ * Returns the ID of the last notification
+ * for `key', or 0 if there is none.
+ */
+uint32_t
+idmap_get(uint64_t key)
+{
+    struct idmap *map;
+    uint32_t id = 0;
+    int fd;
+
+    if (key == 0) {
+        return 0;
+    }
+
+    if ((map = xdg_map(XDG_RUNTIME, IDMAP_FILE, sizeof(*map), &fd)) == NULL) {
+        return 0;
+    }
+
+    flock(fd, LOCK_SH);
+    for (size_t i = 0; i < IDMAP_ENTRIES; ++i) {
+        if (map->ent[i].key == key) {
+            id = map->ent[i].id;
+            break;
+        }
+    }
+    flock(fd, LOCK_UN);
+
+    xdg_unmap(map, sizeof(*map), fd);
+    return id;
+}
+
+/*
+ * Records `id' as the last notification
+ * for `key', evicting the least recently
+ * used entry if needed.
+ */
+void
+idmap_put(uint64_t key, uint32_t id)
+{
+    struct idmap *map;
+    struct idmap_entry *e, *victim = NULL;
+    int fd;
+
+    if (key == 0 || id == 0) {
+        return;
+    }
+
+    if ((map = xdg_map(XDG_RUNTIME, IDMAP_FILE, sizeof(*map), &fd)) == NULL) {
+        return;
+    }
+
+    flock(fd, LOCK_EX);
+    for (size_t i = 0; i < IDMAP_ENTRIES; ++i) {
+        e = &map->ent[i];
+        if (e->key == key) {
+            victim = e;
+            break;
+        }
+        if (victim == NULL || e->stamp < victim->stamp) {
+            victim = e;
+        }
+    }
+
+    victim->key = key;
+    victim->id = id;
+    victim->stamp = ++map->clock;
+    flock(fd, LOCK_UN);
+
+    xdg_unmap(map, sizeof(*map), fd);
+}
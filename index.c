@@ -0,0 +1,847 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Trigram index of archived output (-A), for
+ * "cmdnotify --search". Each archive in the runs
+ * directory (see archive.c) gets segments next to
+ * it, in "<id>.tri", listing for every trigram
+ * (three consecutive bytes) the archive blocks
+ * it occurs in:
+ *
+ *      struct seg_hdr
+ *      argv            cmdlen bytes, padded to 8
+ *      u64             archive offset of each block,
+ *                      BLOCK_SCAN if not indexed
+ *      struct seg_term nterms + 1 by trigram, the
+ *                      last only ends the postings
+ *      postings        per trigram, its blocks as
+ *                      LEB128 varint deltas, padded
+ *                      to 8
+ *
+ * The index is built on a thread of its own, which
+ * reads back and decompresses what the archive
+ * wrote out, so indexing never holds up archiving.
+ * A segment is appended every INDEX_SEGMENT blocks,
+ * keeping only that many blocks' postings in memory.
+ * One without blocks is written first, so a run
+ * killed early is still found. Blocks past the
+ * last segment's `end' (we were killed before it
+ * got to them) are searched without the index.
+ * Runs are pruned as a whole, see runs.c.
+ *
+ * Searching maps every segment, intersects the
+ * postings of the query's trigrams and then only
+ * decompresses the blocks that may match to check
+ * them. Blocks that did not compress (e.g., binary
+ * output) are not worth indexing and are always
+ * checked. Matches spanning two blocks are missed.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "index.h"
+#include "lz4.h"
+#include "runs.h"
+#include "util.h"
+#include "config.h"
+
+#define INDEX_MAGIC     "TRI2"
+#define TABLE_INIT      4096
+#define VARINT_MAX      5
+#define BLOCK_STORED    0x80000000U
+#define BLOCK_SCAN      (1ULL << 63)
+#define LINE_MAX_SHOWN  256
+
+#define TRI_FREE        UINT32_MAX
+
+struct tri_term {
+    uint32_t tri;       /* TRI_FREE if unused */
+    uint32_t last;      /* Last block it was seen in + 1 */
+    uint32_t len;
+    uint32_t cap;
+    uint8_t *post;
+};
+
+struct seg_hdr {
+    char magic[4];
+    uint32_t nblocks;
+    uint32_t nterms;
+    uint32_t cmdlen;
+    int64_t start;      /* CLOCK_REALTIME in ns */
+    uint64_t end;       /* Archive offset after the last block */
+};
+
+struct seg_term {
+    uint32_t tri;
+    uint32_t off;       /* Into the postings */
+};
+
+/*
+ * A segment in a mapped segments file.
+ */
+struct segment {
+    const struct seg_hdr *hdr;
+    const uint64_t *blocks;
+    const struct seg_term *terms;
+    const uint8_t *post;
+    size_t post_len;
+};
+
+/*
+ * A run's mapped segments file.
+ */
+struct run_segs {
+    char id[32];
+    char *map;
+    size_t size;
+    const struct seg_hdr *hdr;  /* The first segment's */
+    const char *cmd;
+    struct segment *segs;
+    size_t nsegs;
+    uint64_t end;               /* Of the last segment */
+};
+
+static inline size_t
+tri_hash(uint32_t tri)
+{
+    /* Trigrams are 24 bits, keep the well mixed top ones */
+    return (tri * 2654435761U) >> 8;
+}
+
+static int
+table_grow(struct tri_index *ix)
+{
+    size_t size = ix->terms == NULL ? TABLE_INIT : (ix->mask + 1) * 2;
+    struct tri_term *terms, *t;
+    size_t i;
+
+    if ((terms = calloc(size, sizeof(*terms))) == NULL) {
+        return -1;
+    }
+    for (i = 0; i < size; ++i) {
+        terms[i].tri = TRI_FREE;
+    }
+
+    for (size_t j = 0; ix->terms != NULL && j <= ix->mask; ++j) {
+        t = &ix->terms[j];
+        if (t->tri == TRI_FREE) {
+            continue;
+        }
+        for (i = tri_hash(t->tri) & (size - 1); terms[i].tri != TRI_FREE;
+             i = (i + 1) & (size - 1));
+        terms[i] = *t;
+    }
+
+    free(ix->terms);
+    ix->terms = terms;
+    ix->mask = size - 1;
+    return 0;
+}
+
+/*
+ * Returns the entry of `tri', a free one if it
+ * is new, or NULL if we ran out of memory.
+ */
+static struct tri_term *
+term_get(struct tri_index *ix, uint32_t tri)
+{
+    struct tri_term *t;
+    size_t i;
+
+    if (ix->terms == NULL && table_grow(ix) < 0) {
+        return NULL;
+    }
+
+    for (i = tri_hash(tri) & ix->mask;; i = (i + 1) & ix->mask) {
+        t = &ix->terms[i];
+        if (t->tri == tri) {
+            return t;
+        }
+        if (t->tri != TRI_FREE) {
+            continue;
+        }
+
+        /* Keep the table at most half full */
+        if ((ix->nterms + 1) * 2 > ix->mask + 1) {
+            return table_grow(ix) < 0 ? NULL : term_get(ix, tri);
+        }
+        t->tri = tri;
+        ++ix->nterms;
+        return t;
+    }
+}
+
+/*
+ * Adds `block' to the postings of `t'.
+ */
+static int
+post_add(struct tri_term *t, uint32_t block)
+{
+    uint32_t d = block + 1 - t->last;
+    uint8_t *post;
+
+    if (t->cap - t->len < VARINT_MAX) {
+        t->cap = t->cap == 0 ? 8 : t->cap * 2;
+        if ((post = realloc(t->post, t->cap)) == NULL) {
+            return -1;
+        }
+        t->post = post;
+    }
+
+    do {
+        t->post[t->len++] = (d & 0x7f) | (d > 0x7f ? 0x80 : 0);
+        d >>= 7;
+    } while (d != 0);
+    t->last = block + 1;
+    return 0;
+}
+
+/*
+ * Indexes the `n' bytes at `p', stored in the
+ * archive as the block at offset `off'. Unless
+ * `text', only the block is recorded.
+ */
+static void
+index_add(struct tri_index *ix, uint64_t off, const char *p, size_t n,
+          bool text)
+{
+    const uint8_t *b = (const uint8_t *)p;
+    uint32_t block = ix->nblocks, tri;
+    struct tri_term *t;
+    uint64_t *blocks;
+
+    if (ix->failed) {
+        return;
+    }
+
+    if (ix->nblocks == ix->blocks_cap) {
+        ix->blocks_cap = ix->blocks_cap == 0 ? 64 : ix->blocks_cap * 2;
+        blocks = realloc(ix->blocks, ix->blocks_cap * sizeof(*blocks));
+        if (blocks == NULL) {
+            ix->failed = true;
+            return;
+        }
+        ix->blocks = blocks;
+    }
+    ix->blocks[ix->nblocks++] = text ? off : off | BLOCK_SCAN;
+
+    if (!text || n < 3) {
+        return;
+    }
+
+    tri = b[0] << 8 | b[1];
+    for (size_t i = 2; i < n; ++i) {
+        tri = (tri << 8 | b[i]) & 0xffffff;
+        if ((t = term_get(ix, tri)) == NULL) {
+            ix->failed = true;
+            return;
+        }
+        if (t->last == block + 1) {
+            continue;
+        }
+        if (post_add(t, block) < 0) {
+            ix->failed = true;
+            return;
+        }
+    }
+}
+
+static int
+term_cmp(const void *a, const void *b)
+{
+    const struct tri_term *ta = a, *tb = b;
+
+    return ta->tri < tb->tri ? -1 : ta->tri > tb->tri;
+}
+
+/*
+ * Appends a segment for the blocks indexed since
+ * the last one and starts over.
+ */
+static void
+seg_write(struct tri_index *ix)
+{
+    struct seg_hdr hdr = { .magic = INDEX_MAGIC };
+    struct seg_term st = {0};
+    static const char pad[8];
+    size_t n = 0;
+
+    /* Pack the entries in use, by trigram */
+    for (size_t i = 0; ix->terms != NULL && i <= ix->mask; ++i) {
+        if (ix->terms[i].tri != TRI_FREE) {
+            ix->terms[n++] = ix->terms[i];
+        }
+    }
+    if (n > 0) {
+        qsort(ix->terms, n, sizeof(*ix->terms), term_cmp);
+    }
+
+    hdr.nblocks = ix->nblocks;
+    hdr.nterms = n;
+    hdr.cmdlen = ix->cmdlen;
+    hdr.start = ix->start;
+    hdr.end = ix->off;
+    fwrite(&hdr, sizeof(hdr), 1, ix->seg);
+    fwrite(ix->cmd, 1, ix->cmdlen, ix->seg);
+    fwrite(pad, 1, -ix->cmdlen & 7, ix->seg);
+    if (ix->nblocks > 0) {
+        fwrite(ix->blocks, sizeof(*ix->blocks), ix->nblocks, ix->seg);
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        st.tri = ix->terms[i].tri;
+        fwrite(&st, sizeof(st), 1, ix->seg);
+        st.off += ix->terms[i].len;
+    }
+    st.tri = UINT32_MAX;
+    fwrite(&st, sizeof(st), 1, ix->seg);
+
+    for (size_t i = 0; i < n; ++i) {
+        fwrite(ix->terms[i].post, 1, ix->terms[i].len, ix->seg);
+        free(ix->terms[i].post);
+    }
+    fwrite(pad, 1, -st.off & 7, ix->seg);
+    fflush(ix->seg);
+
+    free(ix->terms);
+    ix->terms = NULL;
+    ix->nterms = 0;
+    ix->mask = 0;
+    ix->nblocks = 0;
+}
+
+/*
+ * Reads the archive block at `off' into `buf',
+ * its header into `hdrp'.
+ *
+ * Returns its size or -1.
+ */
+static ssize_t
+read_block(int fd, uint64_t off, char *buf, char *tmp, uint32_t *hdrp)
+{
+    uint8_t h[4];
+    uint32_t size;
+
+    /* Nothing to read is as good as the end */
+    *hdrp = 0;
+    if (pread(fd, h, sizeof(h), off) != sizeof(h)) {
+        return -1;
+    }
+    size = h[0] | h[1] << 8 | h[2] << 16 | (uint32_t)h[3] << 24;
+    *hdrp = size;
+    if (size == 0 || (size & ~BLOCK_STORED) > LZ4_BLOCK_MAX) {
+        return -1;
+    }
+
+    if (size & BLOCK_STORED) {
+        size &= ~BLOCK_STORED;
+        return pread(fd, buf, size, off + 4) == (ssize_t)size ? (ssize_t)size : -1;
+    }
+    if (pread(fd, tmp, size, off + 4) != (ssize_t)size) {
+        return -1;
+    }
+    return lz4_decompress(tmp, size, buf, LZ4_BLOCK_MAX);
+}
+
+/*
+ * The indexer thread. It stops at the end of the
+ * archive, or once asked to and there is no more
+ * of it.
+ */
+static void *
+index_main(void *arg)
+{
+    struct tri_index *ix = arg;
+    char *buf = malloc(LZ4_BLOCK_MAX), *tmp = malloc(LZ4_BLOCK_MAX);
+    uint64_t written;
+    uint32_t hdr;
+    ssize_t n;
+
+    while (buf != NULL && tmp != NULL && !ix->failed) {
+        written = atomic_load(&ix->written);
+
+        /* A whole block, with its checksum, is out */
+        if (written >= ix->off + 4 &&
+            (n = read_block(ix->fd, ix->off, buf, tmp, &hdr)) >= 0 &&
+            written >= ix->off + 4 + (hdr & ~BLOCK_STORED) + 4) {
+            index_add(ix, ix->off, buf, n, !(hdr & BLOCK_STORED));
+            ix->off += 4 + (hdr & ~BLOCK_STORED) + 4;
+            if (ix->nblocks == INDEX_SEGMENT) {
+                seg_write(ix);
+            }
+            continue;
+        }
+        if (atomic_load(&ix->done) || (written >= ix->off + 4 && hdr == 0)) {
+            break;
+        }
+
+        /* Go to sleep, unless more was written meanwhile */
+        atomic_store(&ix->sleeping, 1);
+        if (atomic_load(&ix->written) == written && !atomic_load(&ix->done)) {
+            syscall(SYS_futex, &ix->sleeping, FUTEX_WAIT_PRIVATE, 1, NULL, NULL, 0);
+        }
+        atomic_store(&ix->sleeping, 0);
+    }
+
+    if (ix->nblocks > 0 && !ix->failed) {
+        seg_write(ix);
+    }
+    free(buf);
+    free(tmp);
+    return NULL;
+}
+
+/*
+ * Starts indexing the archive of the run `id',
+ * running `argv', as it is written out. Its
+ * first block is at `off'.
+ *
+ * Returns 0 on success, otherwise -1 and
+ * `ix' is left unused.
+ */
+int
+index_begin(struct tri_index *ix, const char *id, char **argv, uint64_t off)
+{
+    char path[256];
+    sigset_t all, old;
+    struct timespec ts;
+    size_t len = 0;
+    int fd, error;
+
+    *ix = (struct tri_index){ .fd = -1, .off = off };
+    if (runs_path(id, ".lz4", path, sizeof(path)) < 0 ||
+        (ix->fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+        return -1;
+    }
+    if (runs_path(id, ".tri", path, sizeof(path)) < 0 ||
+        (fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) < 0) {
+        goto fail;
+    }
+    if ((ix->seg = fdopen(fd, "w")) == NULL) {
+        close(fd);
+        goto fail_unlink;
+    }
+
+    for (char **ap = argv; *ap != NULL; ++ap) {
+        len += snprintf(ix->cmd + len, sizeof(ix->cmd) - len, "%s%s",
+                        ap != argv ? " " : "", *ap);
+        if (len >= sizeof(ix->cmd)) {
+            len = sizeof(ix->cmd) - 1;
+            break;
+        }
+    }
+    ix->cmdlen = len;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ix->start = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+
+    /* Found from the start, even with nothing indexed yet */
+    seg_write(ix);
+
+    /* Signals are for the main thread, e.g., SIGWINCH with -P */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    error = pthread_create(&ix->thread, NULL, index_main, ix);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (error == 0) {
+        return 0;
+    }
+
+    fclose(ix->seg);
+fail_unlink:
+    unlink(path);
+fail:
+    close(ix->fd);
+    ix->fd = -1;
+    return -1;
+}
+
+/*
+ * Tells the indexer the archive is written
+ * out up to `end'.
+ */
+void
+index_written(struct tri_index *ix, uint64_t end)
+{
+    if (ix->fd < 0) {
+        return;
+    }
+
+    atomic_store(&ix->written, end);
+    if (atomic_exchange(&ix->sleeping, 0) != 0) {
+        syscall(SYS_futex, &ix->sleeping, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+}
+
+/*
+ * Waits for the indexer to get to the end of
+ * what was written out, the archive is done.
+ */
+void
+index_end(struct tri_index *ix)
+{
+    if (ix->fd < 0) {
+        return;
+    }
+
+    atomic_store(&ix->done, 1);
+    atomic_store(&ix->sleeping, 0);
+    syscall(SYS_futex, &ix->sleeping, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    pthread_join(ix->thread, NULL);
+
+    for (size_t i = 0; ix->terms != NULL && i <= ix->mask; ++i) {
+        free(ix->terms[i].post);
+    }
+    free(ix->terms);
+    free(ix->blocks);
+    fclose(ix->seg);
+    close(ix->fd);
+    ix->fd = -1;
+}
+
+/*
+ * Maps the segments file `name' in the runs
+ * directory `dfd', checking that everything in
+ * it is in bounds. A segment cut short, e.g., as
+ * we were killed, ends it.
+ *
+ * Returns 0 on success, otherwise -1.
+ */
+static int
+run_map(struct run_segs *r, int dfd, const char *name)
+{
+    const size_t idlen = strlen(name) - 4;
+    const struct seg_hdr *hdr;
+    struct segment *s, *segs;
+    size_t off = 0, cap = 0;
+    struct stat sb;
+    int fd;
+
+    if (idlen >= sizeof(r->id) ||
+        (fd = openat(dfd, name, O_RDONLY | O_CLOEXEC)) < 0) {
+        return -1;
+    }
+    if (fstat(fd, &sb) < 0 || (size_t)sb.st_size < sizeof(*hdr)) {
+        close(fd);
+        return -1;
+    }
+
+    r->size = sb.st_size;
+    r->map = mmap(NULL, r->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (r->map == MAP_FAILED) {
+        return -1;
+    }
+
+    memcpy(r->id, name, idlen);
+    r->id[idlen] = '\0';
+    r->hdr = (const struct seg_hdr *)r->map;
+    r->cmd = r->map + sizeof(*r->hdr);
+    r->segs = NULL;
+    r->nsegs = 0;
+
+    while (r->size - off >= sizeof(*hdr)) {
+        hdr = (const struct seg_hdr *)(r->map + off);
+        if (memcmp(hdr->magic, INDEX_MAGIC, 4) != 0 ||
+            hdr->cmdlen != r->hdr->cmdlen) {
+            break;
+        }
+        if (r->nsegs == cap) {
+            cap = cap == 0 ? 8 : cap * 2;
+            if ((segs = realloc(r->segs, cap * sizeof(*segs))) == NULL) {
+                break;
+            }
+            r->segs = segs;
+        }
+
+        s = &r->segs[r->nsegs];
+        s->hdr = hdr;
+        off += sizeof(*hdr) + ((hdr->cmdlen + 7ULL) & ~7ULL);
+        s->blocks = (const uint64_t *)(r->map + off);
+        off += hdr->nblocks * 8ULL;
+        s->terms = (const struct seg_term *)(r->map + off);
+        off += (hdr->nterms + 1ULL) * sizeof(*s->terms);
+        if (off > r->size || s->terms[hdr->nterms].off > r->size - off) {
+            break;
+        }
+        s->post = (const uint8_t *)r->map + off;
+        s->post_len = s->terms[hdr->nterms].off;
+        off += (s->post_len + 7ULL) & ~7ULL;
+
+        r->end = hdr->end;
+        ++r->nsegs;
+    }
+
+    if (r->nsegs == 0) {
+        free(r->segs);
+        munmap(r->map, r->size);
+        return -1;
+    }
+    return 0;
+}
+
+static int
+run_cmp(const void *a, const void *b)
+{
+    const struct run_segs *ra = a, *rb = b;
+
+    /* Newest first */
+    return ra->hdr->start > rb->hdr->start ? -1 : ra->hdr->start < rb->hdr->start;
+}
+
+/*
+ * Marks the indexed blocks of `s' that contain
+ * all `nq' trigrams in `q', by setting their
+ * `hits' to `nq'.
+ *
+ * Returns the number of such blocks.
+ */
+static size_t
+seg_match(const struct segment *s, const uint32_t *q, size_t nq, uint32_t *hits)
+{
+    const struct seg_term *t;
+    size_t lo, hi, mid, found = 0;
+    const uint8_t *p, *end;
+    uint32_t block, d;
+    int shift;
+
+    for (size_t k = 0; k < nq; ++k) {
+        lo = 0;
+        hi = s->hdr->nterms;
+        while (lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            if (s->terms[mid].tri < q[k]) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        t = &s->terms[lo];
+        if (lo == s->hdr->nterms || t->tri != q[k] || t[1].off < t->off ||
+            t[1].off > s->post_len) {
+            return 0;
+        }
+
+        /* A block stays a candidate if every trigram so far hit it */
+        block = 0;
+        found = 0;
+        p = s->post + t->off;
+        end = s->post + t[1].off;
+        while (p < end) {
+            d = 0;
+            shift = 0;
+            do {
+                d |= (uint32_t)(*p & 0x7f) << shift;
+                shift += 7;
+            } while ((*p++ & 0x80) && p < end && shift < 35);
+
+            block += d;
+            if (block == 0 || block > s->hdr->nblocks) {
+                return 0;
+            }
+            if (hits[block - 1] == k) {
+                hits[block - 1] = k + 1;
+                ++found;
+            }
+        }
+        if (found == 0) {
+            return 0;
+        }
+    }
+    return found;
+}
+
+/*
+ * Prints the lines of `data' that contain `text',
+ * after a line about the run if none came yet.
+ *
+ * Returns the number of lines printed.
+ */
+static size_t
+print_lines(const struct run_segs *r, const char *text, const char *data,
+            size_t n, size_t shown)
+{
+    const char *p = data, *end = data + n, *m, *start, *stop;
+    char line[LINE_MAX_SHOWN], when[32];
+    size_t tlen = strlen(text), count = 0;
+    time_t sec;
+
+    while ((m = memmem(p, end - p, text, tlen)) != NULL) {
+        if (shown + count == 0) {
+            sec = r->hdr->start / 1000000000LL;
+            strftime(when, sizeof(when), "%Y-%m-%d %H:%M", localtime(&sec));
+            printf("%s  %s  %.*s\n", r->id, when, (int)r->hdr->cmdlen, r->cmd);
+        }
+
+        start = memrchr(data, '\n', m - data);
+        start = start != NULL ? start + 1 : data;
+        if ((stop = memchr(m, '\n', end - m)) == NULL) {
+            stop = end;
+        }
+        term_clean(line, sizeof(line), start, stop);
+        printf("    %s\n", line);
+
+        ++count;
+        p = stop < end ? stop + 1 : end;
+    }
+    return count;
+}
+
+/*
+ * Prints the lines containing `text' in the run
+ * `r', reading its archive from `fd' only where
+ * the index says it may be.
+ *
+ * Returns the number of lines printed.
+ */
+static size_t
+run_search(const struct run_segs *r, int fd, const char *text,
+           const uint32_t *q, size_t nq)
+{
+    static char buf[LZ4_BLOCK_MAX], tmp[LZ4_BLOCK_MAX];
+    size_t shown = 0;
+    uint32_t *hits, hdr;
+    uint64_t off;
+    ssize_t n;
+
+    for (size_t i = 0; i < r->nsegs; ++i) {
+        const struct segment *s = &r->segs[i];
+
+        if ((hits = calloc(s->hdr->nblocks + 1, sizeof(*hits))) == NULL) {
+            continue;
+        }
+
+        /* Too short for the index, every block is a candidate */
+        if (nq > 0) {
+            seg_match(s, q, nq, hits);
+        }
+
+        for (uint32_t b = 0; b < s->hdr->nblocks; ++b) {
+            if (hits[b] != nq && !(s->blocks[b] & BLOCK_SCAN)) {
+                continue;
+            }
+            n = read_block(fd, s->blocks[b] & ~BLOCK_SCAN, buf, tmp, &hdr);
+            if (n > 0) {
+                shown += print_lines(r, text, buf, n, shown);
+            }
+        }
+        free(hits);
+    }
+
+    /* What the indexer did not get to */
+    for (off = r->end; (n = read_block(fd, off, buf, tmp, &hdr)) >= 0;
+         off += 4 + (hdr & ~BLOCK_STORED) + 4) {
+        shown += print_lines(r, text, buf, n, shown);
+    }
+    return shown;
+}
+
+/*
+ * Searches the output of runs, newest first.
+ *
+ * Returns 0 if `text' was found, 1 if not
+ * and -1 on errors.
+ */
+int
+index_search(const char *text)
+{
+    struct run_segs *runs = NULL, *tmpruns;
+    size_t nruns = 0, cap = 0, len = strlen(text), nq = 0, total = 0;
+    struct dirent *d;
+    char name[64];
+    uint32_t *q;
+    DIR *dp;
+    int dfd, fd;
+
+    if (len == 0 || (dp = runs_opendir()) == NULL) {
+        return len == 0 ? -1 : 1;
+    }
+    dfd = dirfd(dp);
+
+    while ((d = readdir(dp)) != NULL) {
+        len = strlen(d->d_name);
+        if (len <= 4 || strcmp(d->d_name + len - 4, ".tri") != 0) {
+            continue;
+        }
+        if (nruns == cap) {
+            cap = cap == 0 ? 64 : cap * 2;
+            if ((tmpruns = realloc(runs, cap * sizeof(*runs))) == NULL) {
+                break;
+            }
+            runs = tmpruns;
+        }
+        if (run_map(&runs[nruns], dfd, d->d_name) == 0) {
+            ++nruns;
+        }
+    }
+    qsort(runs, nruns, sizeof(*runs), run_cmp);
+
+    /* The query's trigrams, each once */
+    len = strlen(text);
+    if ((q = malloc((len + 1) * sizeof(*q))) == NULL) {
+        nruns = 0;
+    }
+    for (size_t i = 0; q != NULL && i + 2 < len; ++i) {
+        uint32_t tri = (uint8_t)text[i] << 16 | (uint8_t)text[i + 1] << 8 |
+                       (uint8_t)text[i + 2];
+        size_t j;
+
+        for (j = 0; j < nq && q[j] != tri; ++j);
+        if (j == nq) {
+            q[nq++] = tri;
+        }
+    }
+
+    for (size_t i = 0; i < nruns; ++i) {
+        snprintf(name, sizeof(name), "%s.lz4", runs[i].id);
+        if ((fd = openat(dfd, name, O_RDONLY | O_CLOEXEC)) >= 0) {
+            total += run_search(&runs[i], fd, text, q, nq);
+            close(fd);
+        }
+    }
+
+    for (size_t i = 0; i < nruns; ++i) {
+        free(runs[i].segs);
+        munmap(runs[i].map, runs[i].size);
+    }
+    free(runs);
+    free(q);
+    closedir(dp);
+    return total > 0 ? 0 : 1;
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INDEX_H
+#define INDEX_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+#include "cmdnotify.h"
+
+struct tri_term;
+
+/*
+ * Trigram index of one run's archive, built on a
+ * thread of its own from what the archive wrote
+ * out, a segment every INDEX_SEGMENT blocks. See
+ * index.c.
+ */
+struct tri_index {
+    struct tri_term *terms;     /* Hash table, of the segment */
+    size_t nterms;
+    size_t mask;                /* Table size - 1 */
+    uint64_t *blocks;           /* Archive offset of each block */
+    size_t nblocks;
+    size_t blocks_cap;
+    bool failed;                /* Out of memory, stop indexing */
+    uint64_t off;               /* Next block to index */
+    int fd;                     /* The archive */
+    FILE *seg;                  /* The segments */
+    char cmd[1024];
+    uint32_t cmdlen;
+    int64_t start;              /* CLOCK_REALTIME in ns */
+    _Atomic uint64_t written;   /* Archive bytes written out */
+    _Atomic uint32_t sleeping;  /* Futex, the indexer waits on it */
+    _Atomic uint32_t done;
+    pthread_t thread;
+};
+
+int index_begin(struct tri_index *ix, const char *id, char **argv, uint64_t off);
+void index_written(struct tri_index *ix, uint64_t end);
+void index_end(struct tri_index *ix);
+int index_search(const char *text);
+
+#endif  /* !INDEX_H */
@@ -0,0 +1,243 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * End-to-end delivery latency. For each completion we
+ * record the time from the command exiting to handing
+ * the notification to the backend (dispatch), and from
+ * there to the backend acknowledging it (ack).
+ *
+ * Latencies go into log-linear (HDR style) histograms
+ * kept in $XDG_STATE_HOME/cmdnotify/latency: 16 linear
+ * sub-buckets per power of two, so any recorded value
+ * is off by at most 1/16th. Once a histogram holds more
+ * than LATENCY_WINDOW samples every bucket is halved,
+ * so old samples fade out.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/file.h>
+#include "latency.h"
+#include "util.h"
+#include "xdg.h"
+#include "config.h"
+
+#define LATENCY_FILE    "latency"
+#define LATENCY_MAGIC   0x4c415431U     /* "LAT1" */
+#define SUB_BITS        4
+#define SUB_BUCKETS     (1 << SUB_BITS)
+#define MAGNITUDES      40              /* Up to 2^40 us */
+#define NBUCKETS        (SUB_BUCKETS * MAGNITUDES)
+
+enum {
+    H_EXIT_DISPATCH,
+    H_DISPATCH_ACK,
+    H_EXIT_ACK,
+    NHIST
+};
+
+static const char *names[NHIST] = {
+    [H_EXIT_DISPATCH] = "exit -> dispatch",
+    [H_DISPATCH_ACK] = "dispatch -> ack",
+    [H_EXIT_ACK] = "exit -> ack"
+};
+
+struct histogram {
+    uint64_t total;
+    uint32_t counts[NBUCKETS];
+};
+
+struct latency_file {
+    uint32_t magic;
+    uint32_t reserved;
+    struct histogram hist[NHIST];
+};
+
+/*
+ * Returns the bucket of the value `us'.
+ */
+static uint32_t
+bucket_of(uint64_t us)
+{
+    uint32_t msb, idx;
+
+    if (us < SUB_BUCKETS) {
+        return us;
+    }
+
+    msb = 63 - __builtin_clzll(us);
+    idx = (msb - SUB_BITS + 1) * SUB_BUCKETS +
+          ((us >> (msb - SUB_BITS)) & (SUB_BUCKETS - 1));
+    return idx < NBUCKETS ? idx : NBUCKETS - 1;
+}
+
+/*
+ * Returns the highest value (in us)
+ * that falls in bucket `idx'.
+ */
+static uint64_t
+bucket_max(uint32_t idx)
+{
+    uint32_t mag = idx / SUB_BUCKETS, sub = idx % SUB_BUCKETS;
+    uint32_t shift;
+
+    if (mag == 0) {
+        return idx;
+    }
+
+    shift = mag - 1;
+    return ((uint64_t)(SUB_BUCKETS + sub + 1) << shift) - 1;
+}
+
+static void
+hist_add(struct histogram *h, long long ns)
+{
+    if (ns < 0) {
+        ns = 0;
+    }
+
+    if (h->total >= LATENCY_WINDOW) {
+        h->total = 0;
+        for (uint32_t i = 0; i < NBUCKETS; ++i) {
+            h->counts[i] /= 2;
+            h->total += h->counts[i];
+        }
+    }
+
+    ++h->counts[bucket_of(ns / 1000)];
+    ++h->total;
+}
+
+/*
+ * Returns the `pct' percentile of `h' in us.
+ */
+static uint64_t
+hist_percentile(const struct histogram *h, double pct)
+{
+    uint64_t want = (uint64_t)(h->total * pct / 100.0 + 0.5), seen = 0;
+
+    if (want == 0) {
+        want = 1;
+    }
+
+    for (uint32_t i = 0; i < NBUCKETS; ++i) {
+        seen += h->counts[i];
+        if (seen >= want) {
+            return bucket_max(i);
+        }
+    }
+    return 0;
+}
+
+/*
+ * Records the latencies of one notification,
+ * all timestamps are CLOCK_MONOTONIC in ns.
+ */
+void
+latency_record(long long exit_ns, long long dispatch_ns, long long ack_ns)
+{
+    struct latency_file *lf;
+    int fd;
+
+    lf = xdg_map(XDG_STATE, LATENCY_FILE, sizeof(*lf), &fd);
+    if (lf == NULL) {
+        return;
+    }
+
+    flock(fd, LOCK_EX);
+    if (lf->magic != LATENCY_MAGIC) {
+        memset(lf, 0, sizeof(*lf));
+        lf->magic = LATENCY_MAGIC;
+    }
+
+    hist_add(&lf->hist[H_EXIT_DISPATCH], dispatch_ns - exit_ns);
+    hist_add(&lf->hist[H_DISPATCH_ACK], ack_ns - dispatch_ns);
+    hist_add(&lf->hist[H_EXIT_ACK], ack_ns - exit_ns);
+    flock(fd, LOCK_UN);
+
+    xdg_unmap(lf, sizeof(*lf), fd);
+}
+
+static void
+print_us(uint64_t us)
+{
+    char buf[32];
+
+    if (us < 1000) {
+        snprintf(buf, sizeof(buf), "%lluus", (unsigned long long)us);
+    } else if (us < 1000000) {
+        snprintf(buf, sizeof(buf), "%llu.%llums", (unsigned long long)us / 1000,
+                 (unsigned long long)(us % 1000) / 100);
+    } else {
+        fmt_duration(buf, sizeof(buf), us / 1000);
+    }
+    printf(" %9s", buf);
+}
+
+/*
+ * Prints p50, p99 and p999 of each
+ * histogram, for cmdnotify --stats.
+ *
+ * Returns 0 on success, otherwise -1.
+ */
+int
+latency_print(void)
+{
+    struct latency_file *lf;
+    struct histogram h;
+    int fd;
+
+    lf = xdg_map(XDG_STATE, LATENCY_FILE, sizeof(*lf), &fd);
+    if (lf == NULL) {
+        perror("cmdnotify: latency");
+        return -1;
+    }
+
+    printf("%-18s %9s %9s %9s %9s\n", "", "samples", "p50", "p99", "p999");
+    for (int i = 0; i < NHIST; ++i) {
+        flock(fd, LOCK_SH);
+        h = lf->magic == LATENCY_MAGIC ? lf->hist[i] : (struct histogram){0};
+        flock(fd, LOCK_UN);
+
+        printf("%-18s %9llu", names[i], (unsigned long long)h.total);
+        if (h.total == 0) {
+            printf(" %9s %9s %9s\n", "-", "-", "-");
+            continue;
+        }
+        print_us(hist_percentile(&h, 50.0));
+        print_us(hist_percentile(&h, 99.0));
+        print_us(hist_percentile(&h, 99.9));
+        printf("\n");
+    }
+
+    xdg_unmap(lf, sizeof(*lf), fd);
+    return 0;
+}
@@ -0,0 +1,267 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Line timing (-L): output is timestamped as it
+ * arrives, every line in a read gets the time of
+ * that read. The timings go to a side file in the
+ * runs directory (see runs.c), "<id>.times":
+ *
+ *      "LTM1"  magic
+ *      u64     CLOCK_REALTIME start in ns
+ *      then per read, as LEB128 varints:
+ *          bytes, lines, us since the previous read
+ *
+ * ending with a record of 0 bytes and 0 lines at
+ * the program's exit. The LINES_TOP longest pauses
+ * are tracked along the way for the notification.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif  /* __SSE2__ */
+#include "lines.h"
+#include "runs.h"
+#include "util.h"
+
+#define LINES_MAGIC     "LTM1"
+#define VARINT_MAX      10
+
+static long long
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * Returns the number of newlines in `p'.
+ */
+static size_t
+count_newlines(const char *p, size_t n)
+{
+    size_t count = 0, i = 0;
+
+#ifdef __SSE2__
+    const __m128i nl = _mm_set1_epi8('\n');
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        count += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)));
+    }
+#endif  /* __SSE2__ */
+
+    for (; i < n; ++i) {
+        count += p[i] == '\n';
+    }
+    return count;
+}
+
+static void
+lines_flush(struct line_log *l)
+{
+    if (l->fd >= 0 && l->len > 0 && write(l->fd, l->buf, l->len) < 0) {
+        close(l->fd);
+        l->fd = -1;
+    }
+    l->len = 0;
+}
+
+static void
+lines_varint(struct line_log *l, uint64_t v)
+{
+    do {
+        l->buf[l->len++] = (v & 0x7f) | (v > 0x7f ? 0x80 : 0);
+        v >>= 7;
+    } while (v != 0);
+}
+
+static void
+lines_record(struct line_log *l, uint64_t bytes, uint64_t lines, long long dt_ns)
+{
+    if (l->fd < 0) {
+        return;
+    }
+    if (l->len + 3 * VARINT_MAX > sizeof(l->buf)) {
+        lines_flush(l);
+    }
+
+    lines_varint(l, bytes);
+    lines_varint(l, lines);
+    lines_varint(l, dt_ns / 1000);
+}
+
+/*
+ * Keeps the pause of `ns' after the last
+ * output if it is among the longest.
+ */
+static void
+lines_gap(struct line_log *l, long long ns)
+{
+    const struct line_stream *s = &l->streams[l->last];
+    const char *text = s->partial_len > 0 ? s->partial : s->line;
+    size_t i;
+
+    if (ns < LINES_GAP_MIN * 1000000LL || text[0] == '\0') {
+        return;
+    }
+    if (l->ntop == LINES_TOP && ns <= l->top[LINES_TOP - 1].ns) {
+        return;
+    }
+
+    /* Longest first */
+    i = l->ntop < LINES_TOP ? l->ntop++ : LINES_TOP - 1;
+    for (; i > 0 && l->top[i - 1].ns < ns; --i) {
+        l->top[i] = l->top[i - 1];
+    }
+    l->top[i].ns = ns;
+    memcpy(l->top[i].text, text, LINES_TEXT_MAX);
+}
+
+static void
+set_text(char *dst, size_t off, const char *src, size_t len)
+{
+    if (off + len > LINES_TEXT_MAX - 1) {
+        len = off < LINES_TEXT_MAX - 1 ? LINES_TEXT_MAX - 1 - off : 0;
+    }
+    memcpy(dst + off, src, len);
+    dst[off + len] = '\0';
+}
+
+/*
+ * Opens the side file for the run `id', or
+ * only tracks pauses if it can't be created.
+ *
+ * Returns 0 on success, otherwise -1.
+ */
+int
+lines_begin(struct line_log *l, const char *id)
+{
+    struct timespec ts;
+    char path[256];
+    uint64_t start;
+
+    memset(l, 0, sizeof(*l));
+    l->start_ns = l->last_ns = now_ns();
+    l->fd = -1;
+
+    if (runs_path(id, ".times", path, sizeof(path)) < 0) {
+        return -1;
+    }
+
+    l->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (l->fd < 0) {
+        return -1;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    start = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    memcpy(l->buf, LINES_MAGIC, 4);
+    memcpy(l->buf + 4, &start, sizeof(start));
+    l->len = 4 + sizeof(start);
+    return 0;
+}
+
+/*
+ * Times the `n' bytes of output at `p' that
+ * just arrived from `stream', 0 for stdout or
+ * 1 for stderr.
+ */
+void
+lines_add(struct line_log *l, int stream, const char *p, size_t n)
+{
+    struct line_stream *s = &l->streams[stream];
+    long long now = now_ns();
+    const char *last, *prev;
+    size_t nl;
+
+    lines_gap(l, now - l->last_ns);
+    lines_record(l, n, (nl = count_newlines(p, n)), now - l->last_ns);
+    l->last_ns = now;
+    l->last = stream;
+
+    if (nl == 0) {
+        set_text(s->partial, s->partial_len, p, n);
+        s->partial_len = strlen(s->partial);
+        return;
+    }
+
+    /* The last complete line, maybe started in an earlier read */
+    last = memrchr(p, '\n', n);
+    if (nl > 1 && (prev = memrchr(p, '\n', last - p)) != NULL) {
+        set_text(s->line, 0, prev + 1, last - prev - 1);
+    } else {
+        memcpy(s->line, s->partial, LINES_TEXT_MAX);
+        set_text(s->line, s->partial_len, p, last - p);
+    }
+
+    set_text(s->partial, 0, last + 1, p + n - last - 1);
+    s->partial_len = strlen(s->partial);
+}
+
+/*
+ * Records the exit of the program at `end_ns'
+ * and closes the side file. The longest pauses
+ * are listed in `buf', e.g.,
+ * "4m12s after 'Linking libfoo.so'".
+ *
+ * Returns the length of the list.
+ */
+size_t
+lines_end(struct line_log *l, long long end_ns, char *buf, size_t len)
+{
+    char dur[32], text[LINES_TEXT_MAX];
+    size_t off = 0;
+
+    lines_gap(l, end_ns - l->last_ns);
+    lines_record(l, 0, 0, end_ns - l->last_ns);
+    lines_flush(l);
+    if (l->fd >= 0) {
+        close(l->fd);
+        l->fd = -1;
+    }
+
+    buf[0] = '\0';
+    for (size_t i = 0; i < l->ntop && off < len; ++i) {
+        fmt_duration(dur, sizeof(dur), l->top[i].ns / 1000000);
+        term_clean(text, sizeof(text), l->top[i].text,
+                   l->top[i].text + strlen(l->top[i].text));
+        off += snprintf(buf + off, len - off, "%s%s after '%s'",
+                        i > 0 ? "\n" : "", dur, text);
+    }
+    return off < len ? off : len - 1;
+}
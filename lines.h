@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LINES_H
+#define LINES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "config.h"
+
+#define LINES_TEXT_MAX  80
+#define LINES_GAPS_MAX  512
+
+/*
+ * A pause in the output, and the text
+ * printed right before it.
+ */
+struct line_gap {
+    long long ns;
+    char text[LINES_TEXT_MAX];
+};
+
+/*
+ * The lines of one output stream.
+ */
+struct line_stream {
+    char line[LINES_TEXT_MAX];  /* Last complete line */
+    char partial[LINES_TEXT_MAX];
+    size_t partial_len;
+};
+
+/*
+ * Times lines of output as they arrive,
+ * see lines.c.
+ */
+struct line_log {
+    int fd;                     /* Side file, -1 if none */
+    char buf[4096];             /* Pending records */
+    size_t len;
+    long long start_ns;
+    long long last_ns;          /* Last output */
+    int last;                   /* Stream of the last output */
+    struct line_stream streams[2];  /* stdout, stderr */
+    struct line_gap top[LINES_TOP];
+    size_t ntop;
+};
+
+int lines_begin(struct line_log *l, const char *id);
+void lines_add(struct line_log *l, int stream, const char *p, size_t n);
+size_t lines_end(struct line_log *l, long long end_ns, char *buf, size_t len);
+
+#endif  /* !LINES_H */
@@ -0,0 +1,346 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * A small LZ4 block compressor (greedy, one hash
+ * probe per position), its decompressor, and the
+ * XXH32 checksum the
+ * LZ4 frame format uses. Blocks are at most
+ * LZ4_BLOCK_MAX bytes so positions fit in 16 bits.
+ */
+
+#include <string.h>
+#include "lz4.h"
+
+#define MINMATCH        4
+#define LASTLITERALS    5       /* Blocks end with at least this many literals */
+#define MFLIMIT         12      /* and no match starts after this many from the end */
+#define HASH_LOG        12
+#define SKIP_SHIFT      6       /* Speed up over incompressible data */
+
+#define PRIME1  2654435761U
+#define PRIME2  2246822519U
+#define PRIME3  3266489917U
+#define PRIME4  668265263U
+#define PRIME5  374761393U
+
+static inline uint32_t
+read32(const uint8_t *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t
+read64(const uint8_t *p)
+{
+    uint64_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t
+rotl32(uint32_t v, int r)
+{
+    return (v << r) | (v >> (32 - r));
+}
+
+static inline uint32_t
+hash4(const uint8_t *p)
+{
+    return (read32(p) * PRIME1) >> (32 - HASH_LOG);
+}
+
+/*
+ * Returns how many bytes at `a' and `b' are
+ * equal, up to `len', 8 at a time.
+ */
+static size_t
+match_len(const uint8_t *a, const uint8_t *b, size_t len)
+{
+    size_t n = 0;
+    uint64_t diff;
+
+    for (; n + 8 <= len; n += 8) {
+        if ((diff = read64(a + n) ^ read64(b + n)) != 0) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            return n + (__builtin_clzll(diff) >> 3);
+#else
+            return n + (__builtin_ctzll(diff) >> 3);
+#endif  /* __BYTE_ORDER__ */
+        }
+    }
+    for (; n < len && a[n] == b[n]; ++n);
+    return n;
+}
+
+/*
+ * Writes a length field continuation, 255s
+ * followed by the remainder.
+ */
+static uint8_t *
+put_len(uint8_t *op, size_t len)
+{
+    for (; len >= 255; len -= 255) {
+        *op++ = 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+/*
+ * Writes one sequence: `nlit' literals from `lit'
+ * then a match of `mlen' bytes `off' back, or
+ * only the literals if `mlen' is 0.
+ *
+ * Returns the end of the sequence in `op', or
+ * NULL if it does not fit before `oend'.
+ */
+static uint8_t *
+put_seq(uint8_t *op, uint8_t *oend, const uint8_t *lit, size_t nlit,
+        size_t off, size_t mlen)
+{
+    uint8_t *token = op++;
+    size_t need = 1 + nlit + nlit / 255 + 1 + 2 + mlen / 255 + 1;
+
+    if ((size_t)(oend - token) < need) {
+        return NULL;
+    }
+
+    if (nlit >= 15) {
+        *token = 15 << 4;
+        op = put_len(op, nlit - 15);
+    } else {
+        *token = (uint8_t)(nlit << 4);
+    }
+    memcpy(op, lit, nlit);
+    op += nlit;
+
+    if (mlen == 0) {
+        return op;
+    }
+
+    *op++ = (uint8_t)off;
+    *op++ = (uint8_t)(off >> 8);
+    mlen -= MINMATCH;
+    if (mlen >= 15) {
+        *token |= 15;
+        op = put_len(op, mlen - 15);
+    } else {
+        *token |= (uint8_t)mlen;
+    }
+    return op;
+}
+
+/*
+ * Compresses the `n' bytes at `src' (at most
+ * LZ4_BLOCK_MAX) into an LZ4 block at `dst'.
+ *
+ * Returns the size of the block, or 0 if it
+ * would not fit in `cap' bytes, in which case
+ * the data is best stored as is.
+ */
+size_t
+lz4_compress(const void *src, size_t n, void *dst, size_t cap)
+{
+    const uint8_t *base = src;
+    uint8_t *op = dst, *oend = op + cap;
+    uint16_t table[1 << HASH_LOG] = {0};
+    size_t ip = 1, anchor = 0, ref, len;
+
+    if (n > LZ4_BLOCK_MAX) {
+        return 0;
+    }
+
+    while (n >= MFLIMIT && ip <= n - MFLIMIT) {
+        uint32_t h = hash4(base + ip);
+
+        ref = table[h];
+        table[h] = (uint16_t)ip;
+        if (ref >= ip || read32(base + ref) != read32(base + ip)) {
+            ip += 1 + ((ip - anchor) >> SKIP_SHIFT);
+            continue;
+        }
+
+        /* Catch up with earlier equal bytes, then extend */
+        while (ip > anchor && ref > 0 && base[ip - 1] == base[ref - 1]) {
+            --ip;
+            --ref;
+        }
+        len = MINMATCH + match_len(base + ip + MINMATCH, base + ref + MINMATCH,
+                                  n - LASTLITERALS - ip - MINMATCH);
+
+        op = put_seq(op, oend, base + anchor, ip - anchor, ip - ref, len);
+        if (op == NULL) {
+            return 0;
+        }
+
+        ip += len;
+        anchor = ip;
+        if (ip <= n - MFLIMIT) {
+            table[hash4(base + ip - 2)] = (uint16_t)(ip - 2);
+        }
+    }
+
+    op = put_seq(op, oend, base + anchor, n - anchor, 0, 0);
+    return op == NULL ? 0 : (size_t)(op - (uint8_t *)dst);
+}
+
+/*
+ * Reads a length field continuation into `len'.
+ *
+ * Returns the position after it, or NULL if it
+ * runs past `end'.
+ */
+static const uint8_t *
+get_len(const uint8_t *ip, const uint8_t *end, size_t *len)
+{
+    uint8_t b;
+
+    do {
+        if (ip == end) {
+            return NULL;
+        }
+        b = *ip++;
+        *len += b;
+    } while (b == 255);
+    return ip;
+}
+
+/*
+ * Decompresses the LZ4 block of `n' bytes at
+ * `src' into `dst', checking every length and
+ * offset as the block may be damaged.
+ *
+ * Returns the size of the data, or -1 if the
+ * block is bad or the data exceeds `cap'.
+ */
+ssize_t
+lz4_decompress(const void *src, size_t n, void *dst, size_t cap)
+{
+    const uint8_t *ip = src, *iend = ip + n;
+    uint8_t *op = dst;
+    size_t out = 0, len, off;
+    uint8_t token;
+
+    while (ip < iend) {
+        token = *ip++;
+
+        len = token >> 4;
+        if (len == 15 && (ip = get_len(ip, iend, &len)) == NULL) {
+            return -1;
+        }
+        if ((size_t)(iend - ip) < len || cap - out < len) {
+            return -1;
+        }
+        memcpy(op + out, ip, len);
+        ip += len;
+        out += len;
+
+        /* The last sequence has no match */
+        if (ip == iend) {
+            break;
+        }
+
+        if (iend - ip < 2) {
+            return -1;
+        }
+        off = ip[0] | (ip[1] << 8);
+        ip += 2;
+        len = token & 15;
+        if (len == 15 && (ip = get_len(ip, iend, &len)) == NULL) {
+            return -1;
+        }
+        len += MINMATCH;
+        if (off == 0 || off > out || cap - out < len) {
+            return -1;
+        }
+
+        /* Byte by byte if the match overlaps its own output */
+        if (off >= len) {
+            memcpy(op + out, op + out - off, len);
+        } else {
+            for (size_t i = 0; i < len; ++i) {
+                op[out + i] = op[out - off + i];
+            }
+        }
+        out += len;
+    }
+
+    return out;
+}
+
+static inline uint32_t
+xxh32_round(uint32_t acc, uint32_t in)
+{
+    return rotl32(acc + in * PRIME2, 13) * PRIME1;
+}
+
+/*
+ * Returns the XXH32 hash of `len' bytes at `p'.
+ */
+uint32_t
+xxh32(const void *p, size_t len, uint32_t seed)
+{
+    const uint8_t *b = p, *end = b + len;
+    uint32_t h;
+
+    if (len >= 16) {
+        uint32_t v1 = seed + PRIME1 + PRIME2, v2 = seed + PRIME2;
+        uint32_t v3 = seed, v4 = seed - PRIME1;
+
+        for (; end - b >= 16; b += 16) {
+            v1 = xxh32_round(v1, read32(b));
+            v2 = xxh32_round(v2, read32(b + 4));
+            v3 = xxh32_round(v3, read32(b + 8));
+            v4 = xxh32_round(v4, read32(b + 12));
+        }
+        h = rotl32(v1, 1) + rotl32(v2, 7) + rotl32(v3, 12) + rotl32(v4, 18);
+    } else {
+        h = seed + PRIME5;
+    }
+
+    h += (uint32_t)len;
+    for (; end - b >= 4; b += 4) {
+        h = rotl32(h + read32(b) * PRIME3, 17) * PRIME4;
+    }
+    for (; b < end; ++b) {
+        h = rotl32(h + *b * PRIME5, 11) * PRIME1;
+    }
+
+    h ^= h >> 15;
+    h *= PRIME2;
+    h ^= h >> 13;
+    h *= PRIME3;
+    h ^= h >> 16;
+    return h;
+}
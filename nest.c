@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "nest.h"
+
+#define NEST_ENV        "CMDNOTIFY_NEST"
+#define NEST_PIPE_SIZE  (1024 * 1024)
+
+/*
+ * Sets up nesting for this instance.
+ *
+ * If CMDNOTIFY_NEST is set (as "<fd>:<inode>") and
+ * names a pipe we inherited, we are an inner instance
+ * and report our result over it. Otherwise we become
+ * the outermost instance and advertise a new pipe to
+ * our children.
+ */
+void
+nest_begin(struct nest_ctx *nc)
+{
+    const char *env = getenv(NEST_ENV);
+    unsigned long ino;
+    struct stat st;
+    char buf[64];
+    int fd, fds[2];
+
+    nc->inner = false;
+    nc->fd = -1;
+    nc->wfd = -1;
+
+    if (env != NULL && sscanf(env, "%d:%lu", &fd, &ino) == 2) {
+        /*
+         * Make sure the fd is still the pipe we were
+         * given and not something that happened to
+         * reuse the number.
+         */
+        if (fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode) &&
+            st.st_ino == ino) {
+            nc->inner = true;
+            nc->fd = fd;
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            return;
+        }
+    }
+
+    if (pipe2(fds, O_CLOEXEC | O_NONBLOCK) < 0) {
+        unsetenv(NEST_ENV);
+        return;
+    }
+
+    /* Room for plenty of steps before writers see EAGAIN */
+    fcntl(fds[0], F_SETPIPE_SZ, NEST_PIPE_SIZE);
+
+    /* Only the write end is inherited */
+    fcntl(fds[1], F_SETFD, 0);
+    fstat(fds[1], &st);
+    snprintf(buf, sizeof(buf), "%d:%lu", fds[1], (unsigned long)st.st_ino);
+    setenv(NEST_ENV, buf, 1);
+
+    nc->fd = fds[0];
+    nc->wfd = fds[1];
+}
+
+/*
+ * Reports the result of the run in `ri' to
+ * the outermost instance.
+ *
+ * Returns true if reported, in which case we
+ * must not notify ourselves.
+ */
+bool
+nest_report(struct nest_ctx *nc, const struct run_info *ri)
+{
+    struct nest_step step = {0};
+    const char *name;
+
+    if (!nc->inner) {
+        return false;
+    }
+
+    if ((name = strrchr(ri->progname, '/')) != NULL) {
+        ++name;
+    } else {
+        name = ri->progname;
+    }
+
+    step.status = ri->status;
+    step.duration_ms = ts_diff_ns(&ri->mono_start, &ri->mono_end) / 1000000;
+    snprintf(step.name, sizeof(step.name), "%s", name);
+
+    /* The pipe is full or gone, notify directly */
+    if (write(nc->fd, &step, sizeof(step)) != sizeof(step)) {
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Drains the steps reported by inner
+ * instances into `sum'.
+ */
+void
+nest_collect(struct nest_ctx *nc, struct nest_summary *sum)
+{
+    struct nest_step step;
+
+    memset(sum, 0, sizeof(*sum));
+    if (nc->inner || nc->fd < 0) {
+        return;
+    }
+
+    /* We are done handing out the write end */
+    close(nc->wfd);
+    while (read(nc->fd, &step, sizeof(step)) == sizeof(step)) {
+        step.name[NEST_NAME_MAX - 1] = '\0';
+
+        if (step.status != 0 && sum->nfailed++ == 0) {
+            sum->first_fail = step;
+        }
+        if (sum->nlisted < NEST_MAX_LISTED) {
+            sum->listed[sum->nlisted++] = step;
+        }
+        ++sum->nsteps;
+    }
+
+    close(nc->fd);
+    nc->fd = -1;
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef NEST_H
+#define NEST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "cmdnotify.h"
+#include "config.h"
+
+#define NEST_NAME_MAX   48
+
+/*
+ * Result of a step, sent by an inner
+ * cmdnotify to the outermost one. Kept
+ * under PIPE_BUF so writes are atomic.
+ */
+struct nest_step {
+    int32_t status;
+    uint32_t duration_ms;
+    char name[NEST_NAME_MAX];
+};
+
+/*
+ * Nesting state, we are either the outermost
+ * cmdnotify and own the read end of the step
+ * channel, or an inner one holding the write end.
+ */
+struct nest_ctx {
+    bool inner;
+    int fd;         /* Our end of the step channel */
+    int wfd;        /* Write end handed to children */
+};
+
+/*
+ * Steps reported by inner instances,
+ * collected by the outermost one.
+ */
+struct nest_summary {
+    size_t nsteps;
+    size_t nfailed;
+    struct nest_step first_fail;
+    size_t nlisted;
+    struct nest_step listed[NEST_MAX_LISTED];
+};
+
+void nest_begin(struct nest_ctx *nc);
+bool nest_report(struct nest_ctx *nc, const struct run_info *ri);
+void nest_collect(struct nest_ctx *nc, struct nest_summary *sum);
+
+#endif  /* !NEST_H */
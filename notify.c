@@ -0,0 +1,415 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include "notify.h"
+#include "evloop.h"
+#include "idmap.h"
+#include "utf8.h"
+#include "outbox.h"
+#include "latency.h"
+#include "daemon.h"
+#include "dbus.h"
+#include "config.h"
+
+/*
+ * A notify-send run the event loop reaps,
+ * watching its pidfd.
+ */
+struct pending {
+    struct ev_watch w;
+    pid_t child;        /* 0 if the slot is free */
+    int fd;             /* Its standard output */
+    uint64_t key;
+};
+
+static struct dbus bus = { .fd = -1 };
+static bool use_bus;
+static struct evloop *loop;
+static struct pending pending[NOTIFY_PENDING];
+
+static long long
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * Reads the notification ID printed by
+ * notify-send -p from `fd'.
+ *
+ * Returns the ID, or 0 if there is none.
+ */
+static uint32_t
+read_id(int fd)
+{
+    char buf[32];
+    ssize_t n;
+    size_t off = 0;
+
+    while (off < sizeof(buf) - 1) {
+        n = read(fd, buf + off, sizeof(buf) - 1 - off);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        off += n;
+    }
+
+    buf[off] = '\0';
+    return strtoul(buf, NULL, 10);
+}
+
+/*
+ * Starts notify-send for a notification with the
+ * already sanitized `summary' and `body', setting
+ * `*fd' to the read end of its standard output.
+ *
+ * Returns its PID, otherwise -1.
+ */
+static pid_t
+notify_spawn(const struct notification *n, const char *summary,
+             const char *body, int *fd)
+{
+    char *args[16], idstr[16], hint[32], timeout[16];
+    uint32_t id = 0;
+    int argc = 0, pfd[2];
+    pid_t child;
+
+    args[argc++] = NOTIFY_SEND_BINLOC;
+    args[argc++] = "-t";
+    if (n->has_timeout) {
+        snprintf(timeout, sizeof(timeout), "%d", n->timeout);
+        args[argc++] = timeout;
+    } else {
+        args[argc++] = NOTIFY_SEND_TIMEOUT;
+    }
+
+    args[argc++] = "-u";
+    args[argc++] = n->urgency != NULL ? (char *)n->urgency : NOTIFY_SEND_URGENCY;
+
+    if (n->has_progress) {
+        snprintf(hint, sizeof(hint), "int:value:%d", n->progress);
+        args[argc++] = "-h";
+        args[argc++] = hint;
+    }
+
+#if NOTIFY_SEND_REPLACE
+    if (n->key != 0) {
+        args[argc++] = "-p";
+        if ((id = idmap_get(n->key)) != 0) {
+            snprintf(idstr, sizeof(idstr), "%u", id);
+            args[argc++] = "-r";
+            args[argc++] = idstr;
+        }
+    }
+#endif  /* NOTIFY_SEND_REPLACE */
+
+    args[argc++] = (char *)summary;
+    args[argc++] = (char *)body;
+    args[argc] = NULL;
+
+    /* Not inherited by other notify-send runs, which would hold it open */
+    if (pipe2(pfd, O_CLOEXEC) < 0) {
+        return -1;
+    }
+
+    /*
+     * Forking will create a child that will
+     * then be overwritten by execv() therefore
+     * allowing us to continue this main thread
+     * and cleanup
+     */
+    child = fork();
+    if (child == 0) {
+        /* Child side */
+        dup2(pfd[1], STDOUT_FILENO);
+        execv(NOTIFY_SEND_BINLOC, args);
+        _exit(127);
+    }
+
+    close(pfd[1]);
+    if (child < 0) {
+        close(pfd[0]);
+        return -1;
+    }
+    *fd = pfd[0];
+    return child;
+}
+
+/*
+ * Remembers the ID notify-send printed to `fd'
+ * for `key' and reaps it.
+ *
+ * Returns 0 if it succeeded, otherwise -1.
+ */
+static int
+notify_reap(pid_t child, int fd, uint64_t key)
+{
+    uint32_t id;
+    int status;
+
+    if ((id = read_id(fd)) != 0 && key != 0) {
+        idmap_put(key, id);
+    }
+    close(fd);
+
+    while (waitpid(child, &status, 0) < 0 && errno == EINTR);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Runs notify-send for a notification with the
+ * already sanitized `summary' and `body'.
+ *
+ * Returns 0 on success, otherwise -1.
+ */
+static int
+notify_exec(const struct notification *n, const char *summary, const char *body)
+{
+    pid_t child;
+    int fd;
+
+    if ((child = notify_spawn(n, summary, body, &fd)) < 0) {
+        return -1;
+    }
+    return notify_reap(child, fd, n->key);
+}
+
+/*
+ * Called once the pidfd of a notify-send
+ * started by notify_start() becomes readable.
+ */
+static void
+pending_exited(struct ev_watch *w, uint32_t events)
+{
+    struct pending *p = w->arg;
+
+    (void)events;
+    ev_del(loop, w);
+    close(w->fd);
+    notify_reap(p->child, p->fd, p->key);
+    p->child = 0;
+}
+
+/*
+ * Like notify_exec(), but leaves reaping
+ * notify-send to the event loop, so that
+ * its handlers are never held up by the
+ * notification server.
+ *
+ * Returns 0 if notify-send was started,
+ * otherwise -1.
+ */
+static int
+notify_start(const struct notification *n, const char *summary, const char *body)
+{
+    struct pending *p = NULL;
+    int ret;
+
+    for (size_t i = 0; i < NOTIFY_PENDING; ++i) {
+        if (pending[i].child == 0) {
+            p = p != NULL ? p : &pending[i];
+        } else if (n->key != 0 && pending[i].key == n->key) {
+            /* Its ID isn't known yet, we'd stack a second one */
+            return -1;
+        }
+    }
+    if (p == NULL) {
+        return -1;
+    }
+
+    if ((p->child = notify_spawn(n, summary, body, &p->fd)) < 0) {
+        p->child = 0;
+        return -1;
+    }
+    p->key = n->key;
+    p->w = (struct ev_watch){ .fn = pending_exited, .arg = p };
+    p->w.fd = syscall(SYS_pidfd_open, p->child, 0);
+    if (p->w.fd < 0 || ev_add(loop, &p->w, EPOLLIN) < 0) {
+        if (p->w.fd >= 0) {
+            close(p->w.fd);
+        }
+        ret = notify_reap(p->child, p->fd, p->key);
+        p->child = 0;
+        return ret;
+    }
+    return 0;
+}
+
+/*
+ * Like notify_exec(), but over our own session
+ * bus connection, reconnecting if it broke.
+ *
+ * Returns 0 on success, otherwise -1.
+ */
+static int
+notify_bus(const struct notification *n, const char *summary, const char *body)
+{
+    uint32_t id = 0, replaces = 0;
+
+    if (bus.fd < 0 && dbus_open(&bus) < 0) {
+        return -1;
+    }
+
+#if NOTIFY_SEND_REPLACE
+    if (n->key != 0) {
+        replaces = idmap_get(n->key);
+    }
+#endif  /* NOTIFY_SEND_REPLACE */
+
+    if (dbus_notify(&bus, summary, body,
+                    n->urgency != NULL ? n->urgency : NOTIFY_SEND_URGENCY,
+                    n->has_timeout ? n->timeout : atoi(NOTIFY_SEND_TIMEOUT),
+                    n->has_progress ? n->progress : -1, replaces, &id) < 0) {
+        return -1;
+    }
+
+#if NOTIFY_SEND_REPLACE
+    if (n->key != 0 && id != 0) {
+        idmap_put(n->key, id);
+    }
+#endif  /* NOTIFY_SEND_REPLACE */
+    return 0;
+}
+
+/*
+ * Has notify_deliver() talk to the notification
+ * server over a session bus connection that is
+ * kept open, rather than run notify-send each
+ * time. Used by cmdnotifyd.
+ */
+void
+notify_use_bus(void)
+{
+    use_bus = true;
+    dbus_open(&bus);
+}
+
+/*
+ * Has notify_deliver() leave transient notifications
+ * to notify-send without waiting for it while `ev'
+ * runs, as they are sent from its handlers. With
+ * NULL, waits for those still running, so that
+ * their IDs are known to the next notification.
+ */
+void
+notify_use_loop(struct evloop *ev)
+{
+    struct pending *p;
+
+    for (p = pending; ev == NULL && p < &pending[NOTIFY_PENDING]; ++p) {
+        if (p->child != 0) {
+            ev_del(loop, &p->w);
+            close(p->w.fd);
+            notify_reap(p->child, p->fd, p->key);
+            p->child = 0;
+        }
+    }
+    loop = ev;
+}
+
+/*
+ * Sends a notification, through cmdnotifyd if
+ * it runs, otherwise through notify-send.
+ *
+ * If `n->key' is set, the last notification
+ * for the same key is replaced instead of
+ * stacking a new one.
+ *
+ * Returns 0 on success, otherwise -1.
+ */
+int
+notify_deliver(const struct notification *n)
+{
+    char summary[NOTIFY_SUMMARY_BUDGET], body[NOTIFY_BODY_BUDGET];
+    long long dispatch_ns;
+
+    if (daemon_send(n) == 0) {
+        return 0;
+    }
+
+    /* The body is markup, the summary is plain text */
+    utf8_sanitize(summary, sizeof(summary), n->summary, strlen(n->summary), 0);
+    utf8_sanitize(body, sizeof(body), n->body, strlen(n->body), UTF8_ESCAPE);
+
+    if (loop != NULL && n->transient) {
+        return notify_start(n, summary, body);
+    }
+
+    dispatch_ns = now_ns();
+    if ((!use_bus || notify_bus(n, summary, body) < 0) &&
+        notify_exec(n, summary, body) < 0) {
+        return -1;
+    }
+
+    /* Either way, we are back once the server replied */
+    if (n->exit_ns != 0) {
+        latency_record(n->exit_ns, dispatch_ns, now_ns());
+    }
+    return 0;
+}
+
+/*
+ * Sends a notification, keeping it in the
+ * outbox if it can't be delivered right now.
+ *
+ * Returns 0 on success, otherwise -1.
+ */
+int
+notify(const struct notification *n)
+{
+    if (notify_deliver(n) == 0) {
+        return 0;
+    }
+
+    if (!n->transient) {
+        outbox_append(n);
+    }
+    return -1;
+}
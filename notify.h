@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef NOTIFY_H
+#define NOTIFY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define NOTIFY_SEND_BINLOC  "/bin/notify-send"
+
+#define SUCCESS_SUMMARY "Success"
+#define FAILURE_SUMMARY "Error"
+#define PROGRESS_SUMMARY "Running"
+#define TRIGGER_SUMMARY "Output"
+#define IDLE_SUMMARY "Waiting for input"
+
+/*
+ * A notification to be shown.
+ */
+struct notification {
+    const char *summary;
+    const char *body;
+    uint64_t key;       /* Updated in place if non-zero, see argv_key() */
+    const char *urgency;    /* NULL for NOTIFY_SEND_URGENCY */
+    bool has_timeout;
+    int timeout;        /* Milliseconds, if `has_timeout' */
+    bool transient;     /* Not worth delivering later */
+    long long exit_ns;  /* CLOCK_MONOTONIC exit of the command, 0 if none */
+    bool has_progress;
+    int progress;       /* Percentage, if `has_progress' */
+};
+
+struct evloop;
+
+int notify(const struct notification *n);
+int notify_deliver(const struct notification *n);
+void notify_use_bus(void);
+void notify_use_loop(struct evloop *ev);
+
+#endif  /* !NOTIFY_H */
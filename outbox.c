@@ -0,0 +1,392 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Durable outbox for notifications that could not
+ * be delivered, e.g., with no notification server
+ * around. Records are appended to
+ * $XDG_STATE_HOME/cmdnotify/outbox and replayed in
+ * order by the next cmdnotify (or cmdnotify -F).
+ *
+ * Writers share fsyncs through group commit: after
+ * appending, a writer takes the commit lock and only
+ * syncs if nobody synced past its record meanwhile,
+ * so one fdatasync() covers everyone that queued up
+ * behind it.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "outbox.h"
+#include "xdg.h"
+#include "config.h"
+
+#define OUTBOX_FILE     "outbox"
+#define OUTBOX_LOCK     "outbox.lock"
+#define OUTBOX_MAGIC    0x584f424fU   /* "OBOX" */
+#define OUTBOX_REC_MAX  4096
+
+/*
+ * On-disk record, followed by the urgency,
+ * summary and body (not terminated).
+ */
+struct outbox_rec {
+    uint32_t magic;
+    uint32_t len;           /* Including this header */
+    uint64_t key;
+    int64_t time;           /* When it was due, seconds since epoch */
+    int32_t timeout;
+    uint8_t has_timeout;
+    uint8_t urgency_len;
+    uint16_t summary_len;
+    uint32_t body_len;
+};
+
+/*
+ * Shared commit state.
+ */
+struct outbox_sync {
+    uint64_t synced;        /* File size known to be durable */
+};
+
+/*
+ * Makes sure the outbox is durable up to `end'
+ * (group commit).
+ */
+static void
+outbox_commit(int fd, uint64_t end)
+{
+    struct outbox_sync *sync;
+    struct stat sb;
+    int lfd;
+
+    sync = xdg_map(XDG_STATE, OUTBOX_LOCK, sizeof(*sync), &lfd);
+    if (sync == NULL) {
+        fdatasync(fd);
+        return;
+    }
+
+    /*
+     * Whoever holds the lock is syncing for us too,
+     * unless what it synced was since removed or
+     * replaced by a shorter file.
+     */
+    flock(lfd, LOCK_EX);
+    if (fstat(fd, &sb) < 0) {
+        fdatasync(fd);
+    } else if (sync->synced > (uint64_t)sb.st_size || sync->synced < end) {
+        fdatasync(fd);
+        sync->synced = sb.st_size;
+    }
+    flock(lfd, LOCK_UN);
+
+    xdg_unmap(sync, sizeof(*sync), lfd);
+}
+
+/*
+ * Appends `n' to the outbox so it can
+ * be delivered later.
+ */
+void
+outbox_append(const struct notification *n)
+{
+    char buf[OUTBOX_REC_MAX], path[256];
+    struct outbox_rec *rec = (struct outbox_rec *)buf;
+    const char *urgency = n->urgency != NULL ? n->urgency : "";
+    size_t ulen = strlen(urgency), slen = strlen(n->summary);
+    size_t blen = strlen(n->body);
+    off_t end;
+    int fd;
+
+    if (ulen > 255) {
+        ulen = 255;
+    }
+    if (slen > NOTIFY_SUMMARY_BUDGET) {
+        slen = NOTIFY_SUMMARY_BUDGET;
+    }
+    if (sizeof(*rec) + ulen + slen + blen > sizeof(buf)) {
+        blen = sizeof(buf) - sizeof(*rec) - ulen - slen;
+    }
+
+    memset(rec, 0, sizeof(*rec));
+    rec->magic = OUTBOX_MAGIC;
+    rec->len = sizeof(*rec) + ulen + slen + blen;
+    rec->key = n->key;
+    rec->time = time(NULL);
+    rec->timeout = n->timeout;
+    rec->has_timeout = n->has_timeout;
+    rec->urgency_len = ulen;
+    rec->summary_len = slen;
+    rec->body_len = blen;
+    memcpy(buf + sizeof(*rec), urgency, ulen);
+    memcpy(buf + sizeof(*rec) + ulen, n->summary, slen);
+    memcpy(buf + sizeof(*rec) + ulen + slen, n->body, blen);
+
+    if (xdg_path(XDG_STATE, OUTBOX_FILE, path, sizeof(path)) < 0) {
+        return;
+    }
+
+    fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return;
+    }
+
+    /* Shared, so a replay can't truncate under us */
+    flock(fd, LOCK_SH);
+    if (write(fd, buf, rec->len) == (ssize_t)rec->len &&
+        (end = lseek(fd, 0, SEEK_CUR)) > 0) {
+        outbox_commit(fd, end);
+    }
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
+/*
+ * Turns the record `rec', with its strings at
+ * `p', back into a notification, strings go
+ * in `strs'.
+ */
+static void
+outbox_decode(const struct outbox_rec *rec, const char *p,
+              struct notification *n, char *strs, size_t len)
+{
+    char when[16];
+    struct tm tm;
+    time_t t = rec->time;
+    char *urgency = strs, *summary, *body;
+
+    memcpy(urgency, p, rec->urgency_len);
+    urgency[rec->urgency_len] = '\0';
+    summary = urgency + rec->urgency_len + 1;
+    memcpy(summary, p + rec->urgency_len, rec->summary_len);
+    summary[rec->summary_len] = '\0';
+    body = summary + rec->summary_len + 1;
+
+    localtime_r(&t, &tm);
+    strftime(when, sizeof(when), "%H:%M", &tm);
+    snprintf(body, len - (body - strs), "%.*s\n(at %s)", (int)rec->body_len,
+             p + rec->urgency_len + rec->summary_len, when);
+
+    memset(n, 0, sizeof(*n));
+    n->summary = summary;
+    n->body = body;
+    n->key = rec->key;
+    n->urgency = urgency[0] != '\0' ? urgency : NULL;
+    n->has_timeout = rec->has_timeout;
+    n->timeout = rec->timeout;
+}
+
+/*
+ * Finds the first valid record at or after `*offp'
+ * in the `len' bytes at `buf', skipping whatever
+ * is left of records torn by a crash while they
+ * were appended.
+ *
+ * Returns the strings that follow the record's
+ * header, copied to `rec' as records need not be
+ * aligned, with its offset in `offp'. Returns
+ * NULL if there is none.
+ */
+static const char *
+outbox_next(const char *buf, size_t len, size_t *offp, struct outbox_rec *rec)
+{
+    const uint32_t magic = OUTBOX_MAGIC;
+    size_t off = *offp;
+    const char *p;
+
+    while (len - off >= sizeof(*rec)) {
+        memcpy(rec, buf + off, sizeof(*rec));
+        if (rec->magic == OUTBOX_MAGIC && rec->len <= len - off &&
+            rec->len <= OUTBOX_REC_MAX && rec->len == sizeof(*rec) +
+            rec->urgency_len + rec->summary_len + rec->body_len) {
+            *offp = off;
+            return buf + off + sizeof(*rec);
+        }
+
+        /* Resume at the next record */
+        p = memmem(buf + off + 1, len - off - 1, &magic, sizeof(magic));
+        if (p == NULL) {
+            break;
+        }
+        off = p - buf;
+    }
+    return NULL;
+}
+
+/*
+ * Returns where the last valid record in `buf'
+ * ends, and the number of them in `countp'.
+ */
+static size_t
+outbox_scan(const char *buf, size_t len, size_t *countp)
+{
+    struct outbox_rec rec;
+    size_t off = 0, end = 0;
+
+    *countp = 0;
+    while (outbox_next(buf, len, &off, &rec) != NULL) {
+        off += rec.len;
+        end = off;
+        ++*countp;
+    }
+    return end;
+}
+
+/*
+ * Shows one notification for `count' records
+ * starting at `buf', listing the last few.
+ */
+static int
+outbox_coalesce(const char *buf, size_t len, size_t count)
+{
+    struct outbox_rec rec;
+    struct notification n = {0};
+    char body[NOTIFY_BODY_BUDGET], summary[64];
+    size_t off = 0, skip = count - OUTBOX_COALESCE, i = 0, bodyoff;
+    const char *p;
+
+    snprintf(summary, sizeof(summary), "%zu missed notifications", count);
+    bodyoff = snprintf(body, sizeof(body), "Last %d:", OUTBOX_COALESCE);
+
+    while (bodyoff < sizeof(body) && (p = outbox_next(buf, len, &off, &rec)) != NULL) {
+        if (i++ >= skip) {
+            const char *body_p = p + rec.urgency_len + rec.summary_len;
+            const char *nl = memchr(body_p, '\n', rec.body_len);
+            int blen = nl != NULL ? nl - body_p : (int)rec.body_len;
+
+            bodyoff += snprintf(body + bodyoff, sizeof(body) - bodyoff,
+                                "\n%.*s: %.*s", (int)rec.summary_len,
+                                p + rec.urgency_len, blen, body_p);
+        }
+        off += rec.len;
+    }
+
+    n.summary = summary;
+    n.body = body;
+    return notify_deliver(&n);
+}
+
+/*
+ * Delivers everything in the outbox, in order.
+ * If more than OUTBOX_COALESCE records piled up,
+ * a single summary is shown instead.
+ */
+void
+outbox_flush(void)
+{
+    struct outbox_rec rec;
+    struct outbox_sync *sync;
+    struct notification n;
+    char path[256], strs[OUTBOX_REC_MAX + 64], *buf;
+    const char *p;
+    struct stat sb;
+    size_t len, end, count, pos, off = 0;
+    ssize_t r;
+    int fd, lfd;
+
+    if (xdg_path(XDG_STATE, OUTBOX_FILE, path, sizeof(path)) < 0) {
+        return;
+    }
+
+    /* Common case, nothing to do */
+    if (stat(path, &sb) < 0 || sb.st_size == 0) {
+        return;
+    }
+
+    if ((fd = open(path, O_RDWR | O_CLOEXEC)) < 0) {
+        return;
+    }
+
+    /* Someone else is already replaying */
+    if (flock(fd, LOCK_EX | LOCK_NB) < 0) {
+        close(fd);
+        return;
+    }
+
+    if (fstat(fd, &sb) < 0 || sb.st_size == 0 ||
+        (buf = malloc(sb.st_size)) == NULL) {
+        goto out;
+    }
+
+    for (len = 0; len < (size_t)sb.st_size; len += r) {
+        r = pread(fd, buf + len, sb.st_size - len, len);
+        if (r <= 0) {
+            break;
+        }
+    }
+
+    /*
+     * `off' is where the delivered records end,
+     * along with whatever was torn among them.
+     */
+    end = outbox_scan(buf, len, &count);
+    if (count > OUTBOX_COALESCE) {
+        if (outbox_coalesce(buf, end, count) == 0) {
+            off = end;
+        }
+    } else {
+        for (pos = 0; (p = outbox_next(buf, end, &pos, &rec)) != NULL; pos += rec.len) {
+            outbox_decode(&rec, p, &n, strs, sizeof(strs));
+            if (notify_deliver(&n) < 0) {
+                break;
+            }
+            off = pos + rec.len;
+        }
+    }
+
+    /* Keep whatever could not be delivered, or read */
+    if (off > 0 && len == (size_t)sb.st_size) {
+        if (off < len) {
+            pwrite(fd, buf + off, len - off, 0);
+        }
+        ftruncate(fd, len - off);
+        fdatasync(fd);
+
+        if ((sync = xdg_map(XDG_STATE, OUTBOX_LOCK, sizeof(*sync), &lfd)) != NULL) {
+            flock(lfd, LOCK_EX);
+            sync->synced = len - off;
+            flock(lfd, LOCK_UN);
+            xdg_unmap(sync, sizeof(*sync), lfd);
+        }
+    }
+
+    free(buf);
+out:
+    flock(fd, LOCK_UN);
+    close(fd);
+}
@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "procstat.h"
+
+/*
+ * Reads /proc/<pid>/stat into `ps'.
+ *
+ * Returns 0 on success, otherwise -1.
+ */
+int
+proc_stat(pid_t pid, struct proc_stat *ps)
+{
+    unsigned long long utime, stime, cutime, cstime, rss;
+    long tck = sysconf(_SC_CLK_TCK);
+    long pagesize = sysconf(_SC_PAGESIZE);
+    char path[64], buf[1024], *p;
+    ssize_t len;
+    int fd, ppid, pgrp, tpgid;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+        return -1;
+    }
+
+    len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0) {
+        return -1;
+    }
+    buf[len] = '\0';
+
+    /* The command name may contain spaces and parens */
+    if ((p = strrchr(buf, ')')) == NULL) {
+        return -1;
+    }
+
+    if (sscanf(p + 2, "%c %d %d %*d %*d %d %*u %*u %*u %*u %*u "
+               "%llu %llu %llu %llu %*d %*d %*d %*d %*u %*u %llu",
+               &ps->state, &ppid, &pgrp, &tpgid, &utime, &stime, &cutime,
+               &cstime, &rss) != 9) {
+        return -1;
+    }
+
+    ps->ppid = ppid;
+    ps->pgrp = pgrp;
+    ps->tpgid = tpgid;
+    ps->cpu_ns = (utime + stime + cutime + cstime) * (1000000000ULL / tck);
+    ps->rss = rss * pagesize;
+    return 0;
+}
+
+/*
+ * Returns the CPU time of `pid' (whose stat is
+ * `ps') and of every live process below it, so
+ * the work of e.g., make or a script shows up
+ * although it happens in their children. Time
+ * of reaped processes is in their parent's.
+ */
+unsigned long long
+proc_tree_cpu(pid_t pid, const struct proc_stat *ps)
+{
+    struct proc_node {
+        pid_t pid;
+        pid_t ppid;
+        unsigned long long cpu_ns;
+        int in_tree;
+    } *nodes = NULL, *tmp;
+    struct proc_stat other;
+    struct dirent *d;
+    unsigned long long total = ps->cpu_ns;
+    size_t n = 0, cap = 0;
+    int added;
+    DIR *dir;
+
+    if ((dir = opendir("/proc")) == NULL) {
+        return total;
+    }
+
+    while ((d = readdir(dir)) != NULL) {
+        if (!isdigit((unsigned char)d->d_name[0]) ||
+            proc_stat(atoi(d->d_name), &other) < 0) {
+            continue;
+        }
+
+        if (n == cap) {
+            cap = cap == 0 ? 256 : cap * 2;
+            if ((tmp = realloc(nodes, cap * sizeof(*nodes))) == NULL) {
+                break;
+            }
+            nodes = tmp;
+        }
+        nodes[n++] = (struct proc_node){
+            .pid = atoi(d->d_name),
+            .ppid = other.ppid,
+            .cpu_ns = other.cpu_ns,
+            .in_tree = 0
+        };
+    }
+    closedir(dir);
+
+    /* One level deeper per pass, trees are shallow */
+    do {
+        added = 0;
+        for (size_t i = 0; i < n; ++i) {
+            if (nodes[i].in_tree || nodes[i].pid == pid) {
+                continue;
+            }
+            if (nodes[i].ppid == pid) {
+                nodes[i].in_tree = added = 1;
+                continue;
+            }
+            for (size_t j = 0; j < n; ++j) {
+                if (nodes[j].in_tree && nodes[j].pid == nodes[i].ppid) {
+                    nodes[i].in_tree = added = 1;
+                    break;
+                }
+            }
+        }
+    } while (added);
+
+    for (size_t i = 0; i < n; ++i) {
+        if (nodes[i].in_tree) {
+            total += nodes[i].cpu_ns;
+        }
+    }
+    free(nodes);
+    return total;
+}
@@ -0,0 +1,313 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include "progress.h"
+#include "notify.h"
+#include "util.h"
+#include "config.h"
+
+#define PROGRESS_ENV    "CMDNOTIFY_PROGRESS_FD"
+#define TOKEN           1000LL
+
+static long long
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * Shows the current progress, unless
+ * we ran out of tokens, in which case
+ * the timer is armed to try again.
+ */
+static void
+progress_flush(struct progress *p)
+{
+    const long long interval = PROGRESS_INTERVAL * 1000000LL;
+    struct notification n = {0};
+    char body[256], eta[32];
+    long long now = now_ns();
+    size_t off;
+
+    if (!p->dirty) {
+        return;
+    }
+
+    p->tokens += (now - p->refill_ns) * TOKEN / interval;
+    if (p->tokens > PROGRESS_BURST * TOKEN) {
+        p->tokens = PROGRESS_BURST * TOKEN;
+    }
+    p->refill_ns = now;
+
+    if (p->tokens < TOKEN) {
+        if (!p->timer_armed) {
+            timer_arm(p->timerfd, (TOKEN - p->tokens) * interval / TOKEN);
+            p->timer_armed = true;
+        }
+        return;
+    }
+
+    p->tokens -= TOKEN;
+    p->dirty = false;
+
+    off = snprintf(body, sizeof(body), "'%s'", p->cmd);
+    if (p->percent >= 0) {
+        off += snprintf(body + off, sizeof(body) - off, " %d%%", p->percent);
+    }
+    if (p->stage[0] != '\0' && off < sizeof(body)) {
+        off += snprintf(body + off, sizeof(body) - off, ", %s", p->stage);
+    }
+    if (p->eta >= 0 && off < sizeof(body)) {
+        fmt_duration(eta, sizeof(eta), p->eta * 1000LL);
+        snprintf(body + off, sizeof(body) - off, ", ETA %s", eta);
+    }
+
+    n.summary = PROGRESS_SUMMARY;
+    n.body = body;
+    n.transient = true;
+    n.key = p->key;
+    n.has_progress = p->percent >= 0;
+    n.progress = p->percent;
+    notify(&n);
+}
+
+/*
+ * Handles a single message from the
+ * program, e.g., "progress 42".
+ */
+static void
+progress_parse(struct progress *p, char *line)
+{
+    char *arg = strchr(line, ' ');
+
+    if (arg == NULL) {
+        return;
+    }
+    *arg++ = '\0';
+
+    if (strcmp(line, "progress") == 0) {
+        p->percent = atoi(arg);
+        if (p->percent < 0) {
+            p->percent = 0;
+        } else if (p->percent > 100) {
+            p->percent = 100;
+        }
+    } else if (strcmp(line, "stage") == 0) {
+        snprintf(p->stage, sizeof(p->stage), "%s", arg);
+    } else if (strcmp(line, "eta") == 0) {
+        p->eta = atol(arg);
+    } else {
+        return;
+    }
+
+    p->dirty = true;
+}
+
+/*
+ * Reports progress found other than on the
+ * channel, e.g., in the program's output (see
+ * build.c).
+ *
+ * @percent: -1 if unknown.
+ * @stage: May be NULL.
+ * @eta: Seconds, -1 if unknown.
+ */
+void
+progress_set(struct progress *p, int percent, const char *stage, long eta)
+{
+    p->percent = percent;
+    snprintf(p->stage, sizeof(p->stage), "%s", stage != NULL ? stage : "");
+    p->eta = eta;
+    p->dirty = true;
+    progress_flush(p);
+}
+
+static void
+progress_read(struct ev_watch *w, uint32_t events)
+{
+    struct progress *p = w->arg;
+    char *nl;
+    ssize_t n;
+
+    for (;;) {
+        n = read(p->rfd, p->line + p->len, sizeof(p->line) - 1 - p->len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+
+        p->len += n;
+        p->line[p->len] = '\0';
+
+        while ((nl = memchr(p->line, '\n', p->len)) != NULL) {
+            *nl = '\0';
+            progress_parse(p, p->line);
+            p->len -= nl + 1 - p->line;
+            memmove(p->line, nl + 1, p->len);
+        }
+
+        /* Overlong line, drop it */
+        if (p->len == sizeof(p->line) - 1) {
+            p->len = 0;
+        }
+    }
+
+    /* Every writer is gone */
+    if (n == 0 || (events & EPOLLHUP) != 0) {
+        ev_del(p->ev, w);
+    }
+
+    progress_flush(p);
+}
+
+static void
+progress_timer(struct ev_watch *w, uint32_t events)
+{
+    struct progress *p = w->arg;
+    uint64_t exp;
+
+    (void)events;
+    read(p->timerfd, &exp, sizeof(exp));
+    p->timer_armed = false;
+    progress_flush(p);
+}
+
+/*
+ * Creates the progress channel and exports
+ * its write end to the program as
+ * CMDNOTIFY_PROGRESS_FD.
+ *
+ * Returns 0 on success, otherwise -1.
+ */
+int
+progress_begin(struct progress *p, const char *cmd, uint64_t key)
+{
+    int fds[2];
+    char buf[16];
+
+    memset(p, 0, sizeof(*p));
+    p->rfd = p->wfd = p->timerfd = -1;
+    p->percent = -1;
+    p->eta = -1;
+    p->cmd = cmd;
+    p->key = key;
+    p->tokens = PROGRESS_BURST * TOKEN;
+    p->refill_ns = now_ns();
+
+    if (pipe2(fds, O_CLOEXEC | O_NONBLOCK) < 0) {
+        return -1;
+    }
+
+    if ((p->timerfd = timer_create_fd()) < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+
+    /* The program writes blocking, only we are non-blocking */
+    fcntl(fds[1], F_SETFL, 0);
+    fcntl(fds[1], F_SETFD, 0);
+    p->rfd = fds[0];
+    p->wfd = fds[1];
+
+    snprintf(buf, sizeof(buf), "%d", p->wfd);
+    setenv(PROGRESS_ENV, buf, 1);
+    return 0;
+}
+
+/*
+ * Starts watching the channel, must be
+ * called after the program was forked.
+ */
+void
+progress_attach(struct progress *p, struct evloop *ev)
+{
+    if (p->rfd < 0) {
+        return;
+    }
+
+    /* Only the program keeps the write end */
+    close(p->wfd);
+    p->wfd = -1;
+
+    p->ev = ev;
+    p->rw = (struct ev_watch){ .fd = p->rfd, .fn = progress_read, .arg = p };
+    p->tw = (struct ev_watch){ .fd = p->timerfd, .fn = progress_timer, .arg = p };
+    ev_add(ev, &p->rw, EPOLLIN);
+    ev_add(ev, &p->tw, EPOLLIN);
+}
+
+/*
+ * Used instead of progress_attach() when nobody
+ * will read the channel. The pipe is switched to
+ * non-blocking for the program too, so once it is
+ * full the program's writes fail rather than
+ * block it forever (a closed read end would kill
+ * it with SIGPIPE).
+ */
+void
+progress_ignore(struct progress *p)
+{
+    if (p->wfd < 0) {
+        return;
+    }
+
+    fcntl(p->wfd, F_SETFL, O_NONBLOCK);
+    close(p->wfd);
+    p->wfd = -1;
+}
+
+void
+progress_end(struct progress *p)
+{
+    if (p->rfd >= 0) {
+        close(p->rfd);
+    }
+    if (p->wfd >= 0) {
+        close(p->wfd);
+    }
+    if (p->timerfd >= 0) {
+        close(p->timerfd);
+    }
+    unsetenv(PROGRESS_ENV);
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "evloop.h"
+
+#define PROGRESS_LINE_MAX   256
+#define PROGRESS_STAGE_MAX  64
+
+/*
+ * Progress channel between the wrapped
+ * program and us, see cmdnotify-progress.h
+ * for the program side.
+ */
+struct progress {
+    int rfd;
+    int wfd;
+    int timerfd;
+    struct ev_watch rw;
+    struct ev_watch tw;
+    char line[PROGRESS_LINE_MAX];
+    size_t len;
+
+    /* Latest state reported by the program */
+    bool dirty;
+    bool timer_armed;
+    int percent;                /* -1 if unknown */
+    long eta;                   /* Seconds, -1 if unknown */
+    char stage[PROGRESS_STAGE_MAX];
+
+    /* Token bucket for notification updates */
+    long long tokens;
+    long long refill_ns;
+
+    const char *cmd;
+    uint64_t key;
+    struct evloop *ev;
+};
+
+int progress_begin(struct progress *p, const char *cmd, uint64_t key);
+void progress_attach(struct progress *p, struct evloop *ev);
+void progress_ignore(struct progress *p);
+void progress_set(struct progress *p, int percent, const char *stage, long eta);
+void progress_end(struct progress *p);
+
+#endif  /* !PROGRESS_H */
@@ -0,0 +1,1109 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Runtime rules deciding the urgency and timeout of
+ * a notification, or whether to show it at all. The
+ * rules file ($XDG_CONFIG_HOME/cmdnotify/rules) holds
+ * one rule per line:
+ *
+ *      # command       status  duration  action ...
+ *      make,ninja      fail    *         urgency=critical timeout=0
+ *      git:fetch       ok      *         suppress
+ *      *               *       >30m      urgency=critical
+ *      *               130     *         suppress
+ *
+ * command:  Comma separated basenames, optionally with
+ *           ":<arg>" to also match the first argument,
+ *           or "*" for any command.
+ * status:   "*", "ok", "fail", "<n>" or "!<n>".
+ * duration: "*", ">" or "<" followed by a number with
+ *           an optional unit (s, m or h).
+ * action:   "suppress", "urgency=<low|normal|critical>"
+ *           and/or "timeout=<ms>", 0 never expires.
+ *
+ * The first matching rule wins. The file is compiled
+ * into a cache ($XDG_CACHE_HOME/cmdnotify/rules.bin)
+ * keyed by its mtime. The rules of each command name
+ * (or "*"), with or without a first argument, make up
+ * a decision table holding their first match for each
+ * class of exit status and duration. The status classes
+ * are the statuses those rules name plus one for any
+ * other, and the duration classes lie between their
+ * thresholds, so a table only grows with the distinct
+ * values its own rules name.
+ *
+ * A lookup probes a perfect hash table for the tables
+ * of "name:arg", "name", "*:arg" and "*", does a binary
+ * search over each one's few statuses and thresholds,
+ * and takes the earliest of their rules, no matter how
+ * many rules there are.
+ *
+ * A key with so many rules and distinct values that
+ * its table would take more than TABLE_MAX_WORK cell
+ * checks to build keeps its rules in file order
+ * instead, and a lookup checks them one by one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "rules.h"
+#include "util.h"
+#include "xdg.h"
+
+#define RULES_FILE      "rules"
+#define RULES_CACHE     "rules.bin"
+#define RULES_MAGIC     0x31434c52  /* "RLC1" */
+#define RULES_VERSION   3
+#define RULES_MAX_DISP  (1 << 20)
+#define TABLE_MAX_WORK  (1 << 22)   /* Cells times rules */
+#define NO_RULE         UINT32_MAX
+
+/* Status operators */
+#define ST_ANY      0
+#define ST_OK       1
+#define ST_FAIL     2
+#define ST_EQ       3
+#define ST_NE       4
+
+/* Duration operators */
+#define DUR_ANY     0
+#define DUR_GT      1
+#define DUR_LT      2
+
+/* Rule flags */
+#define RULE_SUPPRESS   0x01
+#define RULE_TIMEOUT    0x02
+
+static const char *urgencies[] = { NULL, "low", "normal", "critical" };
+
+/*
+ * A parsed rule.
+ */
+struct crule {
+    int32_t status;
+    int32_t timeout;
+    uint8_t status_op;
+    uint8_t dur_op;
+    uint8_t urgency;        /* Index into urgencies[] */
+    uint8_t flags;
+    uint64_t dur_ms;
+};
+
+/*
+ * What a rule does, as kept in
+ * the cache.
+ */
+struct caction {
+    int32_t timeout;
+    uint8_t urgency;
+    uint8_t flags;
+    uint16_t pad;
+};
+
+/*
+ * The decision table of one key. Cell
+ * [s * (2 * ndurs + 1) + d] holds the index of
+ * the winning action or NO_RULE, where `s' is
+ * the index of the status in the sorted statuses
+ * (`nstatuses' if not there), and `d' is 2i + 1
+ * for a duration equal to the i-th threshold or
+ * 2i if i thresholds are below it.
+ */
+struct ctable {
+    uint32_t nstatuses;
+    uint32_t ndurs;
+    uint32_t statuses;      /* Index into the status table */
+    uint32_t durs;          /* Index into the threshold table */
+    uint32_t cells;         /* Index into the cell table */
+    uint32_t nconds;        /* 0 unless there are no cells */
+    uint32_t conds;         /* Index into the condition table */
+};
+
+/*
+ * A rule of a key without cells, checked
+ * at lookup.
+ */
+struct ccond {
+    uint64_t dur_ms;
+    int32_t status;
+    uint32_t rule;          /* Index into the action table */
+    uint8_t status_op;
+    uint8_t dur_op;
+    uint16_t pad[3];
+};
+
+/*
+ * A perfect hash table slot, one per key: a
+ * command basename, "*", or either followed
+ * by a NUL and a first argument.
+ */
+struct cslot {
+    uint32_t key_off;       /* 0 if empty */
+    uint32_t key_len;
+    uint32_t table;
+    uint32_t pad;
+};
+
+/*
+ * Cache file header, every offset
+ * is from the start of the file.
+ */
+struct rules_hdr {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t src_mtime_ns;
+    uint64_t src_size;
+    uint64_t src_ino;
+    uint64_t size;
+    uint32_t nbuckets;
+    uint32_t nslots;
+    uint32_t nrules;
+    uint32_t ntables;
+    uint32_t disp_off;
+    uint32_t slots_off;
+    uint32_t durs_off;
+    uint32_t conds_off;
+    uint32_t tables_off;
+    uint32_t actions_off;
+    uint32_t statuses_off;
+    uint32_t cells_off;
+    uint32_t strings_off;
+};
+
+/*
+ * Rule being compiled, one per command
+ * name it applies to, in file order.
+ */
+struct prule {
+    char *name;             /* "*" for any command */
+    char *arg;              /* NULL for any */
+    struct crule r;
+};
+
+/*
+ * Key being compiled, `len' bytes
+ * at `p' as in struct cslot.
+ */
+struct pkey {
+    char *p;
+    uint32_t len;
+};
+
+/*
+ * Growable buffer used while
+ * compiling.
+ */
+struct buf {
+    char *p;
+    size_t len;
+    size_t cap;
+};
+
+static uint32_t
+buf_add(struct buf *b, const void *p, size_t len)
+{
+    uint32_t off = b->len;
+
+    while (b->len + len > b->cap) {
+        b->cap = b->cap ? b->cap * 2 : 256;
+        b->p = realloc(b->p, b->cap);
+    }
+    memcpy(b->p + b->len, p, len);
+    b->len += len;
+    return off;
+}
+
+static uint64_t
+name_hash(const char *name, size_t len, uint32_t disp)
+{
+    return hash_bytes(name, len, HASH_INIT ^ (disp * 0x9e3779b97f4a7c15ULL));
+}
+
+/*
+ * Parses a duration such as "30m",
+ * returns it in milliseconds.
+ */
+static uint64_t
+parse_duration(const char *s)
+{
+    char *end;
+    uint64_t val = strtoull(s, &end, 10);
+
+    switch (*end) {
+    case 'h':
+        return val * 3600000ULL;
+    case 'm':
+        return val * 60000ULL;
+    default:
+        return val * 1000ULL;
+    }
+}
+
+/*
+ * Parses the fields of one rule into `r'.
+ *
+ * Returns 0 on success, otherwise -1.
+ */
+static int
+parse_rule(char **fields, int nfields, struct crule *r)
+{
+    const char *st = fields[1], *dur = fields[2];
+
+    memset(r, 0, sizeof(*r));
+
+    if (strcmp(st, "*") == 0) {
+        r->status_op = ST_ANY;
+    } else if (strcmp(st, "ok") == 0) {
+        r->status_op = ST_OK;
+    } else if (strcmp(st, "fail") == 0) {
+        r->status_op = ST_FAIL;
+    } else if (st[0] == '!') {
+        r->status_op = ST_NE;
+        r->status = atoi(st + 1);
+    } else if (st[0] >= '0' && st[0] <= '9') {
+        r->status_op = ST_EQ;
+        r->status = atoi(st);
+    } else {
+        return -1;
+    }
+
+    if (strcmp(dur, "*") == 0) {
+        r->dur_op = DUR_ANY;
+    } else if (dur[0] == '>' || dur[0] == '<') {
+        r->dur_op = dur[0] == '>' ? DUR_GT : DUR_LT;
+        r->dur_ms = parse_duration(dur + 1);
+    } else {
+        return -1;
+    }
+
+    for (int i = 3; i < nfields; ++i) {
+        if (strcmp(fields[i], "suppress") == 0) {
+            r->flags |= RULE_SUPPRESS;
+        } else if (strncmp(fields[i], "timeout=", 8) == 0) {
+            r->flags |= RULE_TIMEOUT;
+            r->timeout = atoi(fields[i] + 8);
+        } else if (strncmp(fields[i], "urgency=", 8) == 0) {
+            for (size_t u = 1; u < sizeof(urgencies) / sizeof(*urgencies); ++u) {
+                if (strcmp(fields[i] + 8, urgencies[u]) == 0) {
+                    r->urgency = u;
+                }
+            }
+            if (r->urgency == 0) {
+                return -1;
+            }
+        } else {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Builds the key for `name' and `arg' (may
+ * be NULL) into `k'.
+ */
+static void
+key_make(struct pkey *k, const char *name, const char *arg)
+{
+    size_t nlen = strlen(name), alen = arg != NULL ? strlen(arg) + 1 : 0;
+
+    k->len = nlen + alen;
+    k->p = malloc(k->len + 1);
+    memcpy(k->p, name, nlen + 1);
+    if (arg != NULL) {
+        memcpy(k->p + nlen + 1, arg, alen);
+    }
+}
+
+static int
+key_cmp(const void *a, const void *b)
+{
+    const struct pkey *ka = a, *kb = b;
+    int c = memcmp(ka->p, kb->p, ka->len < kb->len ? ka->len : kb->len);
+
+    if (c != 0) {
+        return c;
+    }
+    return ka->len < kb->len ? -1 : ka->len > kb->len;
+}
+
+static int
+u64_cmp(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static int
+i32_cmp(const void *a, const void *b)
+{
+    int32_t x = *(const int32_t *)a, y = *(const int32_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Sorts the `n' elements of `size' bytes
+ * at `p' and drops duplicates.
+ *
+ * Returns the number left.
+ */
+static size_t
+sort_unique(void *p, size_t n, size_t size,
+            int (*cmp)(const void *, const void *))
+{
+    char *base = p;
+    size_t out = 0;
+
+    qsort(base, n, size, cmp);
+    for (size_t i = 0; i < n; ++i) {
+        if (out == 0 || cmp(base + (out - 1) * size, base + i * size) != 0) {
+            memmove(base + out * size, base + i * size, size);
+            ++out;
+        }
+    }
+    return out;
+}
+
+/*
+ * Builds the perfect hash table for the `nkeys'
+ * distinct keys in `keys', filling `disp' and
+ * `slot_of' (the slot of each key).
+ *
+ * Returns 0 on success, -1 if no displacement
+ * could be found for some bucket.
+ */
+static int
+build_phash(const struct pkey *keys, uint32_t nkeys, uint32_t nbuckets,
+            uint32_t nslots, uint32_t *disp, uint32_t *slot_of)
+{
+    uint32_t *bucket_of = malloc(nkeys * sizeof(uint32_t));
+    uint32_t *bsize = calloc(nbuckets, sizeof(uint32_t));
+    uint32_t *order = malloc(nbuckets * sizeof(uint32_t));
+    uint8_t *used = calloc(nslots, 1);
+    uint32_t b, d, k, tmp;
+    int ret = 0;
+
+    for (k = 0; k < nkeys; ++k) {
+        bucket_of[k] = name_hash(keys[k].p, keys[k].len, 0) % nbuckets;
+        ++bsize[bucket_of[k]];
+    }
+
+    /* Place the biggest buckets first */
+    for (b = 0; b < nbuckets; ++b) {
+        order[b] = b;
+    }
+    for (b = 1; b < nbuckets; ++b) {
+        tmp = order[b];
+        for (d = b; d > 0 && bsize[order[d - 1]] < bsize[tmp]; --d) {
+            order[d] = order[d - 1];
+        }
+        order[d] = tmp;
+    }
+
+    for (uint32_t i = 0; i < nbuckets && bsize[order[i]] > 0; ++i) {
+        b = order[i];
+        for (d = 1; d < RULES_MAX_DISP; ++d) {
+            /* Try to place every key of this bucket */
+            for (k = 0; k < nkeys; ++k) {
+                if (bucket_of[k] != b) {
+                    continue;
+                }
+                slot_of[k] = name_hash(keys[k].p, keys[k].len, d) % nslots;
+                if (used[slot_of[k]]) {
+                    break;
+                }
+                used[slot_of[k]] = 2;
+            }
+
+            /* Undo the tentative placements */
+            for (uint32_t j = 0; j < nkeys; ++j) {
+                if (bucket_of[j] == b && used[slot_of[j]] == 2) {
+                    used[slot_of[j]] = 0;
+                }
+            }
+
+            if (k == nkeys) {
+                break;
+            }
+        }
+
+        if (d == RULES_MAX_DISP) {
+            ret = -1;
+            break;
+        }
+
+        disp[b] = d;
+        for (k = 0; k < nkeys; ++k) {
+            if (bucket_of[k] == b) {
+                used[slot_of[k]] = 1;
+            }
+        }
+    }
+
+    free(bucket_of);
+    free(bsize);
+    free(order);
+    free(used);
+    return ret;
+}
+
+/*
+ * Returns true if `r' matches a status of
+ * class `s' (`nst' for none of `st') and a
+ * duration of class `d' of the `ndur'
+ * thresholds in `dur'.
+ */
+static bool
+cell_matches(const struct crule *r, const int32_t *st, uint32_t nst,
+             uint32_t s, const uint64_t *dur, uint32_t ndur, uint32_t d)
+{
+    double rep;
+
+    /* Any other status is a failure no rule names */
+    switch (r->status_op) {
+    case ST_OK:
+        if (s == nst || st[s] != 0) {
+            return false;
+        }
+        break;
+    case ST_FAIL:
+        if (s < nst && st[s] == 0) {
+            return false;
+        }
+        break;
+    case ST_EQ:
+        if (s == nst || st[s] != r->status) {
+            return false;
+        }
+        break;
+    case ST_NE:
+        if (s < nst && st[s] == r->status) {
+            return false;
+        }
+        break;
+    }
+
+    if (r->dur_op == DUR_ANY) {
+        return true;
+    }
+
+    /* A threshold, or a duration between two */
+    if (d % 2 == 1) {
+        rep = dur[d / 2];
+    } else if (d == 0) {
+        rep = dur[0] - 0.5;
+    } else if (d / 2 == ndur) {
+        rep = dur[ndur - 1] + 0.5;
+    } else {
+        rep = (dur[d / 2 - 1] + dur[d / 2]) / 2.0;
+    }
+
+    if (r->dur_op == DUR_GT) {
+        return rep > r->dur_ms;
+    }
+    return rep < r->dur_ms;
+}
+
+/*
+ * Returns true if the rule `p' belongs to the
+ * key for `name' and `arg' (may be NULL).
+ */
+static bool
+rule_in_key(const struct prule *p, const char *name, const char *arg)
+{
+    if (strcmp(p->name, name) != 0) {
+        return false;
+    }
+    if (p->arg == NULL || arg == NULL) {
+        return p->arg == arg;
+    }
+    return strcmp(p->arg, arg) == 0;
+}
+
+/*
+ * Builds the decision table of the key `k'
+ * from the `nrules' rules in `rules', or its
+ * list of conditions if the table is too big.
+ */
+static void
+build_table(const struct pkey *k, const struct prule *rules, uint32_t nrules,
+            struct ctable *t, struct buf *statuses, struct buf *durs,
+            struct buf *cells, struct buf *conds)
+{
+    const char *name = k->p;
+    const char *arg = strlen(name) < k->len ? name + strlen(name) + 1 : NULL;
+    uint32_t *sel = malloc((nrules + 1) * sizeof(uint32_t));
+    int32_t *st = malloc((nrules + 1) * sizeof(int32_t));
+    uint64_t *dur = malloc((nrules + 1) * sizeof(uint64_t));
+    uint32_t nsel = 0, nst = 0, ndur = 0, cell;
+    struct ccond c;
+
+    /* 0 always has its own class, for "ok" and "fail" */
+    st[nst++] = 0;
+    for (uint32_t i = 0; i < nrules; ++i) {
+        if (!rule_in_key(&rules[i], name, arg)) {
+            continue;
+        }
+        sel[nsel++] = i;
+        if (rules[i].r.status_op == ST_EQ || rules[i].r.status_op == ST_NE) {
+            st[nst++] = rules[i].r.status;
+        }
+        if (rules[i].r.dur_op != DUR_ANY) {
+            dur[ndur++] = rules[i].r.dur_ms;
+        }
+    }
+    nst = sort_unique(st, nst, sizeof(*st), i32_cmp);
+    ndur = sort_unique(dur, ndur, sizeof(*dur), u64_cmp);
+
+    memset(t, 0, sizeof(*t));
+    t->conds = conds->len / sizeof(c);
+    if ((uint64_t)(nst + 1) * (2 * ndur + 1) * nsel > TABLE_MAX_WORK) {
+        memset(&c, 0, sizeof(c));
+        for (uint32_t i = 0; i < nsel; ++i) {
+            c.dur_ms = rules[sel[i]].r.dur_ms;
+            c.status = rules[sel[i]].r.status;
+            c.rule = sel[i];
+            c.status_op = rules[sel[i]].r.status_op;
+            c.dur_op = rules[sel[i]].r.dur_op;
+            buf_add(conds, &c, sizeof(c));
+        }
+        t->nconds = nsel;
+        free(sel);
+        free(st);
+        free(dur);
+        return;
+    }
+
+    t->nstatuses = nst;
+    t->ndurs = ndur;
+    t->statuses = buf_add(statuses, st, nst * sizeof(*st)) / sizeof(*st);
+    t->durs = durs->len / sizeof(*dur);
+    if (ndur > 0) {
+        buf_add(durs, dur, ndur * sizeof(*dur));
+    }
+    t->cells = cells->len / sizeof(uint32_t);
+
+    /* The first rule in file order wins each cell */
+    for (uint32_t s = 0; s <= nst; ++s) {
+        for (uint32_t d = 0; d <= 2 * ndur; ++d) {
+            cell = NO_RULE;
+            for (uint32_t i = 0; i < nsel; ++i) {
+                if (cell_matches(&rules[sel[i]].r, st, nst, s, dur, ndur, d)) {
+                    cell = sel[i];
+                    break;
+                }
+            }
+            buf_add(cells, &cell, sizeof(cell));
+        }
+    }
+
+    free(sel);
+    free(st);
+    free(dur);
+}
+
+/*
+ * Sorts the `n' keys in `keys' and drops
+ * duplicates, returns the number left.
+ */
+static uint32_t
+keys_unique(struct pkey *keys, uint32_t n)
+{
+    uint32_t out = 0;
+
+    qsort(keys, n, sizeof(*keys), key_cmp);
+    for (uint32_t i = 0; i < n; ++i) {
+        if (out > 0 && key_cmp(&keys[out - 1], &keys[i]) == 0) {
+            free(keys[i].p);
+            continue;
+        }
+        keys[out++] = keys[i];
+    }
+    return out;
+}
+
+/*
+ * Collects the keys of the `nrules' rules in
+ * `rules' (name and first argument, if any).
+ *
+ * Returns the number of keys in `*keysp'.
+ */
+static uint32_t
+collect_keys(const struct prule *rules, uint32_t nrules, struct pkey **keysp)
+{
+    struct pkey *keys = malloc((nrules + 1) * sizeof(*keys));
+
+    for (uint32_t i = 0; i < nrules; ++i) {
+        key_make(&keys[i], rules[i].name, rules[i].arg);
+    }
+    *keysp = keys;
+    return keys_unique(keys, nrules);
+}
+
+/*
+ * Reads the rules file at `src' into `*rulesp',
+ * one rule per command name.
+ *
+ * Returns the number of rules, or -1 if the
+ * file cannot be read.
+ */
+static long
+rules_parse(const char *src, struct prule **rulesp)
+{
+    struct prule *rules = NULL;
+    size_t nrules = 0, cap = 0;
+    char line[1024], *fields[16], *save, *name, *nsave, *arg;
+    struct crule r;
+    int nfields, lineno = 0;
+    FILE *fp;
+
+    if ((fp = fopen(src, "re")) == NULL) {
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        ++lineno;
+        line[strcspn(line, "#\n")] = '\0';
+
+        nfields = 0;
+        for (char *tok = strtok_r(line, " \t", &save); tok != NULL &&
+             nfields < 16; tok = strtok_r(NULL, " \t", &save)) {
+            fields[nfields++] = tok;
+        }
+
+        if (nfields == 0) {
+            continue;
+        }
+
+        if (nfields < 3 || parse_rule(fields, nfields, &r) < 0) {
+            fprintf(stderr, "cmdnotify: %s:%d: bad rule\n", src, lineno);
+            continue;
+        }
+
+        /* Each name gets its own copy of the rule */
+        for (name = strtok_r(fields[0], ",", &nsave); name != NULL;
+             name = strtok_r(NULL, ",", &nsave)) {
+            if ((arg = strchr(name, ':')) != NULL) {
+                *arg++ = '\0';
+            }
+
+            if (nrules == cap) {
+                cap = cap ? cap * 2 : 16;
+                rules = realloc(rules, cap * sizeof(*rules));
+            }
+            rules[nrules].name = strdup(name);
+            rules[nrules].arg = arg != NULL ? strdup(arg) : NULL;
+            rules[nrules++].r = r;
+        }
+    }
+    fclose(fp);
+
+    *rulesp = rules;
+    return nrules;
+}
+
+/*
+ * Compiles the rules file at `src' into a cache
+ * image, returns it (malloc'd) or NULL on failure.
+ */
+static struct rules_hdr *
+rules_compile(const char *src, const struct stat *sb)
+{
+    struct buf actions = {0}, tables = {0}, statuses = {0}, durs = {0};
+    struct buf cells = {0}, conds = {0}, strings = {0};
+    struct prule *rules = NULL;
+    struct pkey *keys;
+    struct rules_hdr hdr = {0}, *img;
+    struct cslot *slots;
+    struct caction a = {0};
+    struct ctable t;
+    uint32_t nkeys, *disp, *slot_of, k;
+    long nrules;
+
+    if ((nrules = rules_parse(src, &rules)) < 0) {
+        return NULL;
+    }
+
+    for (long i = 0; i < nrules; ++i) {
+        a.timeout = rules[i].r.timeout;
+        a.urgency = rules[i].r.urgency;
+        a.flags = rules[i].r.flags;
+        buf_add(&actions, &a, sizeof(a));
+    }
+
+    nkeys = collect_keys(rules, nrules, &keys);
+    hdr.nbuckets = nkeys / 4 + 1;
+    hdr.nslots = nkeys + nkeys / 4 + 1;
+    disp = calloc(hdr.nbuckets, sizeof(uint32_t));
+    slot_of = calloc(nkeys + 1, sizeof(uint32_t));
+
+    while (build_phash(keys, nkeys, hdr.nbuckets, hdr.nslots, disp, slot_of) < 0) {
+        hdr.nslots *= 2;
+        memset(disp, 0, hdr.nbuckets * sizeof(uint32_t));
+    }
+
+    /* Offset 0 of the string table means "none" */
+    buf_add(&strings, "", 1);
+    slots = calloc(hdr.nslots, sizeof(*slots));
+    for (k = 0; k < nkeys; ++k) {
+        build_table(&keys[k], rules, nrules, &t, &statuses, &durs, &cells,
+                    &conds);
+        slots[slot_of[k]].key_len = keys[k].len;
+        slots[slot_of[k]].key_off = buf_add(&strings, keys[k].p, keys[k].len + 1);
+        slots[slot_of[k]].table = buf_add(&tables, &t, sizeof(t)) / sizeof(t);
+    }
+
+    /* Lay out the image, 8 byte fields first */
+    hdr.magic = RULES_MAGIC;
+    hdr.version = RULES_VERSION;
+    hdr.src_mtime_ns = sb->st_mtim.tv_sec * 1000000000ULL + sb->st_mtim.tv_nsec;
+    hdr.src_size = sb->st_size;
+    hdr.src_ino = sb->st_ino;
+    hdr.nrules = nrules;
+    hdr.ntables = nkeys;
+    hdr.durs_off = sizeof(hdr);
+    hdr.conds_off = hdr.durs_off + durs.len;
+    hdr.disp_off = hdr.conds_off + conds.len;
+    hdr.slots_off = hdr.disp_off + hdr.nbuckets * sizeof(uint32_t);
+    hdr.tables_off = hdr.slots_off + hdr.nslots * sizeof(struct cslot);
+    hdr.actions_off = hdr.tables_off + tables.len;
+    hdr.statuses_off = hdr.actions_off + actions.len;
+    hdr.cells_off = hdr.statuses_off + statuses.len;
+    hdr.strings_off = hdr.cells_off + cells.len;
+    hdr.size = hdr.strings_off + strings.len;
+
+    img = calloc(1, hdr.size);
+    memcpy(img, &hdr, sizeof(hdr));
+    memcpy((char *)img + hdr.disp_off, disp, hdr.nbuckets * sizeof(uint32_t));
+    memcpy((char *)img + hdr.slots_off, slots, hdr.nslots * sizeof(struct cslot));
+    if (nrules > 0) {
+        memcpy((char *)img + hdr.actions_off, actions.p, actions.len);
+        memcpy((char *)img + hdr.tables_off, tables.p, tables.len);
+        memcpy((char *)img + hdr.statuses_off, statuses.p, statuses.len);
+        memcpy((char *)img + hdr.cells_off, cells.p, cells.len);
+    }
+    if (durs.len > 0) {
+        memcpy((char *)img + hdr.durs_off, durs.p, durs.len);
+    }
+    if (conds.len > 0) {
+        memcpy((char *)img + hdr.conds_off, conds.p, conds.len);
+    }
+    memcpy((char *)img + hdr.strings_off, strings.p, strings.len);
+
+    for (long i = 0; i < nrules; ++i) {
+        free(rules[i].name);
+        free(rules[i].arg);
+    }
+    for (k = 0; k < nkeys; ++k) {
+        free(keys[k].p);
+    }
+    free(rules);
+    free(keys);
+    free(disp);
+    free(slot_of);
+    free(slots);
+    free(actions.p);
+    free(tables.p);
+    free(statuses.p);
+    free(durs.p);
+    free(cells.p);
+    free(conds.p);
+    free(strings.p);
+    return img;
+}
+
+/*
+ * Writes the compiled image `img' to
+ * the cache at `path'.
+ */
+static void
+rules_store(const char *path, const struct rules_hdr *img)
+{
+    char tmp[512];
+    int fd;
+
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+    if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) < 0) {
+        return;
+    }
+
+    if (write(fd, img, img->size) == (ssize_t)img->size) {
+        rename(tmp, path);
+    } else {
+        unlink(tmp);
+    }
+    close(fd);
+}
+
+/*
+ * Maps the cache at `path' if it was built
+ * from the rules file described by `sb'.
+ */
+static const struct rules_hdr *
+rules_load(const char *path, const struct stat *sb)
+{
+    const struct rules_hdr *hdr;
+    struct stat cb;
+    void *p;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+        return NULL;
+    }
+
+    if (fstat(fd, &cb) < 0 || cb.st_size < (off_t)sizeof(*hdr)) {
+        close(fd);
+        return NULL;
+    }
+
+    p = mmap(NULL, cb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        return NULL;
+    }
+
+    hdr = p;
+    if (hdr->magic != RULES_MAGIC || hdr->version != RULES_VERSION ||
+        hdr->size != (uint64_t)cb.st_size ||
+        hdr->src_mtime_ns != sb->st_mtim.tv_sec * 1000000000ULL + sb->st_mtim.tv_nsec ||
+        hdr->src_size != (uint64_t)sb->st_size ||
+        hdr->src_ino != (uint64_t)sb->st_ino) {
+        munmap(p, cb.st_size);
+        return NULL;
+    }
+
+    return hdr;
+}
+
+/*
+ * Returns the table of the key for `name' and
+ * `arg' (may be NULL), or NULL if there is none.
+ */
+static const struct ctable *
+table_find(const struct rules_hdr *hdr, const char *name, const char *arg)
+{
+    const uint32_t *disp = (const uint32_t *)((const char *)hdr + hdr->disp_off);
+    const char *strings = (const char *)hdr + hdr->strings_off;
+    const struct cslot *slot;
+    char key[512];
+    size_t nlen = strlen(name), len = nlen;
+
+    if (nlen >= sizeof(key)) {
+        return NULL;
+    }
+    memcpy(key, name, nlen + 1);
+    if (arg != NULL) {
+        len += strlen(arg) + 1;
+        if (len >= sizeof(key)) {
+            return NULL;
+        }
+        memcpy(key + nlen + 1, arg, len - nlen);
+    }
+
+    slot = (const struct cslot *)((const char *)hdr + hdr->slots_off);
+    slot += name_hash(key, len, disp[name_hash(key, len, 0) % hdr->nbuckets]) %
+            hdr->nslots;
+    if (slot->key_off == 0 || slot->key_len != len ||
+        memcmp(strings + slot->key_off, key, len) != 0) {
+        return NULL;
+    }
+    return (const struct ctable *)((const char *)hdr + hdr->tables_off) +
+           slot->table;
+}
+
+/*
+ * Returns the index of the first of the `n'
+ * conditions at `c' that `status' and `dur_ms'
+ * meet, or NO_RULE.
+ */
+static uint32_t
+conds_decide(const struct ccond *c, uint32_t n, int status, long long dur_ms)
+{
+    for (uint32_t i = 0; i < n; ++i, ++c) {
+        switch (c->status_op) {
+        case ST_OK:
+            if (status != 0) {
+                continue;
+            }
+            break;
+        case ST_FAIL:
+            if (status == 0) {
+                continue;
+            }
+            break;
+        case ST_EQ:
+            if (status != c->status) {
+                continue;
+            }
+            break;
+        case ST_NE:
+            if (status == c->status) {
+                continue;
+            }
+            break;
+        }
+
+        if ((c->dur_op == DUR_GT && dur_ms <= (long long)c->dur_ms) ||
+            (c->dur_op == DUR_LT && dur_ms >= (long long)c->dur_ms)) {
+            continue;
+        }
+        return c->rule;
+    }
+    return NO_RULE;
+}
+
+/*
+ * Returns the index of the rule `t' picks for
+ * `status' and `dur_ms', or NO_RULE.
+ */
+static uint32_t
+table_decide(const struct rules_hdr *hdr, const struct ctable *t,
+             int status, long long dur_ms)
+{
+    const int32_t *st = (const int32_t *)((const char *)hdr + hdr->statuses_off) +
+                        t->statuses;
+    const uint64_t *dur = (const uint64_t *)((const char *)hdr + hdr->durs_off) +
+                          t->durs;
+    const uint32_t *cells = (const uint32_t *)((const char *)hdr + hdr->cells_off) +
+                            t->cells;
+    uint32_t lo = 0, hi = t->nstatuses, mid, s, d;
+
+    if (t->nconds > 0) {
+        return conds_decide((const struct ccond *)((const char *)hdr +
+                            hdr->conds_off) + t->conds, t->nconds,
+                            status, dur_ms);
+    }
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (st[mid] < status) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    s = lo < t->nstatuses && st[lo] == status ? lo : t->nstatuses;
+
+    lo = 0;
+    hi = t->ndurs;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if ((long long)dur[mid] < dur_ms) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    d = lo < t->ndurs && (long long)dur[lo] == dur_ms ? 2 * lo + 1 : 2 * lo;
+
+    return cells[s * (2 * t->ndurs + 1) + d];
+}
+
+/*
+ * Decides what to do with the notification
+ * for the run in `ri', filling `act'.
+ */
+void
+rules_eval(const struct run_info *ri, struct rule_action *act)
+{
+    char src[256], cache[256];
+    const struct rules_hdr *hdr;
+    struct rules_hdr *img = NULL;
+    const struct ctable *t;
+    const struct caction *a;
+    const char *name, *arg = ri->argv[1], *kname, *karg;
+    long long dur_ms;
+    struct stat sb;
+    uint32_t idx, first = NO_RULE;
+
+    memset(act, 0, sizeof(*act));
+
+    if (xdg_path(XDG_CONFIG, RULES_FILE, src, sizeof(src)) < 0 ||
+        stat(src, &sb) < 0) {
+        return;
+    }
+
+    if (xdg_path(XDG_CACHE, RULES_CACHE, cache, sizeof(cache)) < 0) {
+        cache[0] = '\0';
+    }
+
+    if (cache[0] == '\0' || (hdr = rules_load(cache, &sb)) == NULL) {
+        if ((img = rules_compile(src, &sb)) == NULL) {
+            return;
+        }
+        if (cache[0] != '\0') {
+            rules_store(cache, img);
+        }
+        hdr = img;
+    }
+
+    if ((name = strrchr(ri->progname, '/')) != NULL) {
+        ++name;
+    } else {
+        name = ri->progname;
+    }
+
+    /* Each table has the first match of its own rules */
+    dur_ms = ts_diff_ns(&ri->mono_start, &ri->mono_end) / 1000000;
+    for (size_t i = 0; i < 4; ++i) {
+        kname = i < 2 ? name : "*";
+        karg = i % 2 == 0 ? arg : NULL;
+        if (i % 2 == 0 && arg == NULL) {
+            continue;
+        }
+        if ((t = table_find(hdr, kname, karg)) != NULL &&
+            (idx = table_decide(hdr, t, ri->status, dur_ms)) < first) {
+            first = idx;
+        }
+    }
+
+    if (first != NO_RULE) {
+        a = (const struct caction *)((const char *)hdr + hdr->actions_off) + first;
+        act->suppress = (a->flags & RULE_SUPPRESS) != 0;
+        act->urgency = urgencies[a->urgency];
+        act->has_timeout = (a->flags & RULE_TIMEOUT) != 0;
+        act->timeout = a->timeout;
+    }
+
+    if (img != NULL) {
+        free(img);
+    } else {
+        munmap((void *)hdr, hdr->size);
+    }
+}
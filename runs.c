@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Files kept per run of a program, e.g., its line
+ * timings, live in $XDG_STATE_HOME/cmdnotify/runs
+ * named after the run ID. The oldest runs are
+ * removed, all their files at once, when they take
+ * up more than RUNS_MAX_SIZE MiB.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "runs.h"
+#include "xdg.h"
+#include "config.h"
+
+#define RUNS_DIR    "runs"
+
+struct run_file {
+    char name[64];
+    size_t idlen;       /* Up to the extension */
+    struct timespec mtime;
+    off_t size;
+};
+
+/*
+ * A run's files, a range of them by name.
+ */
+struct run {
+    size_t first;
+    size_t nfiles;
+    struct timespec mtime;  /* Of the newest */
+    off_t size;
+};
+
+/*
+ * Creates the path of the file with the extension
+ * `ext' for the run `id', e.g., ".../runs/<id>.lz4".
+ *
+ * Returns 0 on success, otherwise -1.
+ */
+int
+runs_path(const char *id, const char *ext, char *buf, size_t len)
+{
+    char dir[256];
+    int n;
+
+    if (xdg_path(XDG_STATE, RUNS_DIR, dir, sizeof(dir)) < 0 ||
+        (mkdir(dir, 0700) < 0 && errno != EEXIST)) {
+        return -1;
+    }
+
+    n = snprintf(buf, len, "%s/%s%s", dir, id, ext);
+    return (n < 0 || (size_t)n >= len) ? -1 : 0;
+}
+
+/*
+ * Opens the runs directory for listing, files
+ * in it can be opened relative to its dirfd().
+ *
+ * Returns NULL if there is none.
+ */
+DIR *
+runs_opendir(void)
+{
+    char dir[256];
+
+    if (xdg_path(XDG_STATE, RUNS_DIR, dir, sizeof(dir)) < 0) {
+        return NULL;
+    }
+    return opendir(dir);
+}
+
+static int
+name_cmp(const void *a, const void *b)
+{
+    const struct run_file *fa = a, *fb = b;
+
+    return strcmp(fa->name, fb->name);
+}
+
+static int
+mtime_cmp(const void *a, const void *b)
+{
+    const struct run *ra = a, *rb = b;
+
+    if (ra->mtime.tv_sec != rb->mtime.tv_sec) {
+        return ra->mtime.tv_sec < rb->mtime.tv_sec ? -1 : 1;
+    }
+    if (ra->mtime.tv_nsec != rb->mtime.tv_nsec) {
+        return ra->mtime.tv_nsec < rb->mtime.tv_nsec ? -1 : 1;
+    }
+    return 0;
+}
+
+static bool
+time_after(const struct timespec *a, const struct timespec *b)
+{
+    return a->tv_sec != b->tv_sec ? a->tv_sec > b->tv_sec : a->tv_nsec > b->tv_nsec;
+}
+
+/*
+ * Removes the runs written to longest ago until
+ * what is left fits in RUNS_MAX_SIZE MiB. A run
+ * goes as a whole, its archive never outlives
+ * its index or the other way around.
+ */
+void
+runs_prune(void)
+{
+    const off_t max = (off_t)RUNS_MAX_SIZE << 20;
+    struct run_file *files = NULL, *tmp, *f;
+    struct run *runs = NULL, *r;
+    size_t nfiles = 0, nruns = 0, cap = 0;
+    struct dirent *d;
+    struct stat sb;
+    off_t total = 0;
+    char *dot;
+    DIR *dp;
+    int dfd;
+
+    if ((dp = runs_opendir()) == NULL) {
+        return;
+    }
+    dfd = dirfd(dp);
+
+    while ((d = readdir(dp)) != NULL) {
+        if (d->d_name[0] == '.' || strlen(d->d_name) >= sizeof(files->name) ||
+            fstatat(dfd, d->d_name, &sb, 0) < 0 || !S_ISREG(sb.st_mode)) {
+            continue;
+        }
+
+        if (nfiles == cap) {
+            cap = cap == 0 ? 64 : cap * 2;
+            if ((tmp = realloc(files, cap * sizeof(*files))) == NULL) {
+                break;
+            }
+            files = tmp;
+        }
+
+        f = &files[nfiles++];
+        strcpy(f->name, d->d_name);
+        dot = strchr(f->name, '.');
+        f->idlen = dot != NULL ? (size_t)(dot - f->name) : strlen(f->name);
+        f->mtime = sb.st_mtim;
+        f->size = sb.st_size;
+        total += sb.st_size;
+    }
+
+    if (total > max && (runs = malloc(nfiles * sizeof(*runs))) != NULL) {
+        /* A run's files are next to each other by name */
+        qsort(files, nfiles, sizeof(*files), name_cmp);
+        for (size_t i = 0; i < nfiles; ++i) {
+            const struct run_file *prev = i > 0 ? &files[i - 1] : NULL;
+
+            f = &files[i];
+            if (prev == NULL || f->idlen != prev->idlen ||
+                memcmp(f->name, prev->name, f->idlen) != 0) {
+                runs[nruns++] = (struct run){ .first = i, .mtime = f->mtime };
+            }
+            r = &runs[nruns - 1];
+            ++r->nfiles;
+            r->size += f->size;
+            if (time_after(&f->mtime, &r->mtime)) {
+                r->mtime = f->mtime;
+            }
+        }
+
+        qsort(runs, nruns, sizeof(*runs), mtime_cmp);
+        for (size_t i = 0; i < nruns && total > max; ++i) {
+            for (size_t j = 0; j < runs[i].nfiles; ++j) {
+                f = &files[runs[i].first + j];
+                if (unlinkat(dfd, f->name, 0) == 0) {
+                    total -= f->size;
+                }
+            }
+        }
+    }
+
+    free(runs);
+    free(files);
+    closedir(dp);
+}
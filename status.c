@@ -0,0 +1,391 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Table of the running cmdnotify processes in shared
+ * memory, for cmdnotify --ps and status bars. Each
+ * process claims a slot with a CAS on its owner and
+ * publishes updates through a seqlock, so readers
+ * take no locks and make no syscalls once the table
+ * is mapped. Slots of processes that died without
+ * giving theirs back are reclaimed after a pidfd
+ * liveness check.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "status.h"
+#include "procstat.h"
+#include "util.h"
+#include "config.h"
+
+#define STATUS_MAGIC    0x31545453U     /* "STT1" */
+#define READ_TRIES      1000
+
+static long long
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * Maps the status table, creating it
+ * if needed.
+ *
+ * Returns the table, or NULL on failure.
+ */
+static struct status_table *
+table_map(void)
+{
+    struct status_table *tab;
+    struct stat sb;
+    char path[64];
+    uint32_t magic = 0;
+    int fd;
+
+    snprintf(path, sizeof(path), "/dev/shm/cmdnotify-%u", (unsigned)getuid());
+    fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    /* Anyone can create files in /dev/shm */
+    if (fstat(fd, &sb) < 0 || sb.st_uid != getuid() || (sb.st_mode & 077) != 0 ||
+        (sb.st_size < (off_t)sizeof(*tab) && ftruncate(fd, sizeof(*tab)) < 0)) {
+        close(fd);
+        return NULL;
+    }
+
+    tab = mmap(NULL, sizeof(*tab), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (tab == MAP_FAILED) {
+        return NULL;
+    }
+
+    /* Zero filled is an empty table */
+    if (!atomic_compare_exchange_strong(&tab->magic, &magic, STATUS_MAGIC) &&
+        magic != STATUS_MAGIC) {
+        munmap(tab, sizeof(*tab));
+        return NULL;
+    }
+    return tab;
+}
+
+static void
+write_begin(struct status_slot *s)
+{
+    uint32_t seq = atomic_load_explicit(&s->seq, memory_order_relaxed);
+
+    /* Still odd if its last owner died halfway */
+    atomic_store_explicit(&s->seq, seq | 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static void
+write_end(struct status_slot *s)
+{
+    uint32_t seq = atomic_load_explicit(&s->seq, memory_order_relaxed);
+
+    atomic_store_explicit(&s->seq, seq + 1, memory_order_release);
+}
+
+/*
+ * Copies `s' to `copy' while it is not
+ * being written.
+ *
+ * Returns false if its writer seems to
+ * have died halfway.
+ */
+static bool
+slot_read(struct status_slot *s, struct status_slot *copy)
+{
+    uint32_t seq;
+
+    for (int i = 0; i < READ_TRIES; ++i) {
+        seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+        if (seq & 1) {
+            continue;
+        }
+
+        memcpy(copy, s, sizeof(*copy));
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&s->seq, memory_order_relaxed) == seq) {
+            copy->stage[sizeof(copy->stage) - 1] = '\0';
+            copy->cmd[sizeof(copy->cmd) - 1] = '\0';
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Empties a slot we own and gives it up.
+ */
+static void
+slot_release(struct status_slot *s)
+{
+    write_begin(s);
+    s->pid = 0;
+    s->cmd[0] = '\0';
+    write_end(s);
+    atomic_store_explicit(&s->owner, 0, memory_order_release);
+}
+
+/*
+ * Returns true if `pid' exited.
+ */
+static bool
+owner_dead(pid_t pid)
+{
+    int fd = syscall(SYS_pidfd_open, pid, 0);
+
+    if (fd >= 0) {
+        close(fd);
+        return false;
+    }
+    return errno == ESRCH;
+}
+
+/*
+ * Takes back the slots of owners that died
+ * without releasing them, e.g., when killed.
+ */
+static void
+table_sweep(struct status_table *tab)
+{
+    const uint32_t me = getpid();
+    struct status_slot *s;
+    uint32_t owner;
+
+    for (s = tab->slots; s < &tab->slots[STATUS_SLOTS]; ++s) {
+        owner = atomic_load_explicit(&s->owner, memory_order_acquire);
+        if (owner != 0 && owner != me && owner_dead(owner) &&
+            atomic_compare_exchange_strong(&s->owner, &owner, me)) {
+            slot_release(s);
+        }
+    }
+}
+
+/*
+ * Claims a slot for `argv' being run, it
+ * shows once status_attach() is called.
+ *
+ * Returns 0 on success, otherwise -1.
+ */
+int
+status_begin(struct status *st, char **argv)
+{
+    struct status_slot *s;
+    uint32_t owner;
+    size_t off = 0;
+
+    memset(st, 0, sizeof(*st));
+    st->timerfd = -1;
+    if ((st->tab = table_map()) == NULL) {
+        return -1;
+    }
+
+    table_sweep(st->tab);
+    for (s = st->tab->slots; s < &st->tab->slots[STATUS_SLOTS]; ++s) {
+        owner = 0;
+        if (atomic_compare_exchange_strong(&s->owner, &owner, getpid())) {
+            st->slot = s;
+            break;
+        }
+    }
+
+    if (st->slot == NULL || (st->timerfd = timer_create_fd()) < 0) {
+        status_end(st);
+        return -1;
+    }
+    s = st->slot;
+
+    /* Not shown until attached */
+    write_begin(s);
+    s->pid = 0;
+    s->progress = -1;
+    s->eta = -1;
+    s->cpu_permille = 0;
+    s->stage[0] = '\0';
+    for (; *argv != NULL && off < sizeof(s->cmd); ++argv) {
+        off += snprintf(s->cmd + off, sizeof(s->cmd) - off, "%s%s",
+                        off > 0 ? " " : "", *argv);
+    }
+    write_end(s);
+    return 0;
+}
+
+/*
+ * Updates our slot with the CPU usage of the
+ * program and its progress, if any.
+ */
+static void
+status_tick(struct ev_watch *w, uint32_t events)
+{
+    struct status *st = w->arg;
+    struct status_slot *s = st->slot;
+    struct proc_stat ps;
+    long long now = now_ns();
+    uint64_t exp;
+
+    (void)events;
+    read(st->timerfd, &exp, sizeof(exp));
+
+    write_begin(s);
+    if (proc_stat(st->pid, &ps) == 0) {
+        s->cpu_permille = (ps.cpu_ns - st->last_cpu_ns) * 1000 / (now - st->last_ns);
+        st->last_cpu_ns = ps.cpu_ns;
+    }
+    if (st->prog != NULL) {
+        s->progress = st->prog->percent;
+        s->eta = st->prog->eta;
+        memcpy(s->stage, st->prog->stage, sizeof(s->stage));
+    }
+    s->update_ns = now;
+    write_end(s);
+
+    st->last_ns = now;
+    timer_arm(st->timerfd, STATUS_INTERVAL * 1000000LL);
+}
+
+/*
+ * Shows the program running as `pid' in our
+ * slot, updated every STATUS_INTERVAL ms.
+ *
+ * @prog: Its progress, NULL if none.
+ */
+void
+status_attach(struct status *st, struct evloop *ev, pid_t pid,
+              const struct progress *prog)
+{
+    struct status_slot *s = st->slot;
+
+    if (s == NULL) {
+        return;
+    }
+
+    st->pid = pid;
+    st->prog = prog;
+    st->last_ns = now_ns();
+
+    write_begin(s);
+    s->pid = pid;
+    s->start_ns = s->update_ns = st->last_ns;
+    write_end(s);
+
+    st->w = (struct ev_watch){ .fd = st->timerfd, .fn = status_tick, .arg = st };
+    ev_add(ev, &st->w, EPOLLIN);
+    timer_arm(st->timerfd, STATUS_INTERVAL * 1000000LL);
+}
+
+void
+status_end(struct status *st)
+{
+    if (st->timerfd >= 0) {
+        close(st->timerfd);
+        st->timerfd = -1;
+    }
+    if (st->slot != NULL) {
+        slot_release(st->slot);
+        st->slot = NULL;
+    }
+    if (st->tab != NULL) {
+        munmap(st->tab, sizeof(*st->tab));
+        st->tab = NULL;
+    }
+}
+
+/*
+ * Lists the commands running under cmdnotify
+ * with their elapsed time, CPU usage and
+ * progress (cmdnotify --ps).
+ *
+ * Returns 0 on success, otherwise -1.
+ */
+int
+status_print(void)
+{
+    struct status_table *tab;
+    struct status_slot *s, copy;
+    char elapsed[32], eta[32], prog[64];
+    long long now;
+    size_t off;
+
+    if ((tab = table_map()) == NULL) {
+        perror("cmdnotify: /dev/shm");
+        return -1;
+    }
+
+    table_sweep(tab);
+    now = now_ns();
+    printf("%-8s %8s %5s  %-24s %s\n", "PID", "TIME", "CPU", "PROGRESS", "COMMAND");
+
+    for (s = tab->slots; s < &tab->slots[STATUS_SLOTS]; ++s) {
+        if (!slot_read(s, &copy) || copy.owner == 0 || copy.pid == 0) {
+            continue;
+        }
+
+        fmt_duration(elapsed, sizeof(elapsed), (now - copy.start_ns) / 1000000);
+        off = 0;
+        if (copy.progress >= 0) {
+            off = snprintf(prog, sizeof(prog), "%d%%", copy.progress);
+        }
+        if (copy.stage[0] != '\0' && off < sizeof(prog)) {
+            off += snprintf(prog + off, sizeof(prog) - off, "%s%s",
+                            off > 0 ? " " : "", copy.stage);
+        }
+        if (copy.eta >= 0 && off < sizeof(prog)) {
+            fmt_duration(eta, sizeof(eta), copy.eta * 1000LL);
+            off += snprintf(prog + off, sizeof(prog) - off, "%sETA %s",
+                            off > 0 ? " " : "", eta);
+        }
+        if (off == 0) {
+            snprintf(prog, sizeof(prog), "-");
+        }
+
+        printf("%-8d %8s %4u%%  %-24s %s\n", (int)copy.pid, elapsed,
+               (copy.cpu_permille + 5) / 10, prog, copy.cmd);
+    }
+
+    munmap(tab, sizeof(*tab));
+    return 0;
+}
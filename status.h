@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef STATUS_H
+#define STATUS_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "evloop.h"
+#include "progress.h"
+
+#define STATUS_SLOTS    64
+#define STATUS_CMD_MAX  152
+
+/*
+ * A running cmdnotify in the status table. Only
+ * `owner' writes it, in a seqlock: `seq' is odd
+ * while an update is in progress. `pid' is 0 in
+ * free slots and until the command started.
+ */
+struct status_slot {
+    _Atomic uint32_t owner;     /* PID of cmdnotify, 0 if free */
+    _Atomic uint32_t seq;
+    int32_t pid;                /* Of the command, 0 if none */
+    int32_t progress;           /* Percentage, -1 if unknown */
+    int64_t start_ns;           /* CLOCK_MONOTONIC */
+    int64_t update_ns;          /* Likewise */
+    uint32_t cpu_permille;      /* Since the last update, 1000 is one CPU */
+    int32_t eta;                /* Seconds, -1 if unknown */
+    char stage[PROGRESS_STAGE_MAX];
+    char cmd[STATUS_CMD_MAX];
+};
+
+/*
+ * The table shared by everyone, mapped
+ * from /dev/shm/cmdnotify-<uid>.
+ */
+struct status_table {
+    _Atomic uint32_t magic;
+    char pad[60];
+    struct status_slot slots[STATUS_SLOTS];
+};
+
+/*
+ * Our slot and what goes into it.
+ */
+struct status {
+    struct status_table *tab;
+    struct status_slot *slot;   /* NULL if none */
+    int timerfd;
+    struct ev_watch w;
+    pid_t pid;
+    const struct progress *prog;
+    long long last_ns;
+    unsigned long long last_cpu_ns;
+};
+
+int status_begin(struct status *st, char **argv);
+void status_attach(struct status *st, struct evloop *ev, pid_t pid,
+                   const struct progress *prog);
+void status_end(struct status *st);
+int status_print(void);
+
+#endif  /* !STATUS_H */
@@ -0,0 +1,270 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include "storm.h"
+#include "notify.h"
+#include "xdg.h"
+#include "config.h"
+
+#define STORM_FILE      "storm"
+#define STORM_MAGIC     0x53544f52
+#define STORM_ENTRIES   32
+#define STORM_NAME_MAX  48
+
+/* Token bucket is kept in thousandths of a token */
+#define TOKEN           1000LL
+
+/*
+ * A (command, status) event that recently
+ * caused a notification. Repeats within the
+ * window are counted instead of shown.
+ */
+struct storm_entry {
+    uint64_t hash;          /* 0 if free */
+    int32_t status;
+    uint32_t count;
+    int64_t first_ns;
+    uint32_t flushing;      /* A flusher owns this entry */
+    char name[STORM_NAME_MAX];
+};
+
+/*
+ * Shared between every cmdnotify process
+ * of this user, only touched under flock().
+ */
+struct storm_table {
+    uint32_t magic;
+    uint32_t overflow;          /* Events dropped by the rate limit */
+    uint32_t overflow_failed;
+    uint32_t overflow_flushing;
+    int64_t tokens;
+    int64_t refill_ns;
+    struct storm_entry ent[STORM_ENTRIES];
+};
+
+static int64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * Maps the storm table, returns NULL
+ * on failure.
+ */
+static struct storm_table *
+storm_map(int *fdp)
+{
+    return xdg_map(XDG_RUNTIME, STORM_FILE, sizeof(struct storm_table), fdp);
+}
+
+/*
+ * Sleeps until `deadline' (CLOCK_MONOTONIC, in ns)
+ * within a detached process, then shows the
+ * coalesced notification for entry `idx', or the
+ * overflow summary if `idx' is -1.
+ */
+static void
+storm_spawn_flusher(int idx, uint64_t hash, int64_t deadline)
+{
+    struct timespec ts = {
+        .tv_sec = deadline / 1000000000LL,
+        .tv_nsec = deadline % 1000000000LL
+    };
+    struct storm_table *st;
+    struct storm_entry *e;
+    char body[256];
+    struct notification n = { .summary = SUCCESS_SUMMARY, .body = body };
+    uint32_t count = 0, failed = 0;
+    int fd, devnull;
+
+    if (fork() != 0) {
+        return;
+    }
+
+    /* Don't hold on to the terminal or any pipes */
+    setsid();
+    if ((devnull = open("/dev/null", O_RDWR)) >= 0) {
+        dup2(devnull, STDIN_FILENO);
+        dup2(devnull, STDOUT_FILENO);
+        dup2(devnull, STDERR_FILENO);
+        close(devnull);
+    }
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0);
+    if ((st = storm_map(&fd)) == NULL) {
+        _exit(1);
+    }
+
+    flock(fd, LOCK_EX);
+    if (idx < 0) {
+        count = st->overflow;
+        failed = st->overflow_failed;
+        st->overflow = 0;
+        st->overflow_failed = 0;
+        st->overflow_flushing = 0;
+    } else if ((e = &st->ent[idx])->hash == hash) {
+        count = e->count;
+        failed = e->status;
+        snprintf(body, sizeof(body), "'%s' returned %d \xc3\x97%u",
+                 e->name, e->status, e->count);
+        n.key = e->hash;
+        e->hash = 0;
+        e->flushing = 0;
+    }
+    flock(fd, LOCK_UN);
+    xdg_unmap(st, sizeof(*st), fd);
+
+    if (idx < 0 && count > 0) {
+        snprintf(body, sizeof(body), "%u more commands finished, %u failed",
+                 count, failed);
+    }
+
+    if (failed != 0) {
+        n.summary = FAILURE_SUMMARY;
+    }
+
+    /* Only summarize if more than the first one was seen */
+    if ((idx < 0 && count > 0) || count > 1) {
+        notify(&n);
+    }
+    _exit(0);
+}
+
+/*
+ * Decides whether an event for `cmd' exiting
+ * with `status' may be shown now.
+ *
+ * @key: Command key, see argv_key().
+ *
+ * Repeats of a recently shown (command, status)
+ * are counted and later shown once as "xN" by
+ * a flusher. Events beyond the rate limit are
+ * folded into a trailing summary the same way.
+ *
+ * Returns true if the caller should notify.
+ */
+bool
+storm_admit(uint64_t key, const char *cmd, int status)
+{
+    struct storm_table *st;
+    struct storm_entry *e, *slot = NULL;
+    const int64_t window = STORM_WINDOW * 1000000LL;
+    int64_t now, deadline = 0;
+    uint64_t hash = key;
+    int flush_idx = -2;
+    bool admit = false;
+    int fd;
+
+    if ((st = storm_map(&fd)) == NULL) {
+        return true;
+    }
+
+    flock(fd, LOCK_EX);
+    now = now_ns();
+
+    if (st->magic != STORM_MAGIC) {
+        memset(st, 0, sizeof(*st));
+        st->magic = STORM_MAGIC;
+        st->tokens = STORM_BURST * TOKEN;
+        st->refill_ns = now;
+    }
+
+    /* Refill the token bucket */
+    st->tokens += (now - st->refill_ns) * STORM_RATE * TOKEN / 1000000000LL;
+    if (st->tokens > STORM_BURST * TOKEN) {
+        st->tokens = STORM_BURST * TOKEN;
+    }
+    st->refill_ns = now;
+
+    for (int i = 0; i < STORM_ENTRIES; ++i) {
+        e = &st->ent[i];
+        if (e->hash == hash && e->status == status &&
+            now - e->first_ns < window) {
+            /* Seen recently, count it */
+            ++e->count;
+            if (!e->flushing) {
+                e->flushing = 1;
+                flush_idx = i;
+                deadline = e->first_ns + window;
+            }
+            goto done;
+        }
+
+        if (slot == NULL && !e->flushing &&
+            (e->hash == 0 || now - e->first_ns >= window)) {
+            slot = e;
+        }
+    }
+
+    if (st->tokens < TOKEN) {
+        /* Over the rate limit, fold into the summary */
+        ++st->overflow;
+        if (status != 0) {
+            ++st->overflow_failed;
+        }
+        if (!st->overflow_flushing) {
+            st->overflow_flushing = 1;
+            flush_idx = -1;
+            deadline = now + window;
+        }
+        goto done;
+    }
+
+    st->tokens -= TOKEN;
+    admit = true;
+
+    if (slot != NULL) {
+        slot->hash = hash;
+        slot->status = status;
+        slot->count = 1;
+        slot->first_ns = now;
+        snprintf(slot->name, sizeof(slot->name), "%s", cmd);
+    }
+done:
+    flock(fd, LOCK_UN);
+    xdg_unmap(st, sizeof(*st), fd);
+
+    if (flush_idx != -2) {
+        storm_spawn_flusher(flush_idx, hash, deadline);
+    }
+    return admit;
+}
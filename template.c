@@ -0,0 +1,293 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Templates for the notification summary and body.
+ * Fields are written as {name}, a literal '{' as
+ * "{{". Templates are compiled once into a list of
+ * ops, so rendering is a walk over the ops writing
+ * into the caller's buffer with no allocation.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <signal.h>
+#include "template.h"
+#include "notify.h"
+#include "util.h"
+
+#define TMPL_LITERAL    0xff
+
+enum {
+    F_CMD,
+    F_ARGV,
+    F_STATUS,
+    F_SIGNAL,
+    F_DURATION,
+    F_MAXRSS,
+    F_CWD,
+    F_HOST,
+    F_TAIL,
+    F_GAPS,
+    F_ID,
+    F_ERRORS,
+    F_WARNINGS,
+    F_FIRST_ERROR,
+    F_RESULT
+};
+
+static const char *fields[] = {
+    [F_CMD] = "cmd",
+    [F_ARGV] = "argv",
+    [F_STATUS] = "status",
+    [F_SIGNAL] = "signal",
+    [F_DURATION] = "duration",
+    [F_MAXRSS] = "maxrss",
+    [F_CWD] = "cwd",
+    [F_HOST] = "host",
+    [F_TAIL] = "tail",
+    [F_GAPS] = "gaps",
+    [F_ID] = "id",
+    [F_ERRORS] = "errors",
+    [F_WARNINGS] = "warnings",
+    [F_FIRST_ERROR] = "first_error",
+    [F_RESULT] = "result"
+};
+
+static int
+tmpl_emit(struct tmpl *t, uint8_t field, uint32_t off, uint16_t len)
+{
+    struct tmpl_op *op;
+
+    if (field == TMPL_LITERAL && len == 0) {
+        return 0;
+    }
+
+    /* Merge with the previous literal if adjacent */
+    if (field == TMPL_LITERAL && t->nops > 0) {
+        op = &t->ops[t->nops - 1];
+        if (op->field == TMPL_LITERAL && op->off + op->len == off) {
+            op->len += len;
+            return 0;
+        }
+    }
+
+    if (t->nops == TMPL_MAX_OPS) {
+        return -1;
+    }
+
+    t->ops[t->nops++] = (struct tmpl_op){ .field = field, .off = off, .len = len };
+    return 0;
+}
+
+/*
+ * Compiles the template `src', which must
+ * outlive `t'.
+ *
+ * Returns 0 on success, otherwise -1.
+ */
+int
+tmpl_compile(struct tmpl *t, const char *src)
+{
+    const char *p = src, *lit = src, *end;
+    size_t i;
+
+    t->src = src;
+    t->nops = 0;
+
+    while ((p = strchr(p, '{')) != NULL) {
+        if (tmpl_emit(t, TMPL_LITERAL, lit - src, p - lit) < 0) {
+            return -1;
+        }
+
+        /* "{{" is a literal '{' */
+        if (p[1] == '{') {
+            if (tmpl_emit(t, TMPL_LITERAL, p - src, 1) < 0) {
+                return -1;
+            }
+            lit = p += 2;
+            continue;
+        }
+
+        if ((end = strchr(p, '}')) == NULL) {
+            return -1;
+        }
+
+        for (i = 0; i < sizeof(fields) / sizeof(*fields); ++i) {
+            if (strlen(fields[i]) == (size_t)(end - p - 1) &&
+                strncmp(fields[i], p + 1, end - p - 1) == 0) {
+                break;
+            }
+        }
+
+        if (i == sizeof(fields) / sizeof(*fields) ||
+            tmpl_emit(t, i, 0, 0) < 0) {
+            return -1;
+        }
+        lit = p = end + 1;
+    }
+
+    return tmpl_emit(t, TMPL_LITERAL, lit - src, strlen(lit));
+}
+
+/*
+ * Appends `len' bytes of `s' to `buf' at `off',
+ * returns the new offset.
+ */
+static size_t
+put(char *buf, size_t size, size_t off, const char *s, size_t len)
+{
+    if (len > size - 1 - off) {
+        len = size - 1 - off;
+    }
+    memcpy(buf + off, s, len);
+    return off + len;
+}
+
+static size_t
+put_int(char *buf, size_t size, size_t off, long long val)
+{
+    char tmp[24];
+    size_t n = 0;
+    bool neg = val < 0;
+
+    if (neg) {
+        val = -val;
+    }
+    do {
+        tmp[sizeof(tmp) - 1 - n++] = '0' + val % 10;
+        val /= 10;
+    } while (val > 0);
+    if (neg) {
+        tmp[sizeof(tmp) - 1 - n++] = '-';
+    }
+    return put(buf, size, off, tmp + sizeof(tmp) - n, n);
+}
+
+static size_t
+put_str(char *buf, size_t size, size_t off, const char *s)
+{
+    return s != NULL ? put(buf, size, off, s, strlen(s)) : off;
+}
+
+/*
+ * Renders the field `field' at `off'.
+ */
+static size_t
+put_field(char *buf, size_t size, size_t off, int field,
+          const struct tmpl_ctx *ctx)
+{
+    const struct run_info *ri = ctx->ri;
+    const char *abbrev;
+    char tmp[32];
+
+    switch (field) {
+    case F_CMD:
+        return put_str(buf, size, off, ri->progname);
+    case F_ARGV:
+        for (char **ap = ri->argv; *ap != NULL; ++ap) {
+            if (ap != ri->argv) {
+                off = put(buf, size, off, " ", 1);
+            }
+            off = put_str(buf, size, off, *ap);
+        }
+        return off;
+    case F_STATUS:
+        return put_int(buf, size, off, ri->status);
+    case F_SIGNAL:
+        if (ri->signo == 0 || (abbrev = sigabbrev_np(ri->signo)) == NULL) {
+            return off;
+        }
+        off = put(buf, size, off, "SIG", 3);
+        return put_str(buf, size, off, abbrev);
+    case F_DURATION:
+        return put(buf, size, off, tmp, fmt_duration(tmp, sizeof(tmp),
+                   ts_diff_ns(&ri->mono_start, &ri->mono_end) / 1000000));
+    case F_MAXRSS:
+        /* ru_maxrss is in KiB */
+        if (ri->rusage.ru_maxrss >= 1024) {
+            off = put_int(buf, size, off, ri->rusage.ru_maxrss >> 10);
+            return put(buf, size, off, " MiB", 4);
+        }
+        off = put_int(buf, size, off, ri->rusage.ru_maxrss);
+        return put(buf, size, off, " KiB", 4);
+    case F_CWD:
+        return put_str(buf, size, off, ctx->cwd);
+    case F_HOST:
+        return put_str(buf, size, off, ctx->host);
+    case F_TAIL:
+        return put_str(buf, size, off, ctx->tail);
+    case F_GAPS:
+        return put_str(buf, size, off, ctx->gaps);
+    case F_ID:
+        return put_str(buf, size, off, ri->id);
+    case F_ERRORS:
+        return put_int(buf, size, off, ctx->errors);
+    case F_WARNINGS:
+        return put_int(buf, size, off, ctx->warnings);
+    case F_FIRST_ERROR:
+        return put_str(buf, size, off, ctx->first_error);
+    case F_RESULT:
+        return put_str(buf, size, off, ri->status == 0 ?
+                       SUCCESS_SUMMARY : FAILURE_SUMMARY);
+    }
+    return off;
+}
+
+/*
+ * Renders `t' into `buf', truncating
+ * to fit `len' bytes.
+ *
+ * Returns the length of the result.
+ */
+size_t
+tmpl_render(const struct tmpl *t, const struct tmpl_ctx *ctx,
+            char *buf, size_t len)
+{
+    const struct tmpl_op *op;
+    size_t off = 0;
+
+    if (len == 0) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < t->nops; ++i) {
+        op = &t->ops[i];
+        if (op->field == TMPL_LITERAL) {
+            off = put(buf, len, off, t->src + op->off, op->len);
+        } else {
+            off = put_field(buf, len, off, op->field, ctx);
+        }
+    }
+
+    buf[off] = '\0';
+    return off;
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef TEMPLATE_H
+#define TEMPLATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "cmdnotify.h"
+
+#define TMPL_MAX_OPS    32
+
+/*
+ * A single template instruction, either a
+ * literal (a slice of the source) or a field.
+ */
+struct tmpl_op {
+    uint8_t field;          /* TMPL_LITERAL for literals */
+    uint16_t len;
+    uint32_t off;
+};
+
+/*
+ * A compiled template, e.g.,
+ * "'{cmd}' returned {status}".
+ */
+struct tmpl {
+    const char *src;
+    size_t nops;
+    struct tmpl_op ops[TMPL_MAX_OPS];
+};
+
+/*
+ * Values for the fields of a template,
+ * strings the caller looks up once.
+ */
+struct tmpl_ctx {
+    const struct run_info *ri;
+    const char *cwd;
+    const char *host;
+    const char *tail;       /* Tail of the output, may be NULL */
+    const char *gaps;       /* Longest pauses in it, may be NULL */
+    const char *first_error;    /* First error in it, may be NULL */
+    unsigned errors;
+    unsigned warnings;
+};
+
+int tmpl_compile(struct tmpl *t, const char *src);
+size_t tmpl_render(const struct tmpl *t, const struct tmpl_ctx *ctx,
+                   char *buf, size_t len);
+
+#endif  /* !TEMPLATE_H */
@@ -0,0 +1,533 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "trace.h"
+#include "xdg.h"
+#include "config.h"
+
+#define TRACEPARENT_LEN 55
+#define SPAN_BUFSIZE    4096
+#define SPAN_TAIL_RESERVE   128     /* For what follows the attributes */
+
+/*
+ * Simple append-only string buffer used
+ * to build the OTLP/JSON payload.
+ */
+struct strbuf {
+    char *p;
+    size_t len;
+    size_t cap;
+    bool overflow;      /* Something did not fit */
+};
+
+static void
+sb_printf(struct strbuf *sb, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void
+sb_printf(struct strbuf *sb, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    if (sb->overflow) {
+        return;
+    }
+
+    va_start(ap, fmt);
+    n = vsnprintf(sb->p + sb->len, sb->cap - sb->len, fmt, ap);
+    va_end(ap);
+
+    if (n < 0 || (size_t)n >= sb->cap - sb->len) {
+        sb->p[sb->len] = '\0';
+        sb->overflow = true;
+        return;
+    }
+    sb->len += n;
+}
+
+/*
+ * Appends `s' as a JSON string
+ * (with quotes).
+ */
+static void
+sb_json_str(struct strbuf *sb, const char *s)
+{
+    sb_printf(sb, "\"");
+    for (; *s != '\0'; ++s) {
+        unsigned char c = *s;
+
+        if (c == '"' || c == '\\') {
+            sb_printf(sb, "\\%c", c);
+        } else if (c < 0x20) {
+            sb_printf(sb, "\\u%04x", c);
+        } else {
+            sb_printf(sb, "%c", c);
+        }
+    }
+    sb_printf(sb, "\"");
+}
+
+static void
+sb_hex(struct strbuf *sb, const uint8_t *p, size_t len)
+{
+    for (size_t i = 0; i < len; ++i) {
+        sb_printf(sb, "%02x", p[i]);
+    }
+}
+
+/*
+ * Fills `p' with `len' random bytes for an ID.
+ * Without getrandom() or entropy this early,
+ * IDs only need to be unique and non-zero, so
+ * the time and PID are mixed instead.
+ */
+static void
+random_id(uint8_t *p, size_t len)
+{
+    static uint64_t state;
+    struct timespec ts;
+    uint64_t z = 0;
+
+    if (getrandom(p, len, GRND_NONBLOCK) == (ssize_t)len) {
+        return;
+    }
+
+    if (state == 0) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        state = (ts.tv_sec * 1000000000ULL + ts.tv_nsec) ^
+                (uint64_t)getpid() << 40;
+    }
+
+    /* splitmix64 */
+    for (size_t i = 0; i < len; ++i) {
+        if (i % 8 == 0) {
+            z = (state += 0x9e3779b97f4a7c15ULL);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            z ^= z >> 31;
+        }
+        p[i] = z >> (i % 8 * 8);
+    }
+}
+
+/*
+ * Parses `len' bytes of hex from `s'.
+ *
+ * Returns 0 on success, otherwise -1.
+ */
+static int
+parse_hex(const char *s, uint8_t *out, size_t len)
+{
+    unsigned int byte;
+
+    for (size_t i = 0; i < len; ++i) {
+        if (sscanf(s + i * 2, "%2x", &byte) != 1) {
+            return -1;
+        }
+        out[i] = byte;
+    }
+    return 0;
+}
+
+static bool
+is_zero(const uint8_t *p, size_t len)
+{
+    for (size_t i = 0; i < len; ++i) {
+        if (p[i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Parses an incoming TRACEPARENT of the form
+ * "00-<trace-id>-<parent-id>-<flags>".
+ *
+ * Returns 0 on success, otherwise -1.
+ */
+static int
+parse_traceparent(struct trace_ctx *tc, const char *tp)
+{
+    uint8_t flags;
+
+    if (strlen(tp) < TRACEPARENT_LEN || tp[2] != '-' ||
+        tp[35] != '-' || tp[52] != '-') {
+        return -1;
+    }
+
+    /* Version ff is invalid */
+    if (strncmp(tp, "ff", 2) == 0) {
+        return -1;
+    }
+
+    if (parse_hex(tp + 3, tc->trace_id, TRACE_ID_LEN) < 0 ||
+        parse_hex(tp + 36, tc->parent_id, SPAN_ID_LEN) < 0 ||
+        parse_hex(tp + 53, &flags, 1) < 0) {
+        return -1;
+    }
+
+    if (is_zero(tc->trace_id, TRACE_ID_LEN) ||
+        is_zero(tc->parent_id, SPAN_ID_LEN)) {
+        return -1;
+    }
+
+    tc->flags = flags;
+    return 0;
+}
+
+/*
+ * Starts a non-blocking connect to the collector
+ * at `url' which must be of the form
+ * "http://<numeric address>:<port>". Host names
+ * are refused so we never block on DNS.
+ *
+ * Returns the socket on success, otherwise -1.
+ */
+static int
+collector_connect(const char *url)
+{
+    struct sockaddr_storage ss = {0};
+    struct sockaddr_in *sin = (struct sockaddr_in *)&ss;
+    struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&ss;
+    char host[64];
+    const char *p, *colon;
+    socklen_t sslen;
+    int port, fd;
+
+    if (strncmp(url, "http://", 7) != 0) {
+        return -1;
+    }
+
+    p = url + 7;
+    if (*p == '[') {
+        /* IPv6, e.g., http://[::1]:4318 */
+        colon = strchr(p, ']');
+        if (colon == NULL || colon[1] != ':' || (size_t)(colon - p - 1) >= sizeof(host)) {
+            return -1;
+        }
+        memcpy(host, p + 1, colon - p - 1);
+        host[colon - p - 1] = '\0';
+        ++colon;
+    } else {
+        colon = strchr(p, ':');
+        if (colon == NULL || (size_t)(colon - p) >= sizeof(host)) {
+            return -1;
+        }
+        memcpy(host, p, colon - p);
+        host[colon - p] = '\0';
+    }
+
+    port = atoi(colon + 1);
+    if (port <= 0 || port > 65535) {
+        return -1;
+    }
+
+    if (inet_pton(AF_INET, host, &sin->sin_addr) == 1) {
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons(port);
+        sslen = sizeof(*sin);
+    } else if (inet_pton(AF_INET6, host, &sin6->sin6_addr) == 1) {
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = htons(port);
+        sslen = sizeof(*sin6);
+    } else {
+        fprintf(stderr, "cmdnotify: trace collector must be numeric\n");
+        return -1;
+    }
+
+    fd = socket(ss.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (connect(fd, (struct sockaddr *)&ss, sslen) < 0 &&
+        errno != EINPROGRESS) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/*
+ * Sets up the trace context for this run.
+ *
+ * Tracing is enabled by setting CMDNOTIFY_TRACE
+ * to "spool" (use the default spool file), an
+ * absolute path to a spool file, or the URL of an
+ * OTLP/HTTP collector, e.g., "http://127.0.0.1:4318".
+ *
+ * If enabled, TRACEPARENT is exported so the
+ * wrapped program (and any nested cmdnotify)
+ * joins our trace.
+ */
+void
+trace_begin(struct trace_ctx *tc)
+{
+    const char *cfg = getenv("CMDNOTIFY_TRACE");
+    const char *tp = getenv("TRACEPARENT");
+    char buf[TRACEPARENT_LEN + 1];
+
+    memset(tc, 0, sizeof(*tc));
+    tc->sockfd = -1;
+
+    /* Also names the run when tracing is off */
+    random_id(tc->span_id, SPAN_ID_LEN);
+
+    if (cfg == NULL || cfg[0] == '\0') {
+        return;
+    }
+
+    if (strcmp(cfg, "spool") == 0) {
+        if (xdg_path(XDG_RUNTIME, TRACE_SPOOL_NAME, tc->spoolbuf,
+                     sizeof(tc->spoolbuf)) < 0) {
+            return;
+        }
+        tc->spool = tc->spoolbuf;
+    } else if (cfg[0] == '/') {
+        tc->spool = cfg;
+    } else if ((tc->sockfd = collector_connect(cfg)) < 0) {
+        return;
+    }
+
+    tc->enabled = true;
+    tc->flags = 0x01;   /* Sampled */
+
+    if (tp != NULL && parse_traceparent(tc, tp) == 0) {
+        tc->has_parent = true;
+    } else {
+        random_id(tc->trace_id, TRACE_ID_LEN);
+    }
+
+    /* Export ourselves as the parent of the child */
+    snprintf(buf, sizeof(buf), "00-");
+    for (int i = 0; i < TRACE_ID_LEN; ++i) {
+        sprintf(buf + 3 + i * 2, "%02x", tc->trace_id[i]);
+    }
+    buf[35] = '-';
+    for (int i = 0; i < SPAN_ID_LEN; ++i) {
+        sprintf(buf + 36 + i * 2, "%02x", tc->span_id[i]);
+    }
+    sprintf(buf + 52, "-%02x", tc->flags);
+    setenv("TRACEPARENT", buf, 1);
+}
+
+static void
+sb_attr_str(struct strbuf *sb, const char *key, const char *val, bool comma)
+{
+    sb_printf(sb, "%s{\"key\":\"%s\",\"value\":{\"stringValue\":",
+              comma ? "," : "", key);
+    sb_json_str(sb, val);
+    sb_printf(sb, "}}");
+}
+
+static void
+sb_attr_int(struct strbuf *sb, const char *key, long long val, bool comma)
+{
+    sb_printf(sb, "%s{\"key\":\"%s\",\"value\":{\"intValue\":\"%lld\"}}",
+              comma ? "," : "", key, val);
+}
+
+static void
+sb_attr_double(struct strbuf *sb, const char *key, double val)
+{
+    sb_printf(sb, ",{\"key\":\"%s\",\"value\":{\"doubleValue\":%f}}",
+              key, val);
+}
+
+/*
+ * Builds the OTLP/JSON export request
+ * for the run described by `ri'.
+ */
+static void
+build_span(struct trace_ctx *tc, const struct run_info *ri, struct strbuf *sb)
+{
+    const struct rusage *ru = &ri->rusage;
+    char cmdline[1024] = {0};
+    size_t off = 0, mark;
+
+    for (char **ap = ri->argv; *ap != NULL && off < sizeof(cmdline) - 1; ++ap) {
+        off += snprintf(cmdline + off, sizeof(cmdline) - off, "%s%s",
+                        ap == ri->argv ? "" : " ", *ap);
+    }
+
+    sb_printf(sb, "{\"resourceSpans\":[{\"resource\":{\"attributes\":[");
+    sb_attr_str(sb, "service.name", "cmdnotify", false);
+    sb_printf(sb, "]},\"scopeSpans\":[{\"scope\":{\"name\":\"cmdnotify\"},"
+              "\"spans\":[{\"traceId\":\"");
+    sb_hex(sb, tc->trace_id, TRACE_ID_LEN);
+    sb_printf(sb, "\",\"spanId\":\"");
+    sb_hex(sb, tc->span_id, SPAN_ID_LEN);
+    sb_printf(sb, "\",");
+
+    if (tc->has_parent) {
+        sb_printf(sb, "\"parentSpanId\":\"");
+        sb_hex(sb, tc->parent_id, SPAN_ID_LEN);
+        sb_printf(sb, "\",");
+    }
+
+    sb_printf(sb, "\"name\":");
+    sb_json_str(sb, ri->progname);
+    sb_printf(sb, ",\"kind\":1,\"startTimeUnixNano\":\"%lld%09ld\","
+              "\"endTimeUnixNano\":\"%lld%09ld\",\"attributes\":[",
+              (long long)ri->start.tv_sec, ri->start.tv_nsec,
+              (long long)ri->end.tv_sec, ri->end.tv_nsec);
+
+    sb_attr_int(sb, "process.pid", ri->pid, false);
+    sb_attr_int(sb, "process.exit.code", ri->status, true);
+    if (ri->signo != 0) {
+        sb_attr_int(sb, "process.exit.signal", ri->signo, true);
+    }
+    sb_attr_double(sb, "process.cpu.time.user",
+                   ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6);
+    sb_attr_double(sb, "process.cpu.time.system",
+                   ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6);
+    sb_attr_int(sb, "process.memory.max_rss_kb", ru->ru_maxrss, true);
+    sb_attr_int(sb, "process.context_switches.voluntary", ru->ru_nvcsw,
+                true);
+    sb_attr_int(sb, "process.context_switches.involuntary", ru->ru_nivcsw,
+                true);
+    sb_attr_int(sb, "process.page_faults.major", ru->ru_majflt, true);
+
+    /*
+     * Escaped, a long command line may not fit.
+     * Leave it out then, keeping room for the
+     * status that closes the request.
+     */
+    mark = sb->len;
+    sb->cap -= SPAN_TAIL_RESERVE;
+    sb_attr_str(sb, "process.command_line", cmdline, true);
+    sb->cap += SPAN_TAIL_RESERVE;
+    if (sb->overflow) {
+        sb->len = mark;
+        sb->overflow = false;
+    }
+
+    if (ri->status == 0 && ri->signo == 0) {
+        sb_printf(sb, "],\"status\":{\"code\":1}}]}]}]}");
+    } else {
+        sb_printf(sb, "],\"status\":{\"code\":2,\"message\":\"exit %d\"}}]}]}]}",
+                  ri->status);
+    }
+}
+
+/*
+ * Sends the request in `sb' to the collector,
+ * waiting at most TRACE_SEND_TIMEOUT ms for the
+ * connection to complete. The response is not
+ * waited for.
+ */
+static void
+collector_send(int fd, const struct strbuf *sb)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+    char hdr[256];
+    int err = 0;
+    socklen_t errlen = sizeof(err);
+    int hdrlen;
+
+    if (poll(&pfd, 1, TRACE_SEND_TIMEOUT) != 1) {
+        return;
+    }
+
+    getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &errlen);
+    if (err != 0) {
+        return;
+    }
+
+    hdrlen = snprintf(hdr, sizeof(hdr),
+                      "POST /v1/traces HTTP/1.1\r\n"
+                      "Host: cmdnotify\r\n"
+                      "Content-Type: application/json\r\n"
+                      "Content-Length: %zu\r\n"
+                      "Connection: close\r\n\r\n", sb->len);
+
+    if (send(fd, hdr, hdrlen, MSG_NOSIGNAL | MSG_MORE) == hdrlen) {
+        send(fd, sb->p, sb->len, MSG_NOSIGNAL);
+    }
+    shutdown(fd, SHUT_WR);
+}
+
+/*
+ * Emits the span for the run described
+ * by `ri', if tracing is enabled.
+ */
+void
+trace_end(struct trace_ctx *tc, const struct run_info *ri)
+{
+    char buf[SPAN_BUFSIZE];
+    struct strbuf sb = { .p = buf, .cap = sizeof(buf) - 1 };
+    int fd;
+
+    if (!tc->enabled) {
+        return;
+    }
+
+    build_span(tc, ri, &sb);
+
+    /* Cut JSON is of no use to anyone */
+    if (sb.overflow) {
+        if (tc->sockfd >= 0) {
+            close(tc->sockfd);
+            tc->sockfd = -1;
+        }
+        return;
+    }
+
+    if (tc->sockfd >= 0) {
+        collector_send(tc->sockfd, &sb);
+        close(tc->sockfd);
+        tc->sockfd = -1;
+        return;
+    }
+
+    /* One span per line, a single write keeps lines intact */
+    buf[sb.len++] = '\n';
+    fd = open(tc->spool, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return;
+    }
+    write(fd, buf, sb.len);
+    close(fd);
+}
@@ -0,0 +1,643 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Notifies when the program prints one of the
+ * patterns in $XDG_CONFIG_HOME/cmdnotify/triggers
+ * while its output is captured (-T or -P). Each
+ * line holds a cooldown and a pattern:
+ *
+ *      # cooldown  pattern
+ *      30s         error:
+ *      1h          Listening on
+ *      -           FAILED
+ *
+ * cooldown: Time between notifications for the same
+ *           pattern as a number with an optional unit
+ *           (s, m or h), or "-" for TRIGGER_COOLDOWN.
+ * pattern:  The rest of the line, matched as is.
+ *
+ * Output is scanned as it arrives with an
+ * Aho-Corasick automaton, its state carried over
+ * between reads. While the automaton is at its root,
+ * it skips ahead to the next pair of bytes a pattern
+ * starts with, comparing 16 or 32 positions at once
+ * with SSE2 or AVX2 (by nibble lookups with many
+ * patterns), and only leaves the root where the
+ * first few bytes hash like a pattern's.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif  /* __SSE2__ */
+#include "triggers.h"
+#include "notify.h"
+#include "util.h"
+#include "xdg.h"
+#include "config.h"
+
+#define TRIGGERS_FILE   "triggers"
+#define LINE_CONTEXT    160
+#define PAIRS_COMPARE   4       /* Pairs compared one by one, at most */
+
+static long long
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * Parses a cooldown such as "30s",
+ * returns it in nanoseconds.
+ */
+static long long
+parse_cooldown(const char *s)
+{
+    char *end;
+    long long val;
+
+    if (strcmp(s, "-") == 0) {
+        return TRIGGER_COOLDOWN * 1000000000LL;
+    }
+
+    val = strtoll(s, &end, 10);
+    switch (*end) {
+    case 'h':
+        return val * 3600000000000LL;
+    case 'm':
+        return val * 60000000000LL;
+    default:
+        return val * 1000000000LL;
+    }
+}
+
+/*
+ * Reads the triggers file into `t->pats'.
+ *
+ * Returns the number of patterns.
+ */
+static size_t
+triggers_read(struct triggers *t)
+{
+    char path[256], *line = NULL, *p, *cd, *end;
+    struct trigger *tr;
+    size_t cap = 0;
+    FILE *fp;
+
+    if (xdg_path(XDG_CONFIG, TRIGGERS_FILE, path, sizeof(path)) < 0 ||
+        (fp = fopen(path, "re")) == NULL) {
+        return 0;
+    }
+
+    while (getline(&line, &cap, fp) > 0 && t->npats < TRIGGERS_MAX) {
+        for (p = line; isspace((unsigned char)*p); ++p);
+        if (*p == '#' || *p == '\0') {
+            continue;
+        }
+
+        cd = p;
+        while (*p != '\0' && !isspace((unsigned char)*p)) {
+            ++p;
+        }
+        if (*p == '\0') {
+            continue;
+        }
+        *p++ = '\0';
+        while (isspace((unsigned char)*p)) {
+            ++p;
+        }
+
+        end = p + strlen(p);
+        while (end > p && isspace((unsigned char)end[-1])) {
+            --end;
+        }
+        if (end == p || (size_t)(end - p) >= TRIGGER_LEN_MAX) {
+            continue;
+        }
+
+        tr = &t->pats[t->npats++];
+        tr->len = end - p;
+        memcpy(tr->text, p, tr->len);
+        tr->text[tr->len] = '\0';
+        tr->cooldown_ns = parse_cooldown(cd);
+    }
+
+    free(line);
+    fclose(fp);
+    return t->npats;
+}
+
+/*
+ * Adds the first two bytes of `tr' to the pairs
+ * the prefilter looks for, giving up on pairs
+ * if there are too many or `tr' is too short.
+ */
+static void
+add_pair(struct triggers *t, const struct trigger *tr)
+{
+    static const size_t none = TRIGGER_PAIRS_SIMD + 1;
+
+    if (t->npairs == none) {
+        return;
+    }
+    if (tr->len < 2) {
+        t->npairs = none;
+        return;
+    }
+
+    for (size_t i = 0; i < t->npairs; ++i) {
+        if (memcmp(t->pairs[i], tr->text, 2) == 0) {
+            return;
+        }
+    }
+
+    if (t->npairs == TRIGGER_PAIRS_SIMD) {
+        t->npairs = none;
+        return;
+    }
+    memcpy(t->pairs[t->npairs++], tr->text, 2);
+}
+
+/*
+ * Hashes the first `t->prefix_len' bytes at `p'
+ * to a bit of `t->prefix_bits'.
+ */
+static inline uint32_t
+prefix_hash(const struct triggers *t, const uint8_t *p)
+{
+    uint32_t key = 0;
+
+    memcpy(&key, p, t->prefix_len);
+    return key * 2654435761U >> 16;
+}
+
+/*
+ * Builds the automaton for `t->pats', see
+ * any text on Aho-Corasick. Transitions
+ * missing from the trie are filled in from
+ * the failure links, so scanning never has
+ * to follow them.
+ *
+ * Returns 0 on success, otherwise -1.
+ */
+static int
+triggers_build(struct triggers *t)
+{
+    uint32_t maxstates = 1, *fail, *queue, head = 0, tail = 0;
+    uint32_t s, next, c, f;
+    const uint8_t *text;
+
+    /* Byte classes, 0 is every byte in no pattern */
+    t->ncls = 1;
+    for (size_t i = 0; i < t->npats; ++i) {
+        text = (const uint8_t *)t->pats[i].text;
+        for (size_t j = 0; j < t->pats[i].len; ++j) {
+            if (t->cls[text[j]] == 0) {
+                t->cls[text[j]] = t->ncls++;
+            }
+        }
+        maxstates += t->pats[i].len;
+
+        if (!t->first[text[0]]) {
+            t->first[text[0]] = 1;
+            t->first_byte = text[0];
+            ++t->nfirst;
+        }
+        add_pair(t, &t->pats[i]);
+    }
+
+    t->delta = calloc((size_t)maxstates * t->ncls, sizeof(*t->delta));
+    t->out = malloc(maxstates * sizeof(*t->out));
+    t->dict = calloc(maxstates, sizeof(*t->dict));
+    t->accept = calloc(maxstates, sizeof(*t->accept));
+    fail = calloc(maxstates, sizeof(*fail));
+    queue = malloc(maxstates * sizeof(*queue));
+    if (t->delta == NULL || t->out == NULL || t->dict == NULL ||
+        t->accept == NULL || fail == NULL || queue == NULL) {
+        free(fail);
+        free(queue);
+        return -1;
+    }
+
+    /* The trie, 0 means no edge as nothing leads back to the root */
+    memset(t->out, 0xff, maxstates * sizeof(*t->out));
+    t->nstates = 1;
+    for (size_t i = 0; i < t->npats; ++i) {
+        text = (const uint8_t *)t->pats[i].text;
+        s = 0;
+        for (size_t j = 0; j < t->pats[i].len; ++j) {
+            c = t->cls[text[j]];
+            if (t->delta[s * t->ncls + c] == 0) {
+                t->delta[s * t->ncls + c] = t->nstates++;
+            }
+            s = t->delta[s * t->ncls + c];
+        }
+        if (t->out[s] < 0) {
+            t->out[s] = i;
+        }
+    }
+
+    /* Breadth first, a state's failure target is always done before it */
+    for (c = 0; c < t->ncls; ++c) {
+        if ((next = t->delta[c]) != 0) {
+            queue[tail++] = next;
+        }
+    }
+
+    while (head < tail) {
+        s = queue[head++];
+        f = fail[s];
+        t->dict[s] = t->out[f] >= 0 ? f : t->dict[f];
+        t->accept[s] = t->out[s] >= 0 || t->dict[s] != 0;
+
+        for (c = 0; c < t->ncls; ++c) {
+            next = t->delta[s * t->ncls + c];
+            if (next == 0) {
+                t->delta[s * t->ncls + c] = t->delta[f * t->ncls + c];
+                continue;
+            }
+            fail[next] = t->delta[f * t->ncls + c];
+            queue[tail++] = next;
+        }
+    }
+
+    free(fail);
+    free(queue);
+
+    /* The prefilter's vectors, built once rather than per skip */
+    if (t->npairs > TRIGGER_PAIRS_SIMD) {
+        t->npairs = 0;
+    }
+    for (size_t i = 0; i < t->npairs; ++i) {
+        const uint8_t *pair = t->pairs[i];
+        unsigned bucket = 1U << (i % 8);
+
+        memset(t->pair_vec[i][0], pair[0], sizeof(t->pair_vec[i][0]));
+        memset(t->pair_vec[i][1], pair[1], sizeof(t->pair_vec[i][1]));
+        for (size_t lane = 0; lane < 32; lane += 16) {
+            t->nibbles[0][lane + (pair[0] & 0x0f)] |= bucket;
+            t->nibbles[1][lane + (pair[0] >> 4)] |= bucket;
+            t->nibbles[2][lane + (pair[1] & 0x0f)] |= bucket;
+            t->nibbles[3][lane + (pair[1] >> 4)] |= bucket;
+        }
+    }
+
+    /* What candidates are checked against before the automaton */
+    t->prefix_len = 4;
+    for (size_t i = 0; i < t->npats; ++i) {
+        if (t->pats[i].len < t->prefix_len) {
+            t->prefix_len = t->pats[i].len;
+        }
+    }
+    for (size_t i = 0; i < t->npats; ++i) {
+        uint32_t bit = prefix_hash(t, (const uint8_t *)t->pats[i].text);
+
+        t->prefix_bits[bit / 8] |= 1U << (bit % 8);
+    }
+#ifdef __SSE2__
+    t->width = __builtin_cpu_supports("avx2") ? 32 : 16;
+#endif  /* __SSE2__ */
+    return 0;
+}
+
+/*
+ * Loads the triggers for the program `cmd'.
+ *
+ * Returns NULL if there are none.
+ */
+struct triggers *
+triggers_load(const char *cmd, uint64_t key)
+{
+    struct triggers *t;
+
+    if ((t = calloc(1, sizeof(*t))) == NULL) {
+        return NULL;
+    }
+
+    if (triggers_read(t) == 0 || triggers_build(t) < 0) {
+        triggers_free(t);
+        return NULL;
+    }
+
+    t->cmd = cmd;
+    t->key = key;
+    return t;
+}
+
+/*
+ * Notifies of pattern `i', which ended at `end'.
+ * The line it is on is taken from the output
+ * between `lo' and `hi'.
+ */
+static void
+trigger_fire(struct triggers *t, size_t i, const char *end,
+             const char *lo, const char *hi)
+{
+    struct trigger *tr = &t->pats[i];
+    struct notification n = {0};
+    const char *start = end - tr->len, *stop;
+    char line[LINE_CONTEXT * 2], body[LINE_CONTEXT * 2 + 64];
+    long long now = now_ns();
+
+    if (tr->last_ns != 0 && now - tr->last_ns < tr->cooldown_ns) {
+        return;
+    }
+    tr->last_ns = now;
+
+    if (start - lo > LINE_CONTEXT) {
+        lo = start - LINE_CONTEXT;
+    }
+    while (start > lo && start[-1] != '\n') {
+        --start;
+    }
+
+    /* The rest of the line may not be here yet */
+    if (hi - end > LINE_CONTEXT) {
+        hi = end + LINE_CONTEXT;
+    }
+    if ((stop = memchr(end, '\n', hi - end)) == NULL) {
+        stop = hi;
+    }
+
+    term_clean(line, sizeof(line), start, stop);
+    snprintf(body, sizeof(body), "'%s': %s", t->cmd, line);
+
+    n.summary = TRIGGER_SUMMARY;
+    n.body = body;
+    n.transient = true;
+    n.key = hash_bytes(tr->text, tr->len, t->key);
+    notify(&n);
+}
+
+static void
+trigger_match(struct triggers *t, uint32_t s, const char *end,
+              const char *lo, const char *hi)
+{
+    if (t->out[s] < 0) {
+        s = t->dict[s];
+    }
+
+    while (s != 0) {
+        trigger_fire(t, t->out[s], end, lo, hi);
+        s = t->dict[s];
+    }
+}
+
+/*
+ * Returns the first block of 32 (or 16) positions
+ * in [p, end) where one of the byte pairs patterns
+ * start with is, the positions in `maskp'. The
+ * last position is left to the scalar code as the
+ * byte after it isn't here yet, so if there is no
+ * such block, `*maskp' is 0 and the rest starts at
+ * the position returned.
+ */
+#ifdef __SSE2__
+__attribute__((target("avx2")))
+static const uint8_t *
+pairs_find_avx2(const struct triggers *t, const uint8_t *p, const uint8_t *end,
+                uint32_t *maskp)
+{
+    __m256i v0, v1, a, b, m;
+    uint32_t mask;
+
+    for (; end - p > 32; p += 32) {
+        v0 = _mm256_loadu_si256((const __m256i *)p);
+        v1 = _mm256_loadu_si256((const __m256i *)(p + 1));
+        m = _mm256_setzero_si256();
+        for (size_t i = 0; i < t->npairs; ++i) {
+            a = _mm256_loadu_si256((const __m256i *)t->pair_vec[i][0]);
+            b = _mm256_loadu_si256((const __m256i *)t->pair_vec[i][1]);
+            m = _mm256_or_si256(m, _mm256_and_si256(_mm256_cmpeq_epi8(v0, a),
+                                                    _mm256_cmpeq_epi8(v1, b)));
+        }
+        if ((mask = _mm256_movemask_epi8(m)) != 0) {
+            *maskp = mask;
+            return p;
+        }
+    }
+    *maskp = 0;
+    return p;
+}
+
+/*
+ * Same as pairs_find_avx2() for more than
+ * PAIRS_COMPARE pairs, at the same cost however
+ * many: each of the eight bits of a byte is a
+ * bucket of pairs, and a position is kept if
+ * some bucket has both its bytes' nibbles (a
+ * table lookup each). A bucket's pairs can mix,
+ * which triggers_skip() sorts out.
+ */
+__attribute__((target("avx2")))
+static const uint8_t *
+buckets_find_avx2(const struct triggers *t, const uint8_t *p, const uint8_t *end,
+                  uint32_t *maskp)
+{
+    const __m256i low = _mm256_set1_epi8(0x0f);
+    const __m256i lo0 = _mm256_loadu_si256((const __m256i *)t->nibbles[0]);
+    const __m256i hi0 = _mm256_loadu_si256((const __m256i *)t->nibbles[1]);
+    const __m256i lo1 = _mm256_loadu_si256((const __m256i *)t->nibbles[2]);
+    const __m256i hi1 = _mm256_loadu_si256((const __m256i *)t->nibbles[3]);
+    __m256i v0, v1, m;
+    uint32_t mask;
+
+    for (; end - p > 32; p += 32) {
+        v0 = _mm256_loadu_si256((const __m256i *)p);
+        v1 = _mm256_loadu_si256((const __m256i *)(p + 1));
+        m = _mm256_and_si256(
+            _mm256_and_si256(
+                _mm256_shuffle_epi8(lo0, _mm256_and_si256(v0, low)),
+                _mm256_shuffle_epi8(hi0, _mm256_and_si256(_mm256_srli_epi16(v0, 4), low))),
+            _mm256_and_si256(
+                _mm256_shuffle_epi8(lo1, _mm256_and_si256(v1, low)),
+                _mm256_shuffle_epi8(hi1, _mm256_and_si256(_mm256_srli_epi16(v1, 4), low))));
+        mask = ~_mm256_movemask_epi8(_mm256_cmpeq_epi8(m, _mm256_setzero_si256()));
+        if (mask != 0) {
+            *maskp = mask;
+            return p;
+        }
+    }
+    *maskp = 0;
+    return p;
+}
+
+static const uint8_t *
+pairs_find_sse2(const struct triggers *t, const uint8_t *p, const uint8_t *end,
+                uint32_t *maskp)
+{
+    __m128i v0, v1, a, b, m;
+    uint32_t mask;
+
+    for (; end - p > 16; p += 16) {
+        v0 = _mm_loadu_si128((const __m128i *)p);
+        v1 = _mm_loadu_si128((const __m128i *)(p + 1));
+        m = _mm_setzero_si128();
+        for (size_t i = 0; i < t->npairs; ++i) {
+            a = _mm_loadu_si128((const __m128i *)t->pair_vec[i][0]);
+            b = _mm_loadu_si128((const __m128i *)t->pair_vec[i][1]);
+            m = _mm_or_si128(m, _mm_and_si128(_mm_cmpeq_epi8(v0, a),
+                                              _mm_cmpeq_epi8(v1, b)));
+        }
+        if ((mask = _mm_movemask_epi8(m)) != 0) {
+            *maskp = mask;
+            return p;
+        }
+    }
+    *maskp = 0;
+    return p;
+}
+#endif  /* __SSE2__ */
+
+/*
+ * The block the prefilter found last and its
+ * positions, kept so that when the automaton
+ * is back at its root within the block, the
+ * next one is only a bit away.
+ */
+struct skip {
+    const uint8_t *blk;
+    uint32_t mask;
+};
+
+/*
+ * Returns the first position in [p, end) a
+ * match may start at, or `end'.
+ */
+static const uint8_t *
+triggers_skip(const struct triggers *t, struct skip *sk, const uint8_t *p,
+              const uint8_t *end)
+{
+    const uint8_t *q;
+
+#ifdef __SSE2__
+    uint32_t bit;
+    bool in;
+
+    if (t->npairs > 0) {
+        /* The automaton is past the start of the block */
+        in = sk->mask != 0 && p - sk->blk < (ptrdiff_t)t->width;
+        sk->mask = in ? sk->mask & ~0U << (p - sk->blk) : 0;
+
+        for (;;) {
+            for (; sk->mask != 0; sk->mask &= sk->mask - 1) {
+                q = sk->blk + __builtin_ctz(sk->mask);
+                if (end - q < (ptrdiff_t)t->prefix_len) {
+                    return q;
+                }
+                bit = prefix_hash(t, q);
+                if (t->prefix_bits[bit / 8] & (1U << (bit % 8))) {
+                    return q;
+                }
+            }
+            if (in) {
+                p = sk->blk + t->width;
+            }
+
+            if (t->width == 32 && t->npairs > PAIRS_COMPARE) {
+                sk->blk = buckets_find_avx2(t, p, end, &sk->mask);
+            } else if (t->width == 32) {
+                sk->blk = pairs_find_avx2(t, p, end, &sk->mask);
+            } else {
+                sk->blk = pairs_find_sse2(t, p, end, &sk->mask);
+            }
+            if (sk->mask == 0) {
+                p = sk->blk;
+                break;
+            }
+            in = true;
+        }
+    }
+#endif  /* __SSE2__ */
+
+    if (t->nfirst == 1) {
+        q = memchr(p, t->first_byte, end - p);
+        return q != NULL ? q : end;
+    }
+
+    while (p < end && !t->first[*p]) {
+        ++p;
+    }
+    return p;
+}
+
+/*
+ * Scans `len' bytes of new output at `buf',
+ * `lo' is where the output before it that is
+ * still around starts, for context.
+ *
+ * @state: Automaton state, 0 at the start of
+ *         the output.
+ */
+void
+triggers_scan(struct triggers *t, uint32_t *state, const char *buf,
+              size_t len, const char *lo)
+{
+    const uint8_t *p = (const uint8_t *)buf, *end = p + len;
+    const uint16_t *delta = t->delta;
+    const uint32_t ncls = t->ncls;
+    struct skip sk = { NULL, 0 };
+    uint32_t s = *state;
+
+    while (p < end) {
+        if (s == 0 && (p = triggers_skip(t, &sk, p, end)) == end) {
+            break;
+        }
+
+        s = delta[s * ncls + t->cls[*p++]];
+        if (t->accept[s]) {
+            trigger_match(t, s, (const char *)p, lo, buf + len);
+        }
+    }
+
+    *state = s;
+}
+
+void
+triggers_free(struct triggers *t)
+{
+    if (t == NULL) {
+        return;
+    }
+
+    free(t->delta);
+    free(t->out);
+    free(t->dict);
+    free(t->accept);
+    free(t);
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef TRIGGERS_H
+#define TRIGGERS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TRIGGERS_MAX        64
+#define TRIGGER_LEN_MAX     128
+#define TRIGGER_PAIRS_SIMD  16
+
+/*
+ * A pattern from the triggers file.
+ */
+struct trigger {
+    char text[TRIGGER_LEN_MAX];
+    size_t len;
+    long long cooldown_ns;
+    long long last_ns;      /* Last notification, 0 if none */
+};
+
+/*
+ * The patterns compiled into an Aho-Corasick
+ * automaton. Bytes are mapped to classes first
+ * so each state's row stays small.
+ */
+struct triggers {
+    struct trigger pats[TRIGGERS_MAX];
+    size_t npats;
+    uint8_t cls[256];       /* 0 for bytes in no pattern */
+    uint32_t ncls;
+    uint32_t nstates;
+    uint16_t *delta;        /* nstates x ncls transitions */
+    int16_t *out;           /* Pattern ending at a state, or -1 */
+    uint16_t *dict;         /* Next suffix state with a pattern, 0 if none */
+    uint8_t *accept;        /* out[] or dict[] set */
+
+    /* Bytes and byte pairs a match can start with */
+    uint8_t first[256];
+    uint8_t first_byte;         /* If there is only one */
+    size_t nfirst;
+    uint8_t pairs[TRIGGER_PAIRS_SIMD][2];
+    size_t npairs;              /* 0 if too many to compare at once */
+    uint8_t pair_vec[TRIGGER_PAIRS_SIMD][2][32];    /* pairs[] broadcast */
+    uint8_t nibbles[4][32];     /* Buckets of pairs[] by nibble, twice */
+    uint8_t prefix_bits[8192];  /* Hashed first prefix_len bytes of patterns */
+    size_t prefix_len;
+    size_t width;               /* Positions compared at once */
+
+    const char *cmd;
+    uint64_t key;
+};
+
+struct triggers *triggers_load(const char *cmd, uint64_t key);
+void triggers_scan(struct triggers *t, uint32_t *state, const char *buf,
+                   size_t len, const char *lo);
+void triggers_free(struct triggers *t);
+
+#endif  /* !TRIGGERS_H */
@@ -0,0 +1,326 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * A minimal io_uring without liburing, enough for
+ * cmdnotifyd's loop: submission, completions and
+ * provided buffer rings.
+ *
+ * The ring is shared with the kernel; the heads
+ * and tails are published with release stores
+ * and read with acquire loads, like liburing does.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "uring.h"
+
+/*
+ * Multishot requests post many completions
+ * per submission, so the CQ is made this much
+ * larger than the SQ.
+ */
+#define CQ_FACTOR   16
+
+#define load_acquire(p)     __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+/*
+ * Sets up a ring with `entries' submission slots.
+ * It needs IORING_SETUP_DEFER_TASKRUN (Linux 6.1),
+ * which also means multishot recv (6.0) and
+ * provided buffer rings (5.19) are there.
+ *
+ * Returns 0 on success, otherwise -1.
+ */
+int
+uring_init(struct uring *r, unsigned entries)
+{
+    struct io_uring_params p;
+    unsigned *array;
+    char *rings;
+    size_t sqlen, cqlen;
+    unsigned i;
+
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL |
+              IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    p.cq_entries = entries * CQ_FACTOR;
+
+    r->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0) {
+        return -1;
+    }
+
+    if ((p.features & IORING_FEAT_SINGLE_MMAP) == 0) {
+        close(r->fd);
+        errno = ENOSYS;
+        return -1;
+    }
+
+    sqlen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cqlen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->rings_len = sqlen > cqlen ? sqlen : cqlen;
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    r->rings = mmap(NULL, r->rings_len, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->rings == MAP_FAILED) {
+        close(r->fd);
+        return -1;
+    }
+
+    r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        munmap(r->rings, r->rings_len);
+        close(r->fd);
+        return -1;
+    }
+
+    rings = r->rings;
+    r->sq_head = (unsigned *)(rings + p.sq_off.head);
+    r->sq_tail = (unsigned *)(rings + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(rings + p.sq_off.ring_mask);
+    r->cq_head = (unsigned *)(rings + p.cq_off.head);
+    r->cq_tail = (unsigned *)(rings + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(rings + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(rings + p.cq_off.cqes);
+    r->sq_entries = p.sq_entries;
+    r->sqe_tail = *r->sq_tail;
+    r->submitted = r->sqe_tail;
+
+    /* SQEs are always used in order */
+    array = (unsigned *)(rings + p.sq_off.array);
+    for (i = 0; i < p.sq_entries; ++i) {
+        array[i] = i;
+    }
+    return 0;
+}
+
+/*
+ * Returns a zeroed SQE to fill in, submitting
+ * what is queued first if the SQ is full. It
+ * goes to the kernel with the next uring_wait().
+ *
+ * Returns NULL if the SQ stays full.
+ */
+struct io_uring_sqe *
+uring_sqe(struct uring *r)
+{
+    struct io_uring_sqe *sqe;
+    long n;
+
+    if (r->sqe_tail - load_acquire(r->sq_head) >= r->sq_entries) {
+        store_release(r->sq_tail, r->sqe_tail);
+        n = syscall(__NR_io_uring_enter, r->fd, r->sqe_tail - r->submitted,
+                    0, 0, NULL, 0);
+        if (n > 0) {
+            r->submitted += n;
+        }
+        if (r->sqe_tail - load_acquire(r->sq_head) >= r->sq_entries) {
+            return NULL;
+        }
+    }
+
+    sqe = &r->sqes[r->sqe_tail & *r->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    ++r->sqe_tail;
+    return sqe;
+}
+
+/*
+ * Submits the queued SQEs and waits until
+ * there is at least one completion.
+ *
+ * Returns 0 on success, otherwise -1.
+ */
+int
+uring_wait(struct uring *r)
+{
+    long n;
+
+    store_release(r->sq_tail, r->sqe_tail);
+    for (;;) {
+        n = syscall(__NR_io_uring_enter, r->fd, r->sqe_tail - r->submitted,
+                    1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (n >= 0) {
+            r->submitted += n;
+            return 0;
+        }
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+}
+
+/*
+ * Returns the next completion, or NULL
+ * if there is none. Pass it on with
+ * uring_cqe_seen() once done with it.
+ */
+struct io_uring_cqe *
+uring_cqe(struct uring *r)
+{
+    unsigned head = *r->cq_head;
+
+    if (head == load_acquire(r->cq_tail)) {
+        return NULL;
+    }
+    return &r->cqes[head & *r->cq_mask];
+}
+
+void
+uring_cqe_seen(struct uring *r)
+{
+    store_release(r->cq_head, *r->cq_head + 1);
+}
+
+/*
+ * Cancels every request on the ring and waits
+ * until they are gone. Their last completions
+ * are on the CQ after, none come later.
+ *
+ * Returns 0 on success, otherwise -1.
+ */
+int
+uring_cancel(struct uring *r)
+{
+    struct io_uring_sync_cancel_reg reg;
+
+    memset(&reg, 0, sizeof(reg));
+    reg.fd = -1;
+    reg.flags = IORING_ASYNC_CANCEL_ANY;
+    reg.timeout.tv_sec = -1;
+    reg.timeout.tv_nsec = -1;
+    if (syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_SYNC_CANCEL,
+                &reg, 1) < 0 && errno != ENOENT) {
+        return -1;
+    }
+
+    /* Post what finished before, it waits for us to ask */
+    if (syscall(__NR_io_uring_enter, r->fd, 0, 0, IORING_ENTER_GETEVENTS,
+                NULL, 0) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+void
+uring_fini(struct uring *r)
+{
+    munmap(r->sqes, r->sqes_len);
+    munmap(r->rings, r->rings_len);
+    close(r->fd);
+}
+
+/*
+ * Registers a ring of `count' (a power of two)
+ * buffers of `size' bytes under `group', all of
+ * them handed to the kernel.
+ *
+ * Returns 0 on success, otherwise -1.
+ */
+int
+uring_bufs_init(struct uring *r, struct uring_bufs *b, uint16_t group,
+                unsigned count, size_t size)
+{
+    struct io_uring_buf_reg reg;
+    size_t ringlen = count * sizeof(struct io_uring_buf);
+    char *p;
+    unsigned i;
+
+    b->len = ringlen + count * size;
+    p = mmap(NULL, b->len, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        return -1;
+    }
+
+    b->ring = (struct io_uring_buf_ring *)p;
+    b->base = p + ringlen;
+    b->size = size;
+    b->count = count;
+    b->group = group;
+    b->tail = 0;
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uintptr_t)b->ring;
+    reg.ring_entries = count;
+    reg.bgid = group;
+    if (syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_PBUF_RING,
+                &reg, 1) < 0) {
+        munmap(p, b->len);
+        return -1;
+    }
+
+    for (i = 0; i < count; ++i) {
+        uring_buf_put(b, i);
+    }
+    return 0;
+}
+
+/*
+ * Returns the buffer with ID `bid'.
+ */
+void *
+uring_buf(struct uring_bufs *b, unsigned bid)
+{
+    return b->base + (size_t)bid * b->size;
+}
+
+/*
+ * Gives the buffer with ID `bid' back to
+ * the kernel.
+ */
+void
+uring_buf_put(struct uring_bufs *b, unsigned bid)
+{
+    struct io_uring_buf *e = &b->ring->bufs[b->tail & (b->count - 1)];
+
+    e->addr = (uintptr_t)uring_buf(b, bid);
+    e->len = b->size;
+    e->bid = bid;
+    store_release(&b->ring->tail, ++b->tail);
+}
+
+void
+uring_bufs_fini(struct uring *r, struct uring_bufs *b)
+{
+    struct io_uring_buf_reg reg;
+
+    memset(&reg, 0, sizeof(reg));
+    reg.bgid = b->group;
+    syscall(__NR_io_uring_register, r->fd, IORING_UNREGISTER_PBUF_RING,
+            &reg, 1);
+    munmap(b->ring, b->len);
+}
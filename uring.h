@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+/*
+ * An io_uring, set up with the raw syscalls.
+ * Only one thread may use it.
+ */
+struct uring {
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned sq_entries;
+    unsigned sqe_tail;          /* SQEs handed out */
+    unsigned submitted;         /* SQEs the kernel took */
+    void *rings;
+    size_t rings_len;
+    size_t sqes_len;
+};
+
+/*
+ * A ring of `count' buffers of `size' bytes each
+ * that the kernel picks from (IOSQE_BUFFER_SELECT
+ * with buf_group set to `group').
+ */
+struct uring_bufs {
+    struct io_uring_buf_ring *ring;
+    char *base;
+    size_t size;
+    unsigned count;             /* Power of two */
+    uint16_t group;
+    uint16_t tail;
+    size_t len;
+};
+
+int uring_init(struct uring *r, unsigned entries);
+struct io_uring_sqe *uring_sqe(struct uring *r);
+int uring_wait(struct uring *r);
+struct io_uring_cqe *uring_cqe(struct uring *r);
+void uring_cqe_seen(struct uring *r);
+int uring_cancel(struct uring *r);
+void uring_fini(struct uring *r);
+
+int uring_bufs_init(struct uring *r, struct uring_bufs *b, uint16_t group,
+                    unsigned count, size_t size);
+void *uring_buf(struct uring_bufs *b, unsigned bid);
+void uring_buf_put(struct uring_bufs *b, unsigned bid);
+void uring_bufs_fini(struct uring *r, struct uring_bufs *b);
+
+#endif  /* !URING_H */
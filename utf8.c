@@ -0,0 +1,728 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Makes text safe to hand to a notification server:
+ * invalid UTF-8 is replaced with U+FFFD, markup
+ * characters are escaped and the result is cut to
+ * a byte budget without splitting a grapheme, all
+ * in a single pass.
+ *
+ * Runs of valid text with nothing to escape (the
+ * common case) are found 16 or 32 bytes at a time
+ * with SSSE3 or AVX2, validating UTF-8 by looking
+ * up each byte's nibbles and the one before it in
+ * tables of the errors they allow for (Keiser and
+ * Lemire's method), and copied as they are. What
+ * stops a run goes through the scalar decoder.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif  /* __SSE2__ */
+#include "utf8.h"
+
+#define REPLACEMENT     "\xef\xbf\xbd"  /* U+FFFD */
+#define ELLIPSIS        "\xe2\x80\xa6"  /* U+2026 */
+#define ELLIPSIS_LEN    3
+#define SHORT_RUN       8
+
+/*
+ * Output state, `safe' is the last grapheme
+ * boundary that leaves room for the ellipsis.
+ */
+struct out {
+    char *p;
+    size_t len;
+    size_t cap;
+    size_t safe;
+    bool truncated;
+    bool after_zwj;
+    bool odd_ri;        /* Unpaired regional indicator before us */
+};
+
+/*
+ * Returns true if `cp' continues the grapheme
+ * before it. This covers combining marks,
+ * variation selectors, emoji modifiers, tags
+ * and ZWJ sequences, an approximation of
+ * UAX #29 that is good enough for cutting.
+ */
+static bool
+is_extend(uint32_t cp)
+{
+    return (cp >= 0x0300 && cp <= 0x036f) ||
+           (cp >= 0x0483 && cp <= 0x0489) ||
+           (cp >= 0x0591 && cp <= 0x05bd) ||
+           (cp >= 0x0610 && cp <= 0x061a) ||
+           (cp >= 0x064b && cp <= 0x065f) ||
+           (cp >= 0x0900 && cp <= 0x0903) ||
+           (cp >= 0x093a && cp <= 0x094f) ||
+           (cp >= 0x1ab0 && cp <= 0x1aff) ||
+           (cp >= 0x1dc0 && cp <= 0x1dff) ||
+           cp == 0x200c || cp == 0x200d ||
+           (cp >= 0x20d0 && cp <= 0x20ff) ||
+           (cp >= 0xfe00 && cp <= 0xfe0f) ||
+           (cp >= 0xfe20 && cp <= 0xfe2f) ||
+           (cp >= 0x1f3fb && cp <= 0x1f3ff) ||
+           (cp >= 0xe0020 && cp <= 0xe007f) ||
+           (cp >= 0xe0100 && cp <= 0xe01ef);
+}
+
+static inline bool
+is_ri(uint32_t cp)
+{
+    /* Regional indicators, flags are pairs of them */
+    return cp >= 0x1f1e6 && cp <= 0x1f1ff;
+}
+
+/*
+ * Appends the encoding `s' of the codepoint
+ * `cp'. Returns false once out of room.
+ */
+static bool
+out_put(struct out *o, uint32_t cp, const char *s, size_t len)
+{
+    bool ri = is_ri(cp);
+    bool boundary = !is_extend(cp) && !o->after_zwj && !(ri && o->odd_ri);
+
+    if (boundary && o->len + ELLIPSIS_LEN <= o->cap) {
+        o->safe = o->len;
+    }
+
+    o->after_zwj = cp == 0x200d;
+    o->odd_ri = ri && !o->odd_ri;
+
+    if (o->len + len > o->cap) {
+        o->truncated = true;
+        return false;
+    }
+
+    memcpy(o->p + o->len, s, len);
+    o->len += len;
+    return true;
+}
+
+/*
+ * Appends a run of plain ASCII, there is a
+ * grapheme boundary before every character.
+ * Returns false once out of room.
+ */
+static bool
+out_ascii(struct out *o, const char *s, size_t len)
+{
+    size_t start = o->len, n = len, best;
+
+    if (len == 0) {
+        return true;
+    }
+
+    if (n > o->cap - o->len) {
+        n = o->cap - o->len;
+        o->truncated = true;
+    }
+
+    memcpy(o->p + o->len, s, n);
+    o->len += n;
+    o->after_zwj = false;
+    o->odd_ri = false;
+
+    /* The last boundary that still leaves room for "..." */
+    if (n > 0 && o->cap >= ELLIPSIS_LEN) {
+        best = start + n - 1;
+        if (best > o->cap - ELLIPSIS_LEN) {
+            best = o->cap - ELLIPSIS_LEN;
+        }
+        if (best >= start) {
+            o->safe = best;
+        }
+    }
+
+    return !o->truncated;
+}
+
+/*
+ * Decodes the codepoint at `s', returns its
+ * length or 0 if the sequence is invalid
+ * (overlong, surrogate, out of range or
+ * truncated).
+ */
+static size_t
+decode(const unsigned char *s, size_t len, uint32_t *cp)
+{
+    size_t n;
+    uint32_t c = s[0], min;
+
+    if (c < 0x80) {
+        *cp = c;
+        return 1;
+    } else if (c >= 0xc2 && c <= 0xdf) {
+        n = 2;
+        c &= 0x1f;
+        min = 0x80;
+    } else if (c >= 0xe0 && c <= 0xef) {
+        n = 3;
+        c &= 0x0f;
+        min = 0x800;
+    } else if (c >= 0xf0 && c <= 0xf4) {
+        n = 4;
+        c &= 0x07;
+        min = 0x10000;
+    } else {
+        return 0;
+    }
+
+    if (n > len) {
+        return 0;
+    }
+
+    for (size_t i = 1; i < n; ++i) {
+        if ((s[i] & 0xc0) != 0x80) {
+            return 0;
+        }
+        c = (c << 6) | (s[i] & 0x3f);
+    }
+
+    if (c < min || c > 0x10ffff || (c >= 0xd800 && c <= 0xdfff)) {
+        return 0;
+    }
+
+    *cp = c;
+    return n;
+}
+
+/*
+ * Appends a run of valid UTF-8 with nothing in it
+ * to escape, that leaves room for the ellipsis.
+ * Only its end is decoded, back to a codepoint
+ * after which there is no state to carry (any but
+ * a regional indicator or ZWJ), for the last
+ * grapheme boundary and the state after it. As
+ * with out_ascii(), there is one before ASCII.
+ */
+static void
+out_text(struct out *o, const char *s, size_t len)
+{
+    const unsigned char *u = (const unsigned char *)s;
+    size_t walk = len, end = len, p, at, n, rn;
+    bool zwj, odd, found = false, end_zwj = false, end_odd = false, first = true;
+    uint32_t cp;
+
+    if (len == 0) {
+        return;
+    }
+    memcpy(o->p + o->len, s, len);
+
+    /* Mostly it ends in ASCII */
+    if (u[len - 1] < 0x80) {
+        o->safe = o->len + len - 1;
+        o->len += len;
+        o->after_zwj = o->odd_ri = false;
+        return;
+    }
+
+    for (;;) {
+        p = walk;
+        do {
+            while (--p > 0 && (u[p] & 0xc0) == 0x80);
+            rn = decode(u + p, len - p, &cp);
+        } while (p > 0 && (is_ri(cp) || cp == 0x200d));
+
+        /* Whether there is a boundary at the start depends on what came before */
+        if (p == 0) {
+            at = 0;
+            zwj = o->after_zwj;
+            odd = o->odd_ri;
+        } else {
+            at = p + rn;
+            zwj = odd = false;
+        }
+
+        /* Forward from there, as out_put() goes */
+        for (; at < end; at += n) {
+            n = decode(u + at, len - at, &cp);
+            if (cp < 0x80 || (!is_extend(cp) && !zwj && !(is_ri(cp) && odd))) {
+                o->safe = o->len + at;
+                found = true;
+            }
+            zwj = cp == 0x200d;
+            odd = is_ri(cp) && !odd;
+        }
+        if (first) {
+            end_zwj = zwj;
+            end_odd = odd;
+            first = false;
+        }
+        if (found || p == 0) {
+            break;
+        }
+
+        /* All of it extends what is before, look there */
+        walk = p;
+        end = p + rn;
+    }
+
+    o->len += len;
+    o->after_zwj = end_zwj;
+    o->odd_ri = end_odd;
+}
+
+static inline bool
+needs_escape(unsigned char c)
+{
+    return c == '&' || c == '<' || c == '>';
+}
+
+/*
+ * Returns `b', or where the sequence cut short
+ * by it starts.
+ */
+static size_t
+seq_start(const unsigned char *s, size_t b)
+{
+    unsigned char c;
+
+    for (size_t k = 1; k <= 3 && k <= b; ++k) {
+        if ((c = s[b - k]) < 0x80) {
+            break;
+        }
+        if (c >= 0xc0) {
+            return (size_t)(c >= 0xf0 ? 4 : c >= 0xe0 ? 3 : 2) > k ? b - k : b;
+        }
+    }
+    return b;
+}
+
+/*
+ * Returns where a run of valid text stops in the
+ * block at `i', given which of its bytes are an
+ * error or are markup. The first error is flagged
+ * where its sequence first goes wrong, at most
+ * three bytes after its lead.
+ */
+static size_t
+run_stop(const unsigned char *s, size_t i, uint32_t err, uint32_t mark)
+{
+    size_t stop = mark != 0 ? i + __builtin_ctz(mark) : SIZE_MAX, e;
+
+    if (err != 0) {
+        e = seq_start(s, i + __builtin_ctz(err));
+        if (e < stop) {
+            stop = e;
+        }
+    }
+    return stop;
+}
+
+/*
+ * Returns the length of the run of valid text at
+ * the start of `s' with nothing in it to escape,
+ * up to a codepoint boundary.
+ */
+static size_t
+text_run_scalar(const unsigned char *s, size_t len, bool escape)
+{
+    size_t i;
+
+    /* Plain ASCII only, the rest is left to decode() */
+    for (i = 0; i < len; ++i) {
+        if (s[i] >= 0x80 || (escape && needs_escape(s[i]))) {
+            break;
+        }
+    }
+    return i;
+}
+
+#ifdef __SSE2__
+/* Errors flagged by the lookup tables */
+#define TOO_SHORT       0x01    /* Lead not followed by a continuation */
+#define TOO_LONG        0x02    /* Continuation after ASCII */
+#define OVERLONG_3      0x04
+#define TOO_LARGE       0x08
+#define SURROGATE       0x10
+#define OVERLONG_2      0x20
+#define TOO_LARGE_1000  0x40
+#define OVERLONG_4      0x40
+#define TWO_CONTS       0x80    /* Continuation after a continuation */
+#define CARRY           (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+/* By the high nibble of the byte before */
+static const uint8_t byte1_high[16] = {
+    TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+    TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+    TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+    TOO_SHORT | OVERLONG_2,
+    TOO_SHORT,
+    TOO_SHORT | OVERLONG_3 | SURROGATE,
+    TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4,
+};
+
+/* By the low nibble of the byte before */
+static const uint8_t byte1_low[16] = {
+    CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+    CARRY | OVERLONG_2,
+    CARRY,
+    CARRY,
+    CARRY | TOO_LARGE,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+};
+
+/* By the high nibble of the byte itself */
+static const uint8_t byte2_high[16] = {
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+};
+
+/* The bytes of `v' shifted in from `prev' by `n' */
+#define PREV_AVX2(v, prev, n) \
+    _mm256_alignr_epi8((v), _mm256_permute2x128_si256((prev), (v), 0x21), 16 - (n))
+#define PREV_SSSE3(v, prev, n) \
+    _mm_alignr_epi8((v), (prev), 16 - (n))
+
+/*
+ * Loads the last `n' bytes of text, padded with
+ * ASCII. Kept out of line, it needs a frame.
+ */
+__attribute__((target("avx2"), noinline))
+static __m256i
+load_tail_avx2(const unsigned char *s, size_t n)
+{
+    unsigned char pad[32] = {0};
+
+    memcpy(pad, s, n);
+    return _mm256_loadu_si256((const __m256i *)pad);
+}
+
+/*
+ * Returns where a run of valid text stops in the
+ * block `v' at `i', after the block `prev', or
+ * SIZE_MAX. Only the bytes in `keep' count.
+ * Sequences cut short at its end are no error.
+ */
+__attribute__((target("avx2"), always_inline))
+static inline size_t
+block_avx2(const unsigned char *s, size_t i, __m256i v, __m256i prev,
+           uint32_t keep, bool escape)
+{
+    const __m256i t1h = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)byte1_high));
+    const __m256i t1l = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)byte1_low));
+    const __m256i t2h = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)byte2_high));
+    const __m256i low = _mm256_set1_epi8(0x0f);
+    __m256i m = _mm256_setzero_si256(), prev1, b1h, b1l, b2h, third, fourth, must;
+    uint32_t err = 0, mark;
+
+    if (escape) {
+        m = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('&')),
+                            _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('<')),
+                                            _mm256_cmpeq_epi8(v, _mm256_set1_epi8('>'))));
+    }
+    mark = _mm256_movemask_epi8(m) & keep;
+
+    /* Nothing to validate in ASCII after ASCII */
+    if ((_mm256_movemask_epi8(v) | _mm256_movemask_epi8(prev)) != 0) {
+        prev1 = PREV_AVX2(v, prev, 1);
+        b1h = _mm256_shuffle_epi8(t1h, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), low));
+        b1l = _mm256_shuffle_epi8(t1l, _mm256_and_si256(prev1, low));
+        b2h = _mm256_shuffle_epi8(t2h, _mm256_and_si256(_mm256_srli_epi16(v, 4), low));
+
+        /* Third and fourth bytes must be continuations, and only they may follow one */
+        third = _mm256_subs_epu8(PREV_AVX2(v, prev, 2), _mm256_set1_epi8(0xe0 - 0x80));
+        fourth = _mm256_subs_epu8(PREV_AVX2(v, prev, 3), _mm256_set1_epi8(0xf0 - 0x80));
+        must = _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8((char)0x80));
+
+        m = _mm256_xor_si256(must, _mm256_and_si256(_mm256_and_si256(b1h, b1l), b2h));
+        err = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(m, _mm256_setzero_si256())) &
+              keep;
+    }
+
+    return (err | mark) != 0 ? run_stop(s, i, err, mark) : SIZE_MAX;
+}
+
+__attribute__((target("avx2")))
+static size_t
+text_run_avx2(const unsigned char *s, size_t len, bool escape)
+{
+    const __m256i amp = _mm256_set1_epi8('&');
+    const __m256i lt = _mm256_set1_epi8('<');
+    const __m256i gt = _mm256_set1_epi8('>');
+    __m256i v, m, prev = _mm256_setzero_si256();
+    uint32_t mark;
+    size_t i, stop;
+
+    /* Plain ASCII first, as far as it goes */
+    for (i = 0; i + 32 <= len; i += 32) {
+        v = _mm256_loadu_si256((const __m256i *)(s + i));
+        m = v;
+        if (escape) {
+            m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, amp));
+            m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, lt));
+            m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, gt));
+        }
+        if ((mark = _mm256_movemask_epi8(m)) != 0) {
+            /* Markup, not the end of ASCII */
+            if (_mm256_movemask_epi8(v) == 0) {
+                return i + __builtin_ctz(mark);
+            }
+            break;
+        }
+    }
+
+    /* Any ASCII before is as good as none */
+    for (; i + 32 <= len; i += 32) {
+        v = _mm256_loadu_si256((const __m256i *)(s + i));
+        if ((stop = block_avx2(s, i, v, prev, UINT32_MAX, escape)) != SIZE_MAX) {
+            return stop;
+        }
+        prev = v;
+    }
+    if (i < len) {
+        v = load_tail_avx2(s + i, len - i);
+        if ((stop = block_avx2(s, i, v, prev, (1U << (len - i)) - 1, escape)) != SIZE_MAX) {
+            return stop;
+        }
+    }
+    return seq_start(s, len);
+}
+
+__attribute__((target("ssse3"), noinline))
+static __m128i
+load_tail_ssse3(const unsigned char *s, size_t n)
+{
+    unsigned char pad[16] = {0};
+
+    memcpy(pad, s, n);
+    return _mm_loadu_si128((const __m128i *)pad);
+}
+
+__attribute__((target("ssse3"), always_inline))
+static inline size_t
+block_ssse3(const unsigned char *s, size_t i, __m128i v, __m128i prev,
+            uint32_t keep, bool escape)
+{
+    const __m128i t1h = _mm_loadu_si128((const __m128i *)byte1_high);
+    const __m128i t1l = _mm_loadu_si128((const __m128i *)byte1_low);
+    const __m128i t2h = _mm_loadu_si128((const __m128i *)byte2_high);
+    const __m128i low = _mm_set1_epi8(0x0f);
+    __m128i m = _mm_setzero_si128(), prev1, b1h, b1l, b2h, third, fourth, must;
+    uint32_t err = 0, mark;
+
+    if (escape) {
+        m = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('&')),
+                         _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('<')),
+                                      _mm_cmpeq_epi8(v, _mm_set1_epi8('>'))));
+    }
+    mark = _mm_movemask_epi8(m) & keep;
+
+    if ((_mm_movemask_epi8(v) | _mm_movemask_epi8(prev)) != 0) {
+        prev1 = PREV_SSSE3(v, prev, 1);
+        b1h = _mm_shuffle_epi8(t1h, _mm_and_si128(_mm_srli_epi16(prev1, 4), low));
+        b1l = _mm_shuffle_epi8(t1l, _mm_and_si128(prev1, low));
+        b2h = _mm_shuffle_epi8(t2h, _mm_and_si128(_mm_srli_epi16(v, 4), low));
+        third = _mm_subs_epu8(PREV_SSSE3(v, prev, 2), _mm_set1_epi8(0xe0 - 0x80));
+        fourth = _mm_subs_epu8(PREV_SSSE3(v, prev, 3), _mm_set1_epi8(0xf0 - 0x80));
+        must = _mm_and_si128(_mm_or_si128(third, fourth), _mm_set1_epi8((char)0x80));
+
+        m = _mm_xor_si128(must, _mm_and_si128(_mm_and_si128(b1h, b1l), b2h));
+        err = ~_mm_movemask_epi8(_mm_cmpeq_epi8(m, _mm_setzero_si128())) & keep;
+    }
+
+    return (err | mark) != 0 ? run_stop(s, i, err, mark) : SIZE_MAX;
+}
+
+__attribute__((target("ssse3")))
+static size_t
+text_run_ssse3(const unsigned char *s, size_t len, bool escape)
+{
+    const __m128i amp = _mm_set1_epi8('&');
+    const __m128i lt = _mm_set1_epi8('<');
+    const __m128i gt = _mm_set1_epi8('>');
+    __m128i v, m, prev = _mm_setzero_si128();
+    uint32_t mark;
+    size_t i, stop;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        v = _mm_loadu_si128((const __m128i *)(s + i));
+        m = v;
+        if (escape) {
+            m = _mm_or_si128(m, _mm_cmpeq_epi8(v, amp));
+            m = _mm_or_si128(m, _mm_cmpeq_epi8(v, lt));
+            m = _mm_or_si128(m, _mm_cmpeq_epi8(v, gt));
+        }
+        if ((mark = _mm_movemask_epi8(m)) != 0) {
+            if (_mm_movemask_epi8(v) == 0) {
+                return i + __builtin_ctz(mark);
+            }
+            break;
+        }
+    }
+
+    for (; i + 16 <= len; i += 16) {
+        v = _mm_loadu_si128((const __m128i *)(s + i));
+        if ((stop = block_ssse3(s, i, v, prev, 0xffff, escape)) != SIZE_MAX) {
+            return stop;
+        }
+        prev = v;
+    }
+    if (i < len) {
+        v = load_tail_ssse3(s + i, len - i);
+        if ((stop = block_ssse3(s, i, v, prev, (1U << (len - i)) - 1, escape)) != SIZE_MAX) {
+            return stop;
+        }
+    }
+    return seq_start(s, len);
+}
+#endif  /* __SSE2__ */
+
+static size_t (*text_run)(const unsigned char *s, size_t len, bool escape) =
+    text_run_scalar;
+
+#ifdef __SSE2__
+/*
+ * Picks the widest text_run() the CPU has, once.
+ */
+__attribute__((constructor))
+static void
+text_run_init(void)
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        text_run = text_run_avx2;
+    } else if (__builtin_cpu_supports("ssse3")) {
+        text_run = text_run_ssse3;
+    }
+}
+#endif  /* __SSE2__ */
+
+/*
+ * Copies `srclen' bytes of `src' into `dst' as
+ * valid UTF-8, escaping markup if UTF8_ESCAPE
+ * is in `flags'. If the result does not fit in
+ * `dstlen' (including the terminator), it is cut
+ * at a grapheme boundary and "…" is appended.
+ *
+ * Returns the length of the result.
+ */
+size_t
+utf8_sanitize(char *dst, size_t dstlen, const char *src, size_t srclen,
+              int flags)
+{
+    const unsigned char *s = (const unsigned char *)src;
+    bool escape = (flags & UTF8_ESCAPE) != 0;
+    struct out o = { .p = dst, .cap = dstlen - 1 };
+    size_t i = 0, run, room, n = 0;
+    uint32_t cp = 0;
+
+    if (dstlen == 0) {
+        return 0;
+    }
+
+    while (i < srclen) {
+        /* Short runs of ASCII are not worth setting up vectors for */
+        for (run = 0; run < SHORT_RUN && run < srclen - i && s[i + run] < 0x80 &&
+             !(escape && needs_escape(s[i + run])); ++run);
+        if (run > 0 && run < SHORT_RUN) {
+            if (!out_ascii(&o, src + i, run)) {
+                break;
+            }
+            i += run;
+            continue;
+        }
+
+        if (escape && needs_escape(s[i])) {
+            const char *ent = s[i] == '&' ? "&amp;" : s[i] == '<' ? "&lt;" : "&gt;";
+
+            if (!out_put(&o, s[i], ent, strlen(ent))) {
+                break;
+            }
+            ++i;
+            continue;
+        }
+
+        if (s[i] >= 0x80 && (n = decode(s + i, srclen - i, &cp)) == 0) {
+            /* Replace one bad byte at a time */
+            if (!out_put(&o, 0xfffd, REPLACEMENT, 3)) {
+                break;
+            }
+            ++i;
+            continue;
+        }
+
+        /* Valid text from here, as far as it leaves room for "..." */
+        room = o.cap - o.len > ELLIPSIS_LEN ? o.cap - o.len - ELLIPSIS_LEN : 0;
+        if ((run = text_run(s + i, srclen - i < room ? srclen - i : room, escape)) > 0) {
+            out_text(&o, src + i, run);
+            i += run;
+            continue;
+        }
+
+        /* Near the end (or without vectors) it goes one codepoint at a time */
+        if (s[i] < 0x80) {
+            if (!out_ascii(&o, src + i, 1)) {
+                break;
+            }
+            ++i;
+            continue;
+        }
+        if (!out_put(&o, cp, src + i, n)) {
+            break;
+        }
+        i += n;
+    }
+
+    if (o.truncated) {
+        if (o.cap < ELLIPSIS_LEN) {
+            dst[0] = '\0';
+            return 0;
+        }
+        o.len = o.safe;
+        memcpy(o.p + o.len, ELLIPSIS, ELLIPSIS_LEN);
+        o.len += ELLIPSIS_LEN;
+    }
+
+    dst[o.len] = '\0';
+    return o.len;
+}
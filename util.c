@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "util.h"
+
+/*
+ * Formats a duration in a human readable
+ * form, e.g., "850ms", "12.3s", "4m12s"
+ * or "1h02m".
+ *
+ * @ms: Duration in milliseconds.
+ *
+ * Returns the length of the formatted string.
+ */
+size_t
+fmt_duration(char *buf, size_t len, long long ms)
+{
+    int n;
+
+    if (ms < 1000) {
+        n = snprintf(buf, len, "%lldms", ms);
+    } else if (ms < 60 * 1000) {
+        n = snprintf(buf, len, "%lld.%llds", ms / 1000, (ms % 1000) / 100);
+    } else if (ms < 60 * 60 * 1000) {
+        n = snprintf(buf, len, "%lldm%02llds", ms / 60000, (ms / 1000) % 60);
+    } else {
+        n = snprintf(buf, len, "%lldh%02lldm", ms / 3600000, (ms / 60000) % 60);
+    }
+
+    if (n < 0) {
+        return 0;
+    }
+    return (size_t)n >= len ? len - 1 : (size_t)n;
+}
+
+/*
+ * FNV-1a hash of `len' bytes at `p',
+ * continuing from `h'.
+ */
+uint64_t
+hash_bytes(const void *p, size_t len, uint64_t h)
+{
+    const unsigned char *c = p;
+
+    for (size_t i = 0; i < len; ++i) {
+        h ^= c[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+/*
+ * Returns a key identifying the command line in
+ * `argv', never 0 so 0 can be used as "no key".
+ */
+uint64_t
+argv_key(char **argv)
+{
+    uint64_t h = HASH_INIT;
+
+    for (; *argv != NULL; ++argv) {
+        /* Include the terminator so "a b" != "ab" */
+        h = hash_bytes(*argv, strlen(*argv) + 1, h);
+    }
+    return h != 0 ? h : 1;
+}
+
+/*
+ * Copies the text between `p' and `end' to
+ * `buf' as shown on a terminal, without
+ * escape sequences and with lines that were
+ * redrawn after a '\r' replaced.
+ */
+size_t
+term_clean(char *buf, size_t len, const char *p, const char *end)
+{
+    size_t off = 0, line = 0;
+
+    for (; p < end && off < len - 1; ++p) {
+        if (*p == '\033') {
+            /* CSI sequences end at 0x40-0x7e, skip anything else as a pair */
+            if (++p < end && *p == '[') {
+                while (++p < end && (*p < 0x40 || *p > 0x7e));
+            }
+            continue;
+        }
+
+        if (*p == '\r') {
+            if (p + 1 < end && p[1] != '\n') {
+                off = line;
+            }
+            continue;
+        }
+
+        if ((unsigned char)*p < ' ' && *p != '\n' && *p != '\t') {
+            continue;
+        }
+
+        buf[off++] = *p;
+        if (*p == '\n') {
+            line = off;
+        }
+    }
+
+    buf[off] = '\0';
+    return off;
+}
@@ -0,0 +1,236 @@
+/*
+ * Copyright (c) 2023-2024 Ian Marco Moffett.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "xdg.h"
+
+#define APP_DIRNAME "cmdnotify"
+
+/*
+ * Returns true if `path' is a directory (not a
+ * symlink to one) only we can get into. Anyone
+ * can create one in /tmp before we do.
+ */
+bool
+xdg_private(const char *path)
+{
+    struct stat sb;
+
+    if (lstat(path, &sb) < 0) {
+        return false;
+    }
+    return S_ISDIR(sb.st_mode) && sb.st_uid == getuid() &&
+           (sb.st_mode & 0777) == 0700;
+}
+
+/*
+ * Returns the base directory for `dir',
+ * falling back to the defaults from the
+ * XDG base directory specification.
+ *
+ * @dir: Which base directory.
+ * @buf: Buffer to use for fallbacks.
+ * @len: Size of `buf'.
+ */
+static const char *
+xdg_base(enum xdg_dir dir, char *buf, size_t len)
+{
+    static const char *envs[] = {
+        [XDG_RUNTIME] = "XDG_RUNTIME_DIR",
+        [XDG_STATE] = "XDG_STATE_HOME",
+        [XDG_CONFIG] = "XDG_CONFIG_HOME",
+        [XDG_CACHE] = "XDG_CACHE_HOME"
+    };
+    static const char *fallbacks[] = {
+        [XDG_STATE] = ".local/state",
+        [XDG_CONFIG] = ".config",
+        [XDG_CACHE] = ".cache"
+    };
+    const char *base = getenv(envs[dir]);
+    const char *home;
+
+    if (base != NULL && base[0] == '/') {
+        return base;
+    }
+
+    /*
+     * No runtime directory, use a per-user
+     * directory in /tmp instead.
+     */
+    if (dir == XDG_RUNTIME) {
+        snprintf(buf, len, "/tmp/%s-%u", APP_DIRNAME, (unsigned)getuid());
+        if (mkdir(buf, 0700) < 0 && errno != EEXIST) {
+            return NULL;
+        }
+        if (!xdg_private(buf)) {
+            errno = EACCES;
+            return NULL;
+        }
+        return buf;
+    }
+
+    if ((home = getenv("HOME")) == NULL) {
+        return NULL;
+    }
+
+    snprintf(buf, len, "%s/%s", home, fallbacks[dir]);
+    return buf;
+}
+
+/*
+ * Creates every directory leading up to
+ * and including `path'.
+ */
+static int
+mkdirs(char *path)
+{
+    char *p;
+
+    for (p = path + 1; *p != '\0'; ++p) {
+        if (*p != '/') {
+            continue;
+        }
+
+        *p = '\0';
+        if (mkdir(path, 0700) < 0 && errno != EEXIST) {
+            *p = '/';
+            return -1;
+        }
+        *p = '/';
+    }
+
+    if (mkdir(path, 0700) < 0 && errno != EEXIST) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Creates a path to `name' within our directory
+ * under the XDG base directory `dir', creating
+ * our directory if needed. If `name' is NULL,
+ * the path of our directory itself is returned.
+ *
+ * For example, with $XDG_RUNTIME_DIR set to
+ * "/run/user/1000" and `name' as "spans.json",
+ * `buf' will be "/run/user/1000/cmdnotify/spans.json"
+ *
+ * Returns 0 on success, otherwise -1.
+ */
+int
+xdg_path(enum xdg_dir dir, const char *name, char *buf, size_t len)
+{
+    char basebuf[256];
+    const char *base;
+    int n;
+
+    if ((base = xdg_base(dir, basebuf, sizeof(basebuf))) == NULL) {
+        return -1;
+    }
+
+    n = snprintf(buf, len, "%s/%s", base, APP_DIRNAME);
+    if (n < 0 || (size_t)n >= len) {
+        return -1;
+    }
+
+    if (mkdirs(buf) < 0) {
+        return -1;
+    }
+
+    if (name == NULL) {
+        return 0;
+    }
+
+    n = snprintf(buf, len, "%s/%s/%s", base, APP_DIRNAME, name);
+    if (n < 0 || (size_t)n >= len) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Maps `size' bytes of the file `name' under
+ * the XDG base directory `dir' shared and
+ * writable, creating it (zero filled) if needed.
+ *
+ * @fdp: Set to the file descriptor, callers
+ *       may flock() it to serialize updates.
+ *
+ * Returns the mapping, or NULL on failure.
+ */
+void *
+xdg_map(enum xdg_dir dir, const char *name, size_t size, int *fdp)
+{
+    char path[256];
+    struct stat sb;
+    void *p;
+    int fd;
+
+    if (xdg_path(dir, name, path, sizeof(path)) < 0) {
+        return NULL;
+    }
+
+    fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    if (fstat(fd, &sb) < 0 ||
+        (sb.st_size < (off_t)size && ftruncate(fd, size) < 0)) {
+        close(fd);
+        return NULL;
+    }
+
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+
+    *fdp = fd;
+    return p;
+}
+
+/*
+ * Undoes xdg_map().
+ */
+void
+xdg_unmap(void *p, size_t size, int fd)
+{
+    munmap(p, size);
+    close(fd);
+}